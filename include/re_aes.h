@@ -15,6 +15,13 @@ enum aes_mode {
 	AES_MODE_GCM,  /**< AES Galois Counter Mode (GCM) */
 };
 
+/** Defines one buffer of an AES Counter mode batch */
+struct aes_ctr_buf {
+	const uint8_t *iv;  /**< Initial counter block       */
+	uint8_t *data;      /**< Data, processed in place    */
+	size_t len;         /**< Length of data in [bytes]   */
+};
+
 struct aes;
 
 int  aes_alloc(struct aes **stp, enum aes_mode mode,
@@ -25,3 +32,5 @@ int  aes_encr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len);
 int  aes_decr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len);
 int  aes_get_authtag(struct aes *aes, uint8_t *tag, size_t taglen);
 int  aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen);
+int  aes_ctr_batch(struct aes *aes, const struct aes_ctr_buf *bufv,
+		   size_t n);
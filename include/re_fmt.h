@@ -42,6 +42,8 @@ int      pl_strcasecmp(const struct pl *pl, const char *str);
 int      pl_cmp(const struct pl *pl1, const struct pl *pl2);
 int      pl_casecmp(const struct pl *pl1, const struct pl *pl2);
 const char *pl_strchr(const struct pl *pl, char c);
+const char *pl_find_any(const struct pl *pl, const char *set);
+int      pl_getline(struct pl *pl, struct pl *line);
 
 /** Advance pl position/length by +/- N bytes */
 static inline void pl_advance(struct pl *pl, ssize_t n)
@@ -94,7 +96,14 @@ int re_sdprintf(char **strp, const char *fmt, ...);
 
 
 /* Regular expressions */
+struct regex;
+
 int re_regex(const char *ptr, size_t len, const char *expr, ...);
+int re_regex_compile(struct regex **rxp, const char *expr);
+int re_regex_exec(const struct regex *rx, const char *ptr, size_t len, ...);
+int re_regex_cached(struct regex **rxp, const char *ptr, size_t len,
+		    const char *expr, ...);
+void re_regex_flush(void);
 
 
 /* Character functions */
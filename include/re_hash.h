@@ -7,9 +7,29 @@
 
 struct hash;
 struct pl;
+struct re_printf;
+
+/**
+ * Defines the key handler of a resizable hashmap table
+ *
+ * @param le List element
+ *
+ * @return Hash key of the element
+ */
+typedef uint32_t (hash_key_h)(struct le *le);
+
+/** Hashmap table statistics */
+struct hashstat {
+	uint32_t elements;   /**< Number of elements            */
+	uint32_t bsize;      /**< Bucket size                   */
+	uint32_t osize;      /**< Old bucket size, if resizing  */
+	uint32_t used;       /**< Number of non-empty buckets   */
+	uint32_t chain_max;  /**< Longest chain                 */
+};
 
 
 int  hash_alloc(struct hash **hp, uint32_t bsize);
+int  hash_alloc_resizable(struct hash **hp, uint32_t bsize, hash_key_h *keyh);
 void hash_append(struct hash *h, uint32_t key, struct le *le, void *data);
 void hash_unlink(struct le *le);
 struct le *hash_lookup(const struct hash *h, uint32_t key, list_apply_h *ah,
@@ -20,6 +40,32 @@ uint32_t hash_bsize(const struct hash *h);
 void hash_flush(struct hash *h);
 void hash_clear(struct hash *h);
 uint32_t hash_valid_size(uint32_t size);
+int  hash_get_stat(const struct hash *h, struct hashstat *hstat);
+int  hash_debug(struct re_printf *pf, const struct hash *h);
+
+
+/* Integer key map */
+struct intmap;
+
+/**
+ * Defines the apply handler of an integer key map
+ *
+ * @param key Key of the element
+ * @param val Element data
+ * @param arg Handler argument
+ *
+ * @return true to stop traversing, false to continue
+ */
+typedef bool (intmap_apply_h)(uint64_t key, void *val, void *arg);
+
+int   intmap_alloc(struct intmap **mp, uint32_t size);
+int   intmap_add(struct intmap *m, uint64_t key, void *val);
+void *intmap_remove(struct intmap *m, uint64_t key);
+void *intmap_find(const struct intmap *m, uint64_t key);
+void *intmap_apply(const struct intmap *m, intmap_apply_h *ah, void *arg);
+uint32_t intmap_count(const struct intmap *m);
+void  intmap_flush(struct intmap *m);
+void  intmap_clear(struct intmap *m);
 
 
 /* Hash functions */
@@ -31,3 +77,15 @@ uint32_t hash_joaat_pl(const struct pl *pl);
 uint32_t hash_joaat_pl_ci(const struct pl *pl);
 uint32_t hash_fast(const char *k, size_t len);
 uint32_t hash_fast_str(const char *str);
+uint64_t hash_fast64(const void *key, size_t len);
+uint64_t hash_fast64_ci(const char *str, size_t len);
+uint64_t hash_fast64_str(const char *str);
+uint64_t hash_fast64_str_ci(const char *str);
+uint64_t hash_fast64_pl(const struct pl *pl);
+uint64_t hash_fast64_pl_ci(const struct pl *pl);
+uint32_t hash_fast32(const void *key, size_t len);
+uint32_t hash_fast32_ci(const char *str, size_t len);
+uint32_t hash_fast32_str(const char *str);
+uint32_t hash_fast32_str_ci(const char *str);
+uint32_t hash_fast32_pl(const struct pl *pl);
+uint32_t hash_fast32_pl_ci(const struct pl *pl);
@@ -17,12 +17,39 @@ struct jbuf_stat {
 	uint32_t n_overflow;   /**< Number of overflows                     */
 	uint32_t n_underflow;  /**< Number of underflows                    */
 	uint32_t n_flush;      /**< Number of times jitter buffer flushed   */
+	uint32_t n_skip;       /**< Number of frames skipped to cut delay   */
+	uint32_t jitter;       /**< Inter-arrival jitter [ms]               */
+	uint32_t target;       /**< Target playout delay [ms]               */
+	uint32_t delay;        /**< Current playout delay [ms]              */
 };
 
 
+/** Jitter buffer type */
+enum jbuf_type {
+	JBUF_FIXED = 0,   /**< Fixed delay of min to max frames          */
+	JBUF_ADAPTIVE,    /**< Target delay follows the measured jitter  */
+};
+
+/**
+ * Defines the delay policy of an adaptive jitter buffer
+ *
+ * @param jitter Inter-arrival jitter [ms]
+ * @param ptime  Packet time [ms]
+ * @param arg    Handler argument
+ *
+ * @return Target playout delay [ms]
+ */
+typedef uint32_t (jbuf_delay_h)(uint32_t jitter, uint32_t ptime, void *arg);
+
+
 int  jbuf_alloc(struct jbuf **jbp, uint32_t min, uint32_t max);
+int  jbuf_set_type(struct jbuf *jb, enum jbuf_type type, uint32_t srate);
+void jbuf_set_delay_handler(struct jbuf *jb, jbuf_delay_h *delayh,
+			    void *arg);
 int  jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem);
 int  jbuf_get(struct jbuf *jb, struct rtp_header *hdr, void **mem);
+int  jbuf_get_ts(struct jbuf *jb, struct rtp_header *hdrv, void **memv,
+		 size_t *n);
 void jbuf_flush(struct jbuf *jb);
 int  jbuf_stats(const struct jbuf *jb, struct jbuf_stat *jstat);
 int  jbuf_debug(struct re_printf *pf, const struct jbuf *jb);
@@ -12,7 +12,8 @@ enum {
 #ifndef FD_WRITE
 	FD_WRITE  = 1<<1,
 #endif
-	FD_EXCEPT = 1<<2
+	FD_EXCEPT = 1<<2,
+	FD_EDGE   = 1<<3   /**< Edge-triggered, handler drains until EAGAIN */
 };
 
 
@@ -50,6 +51,21 @@ void re_thread_enter(void);
 void re_thread_leave(void);
 
 void re_set_mutex(void *mutexp);
+int  re_set_edge_triggered(bool enable);
+
+
+/**
+ * Defines a cross-loop call handler
+ *
+ * @param arg Handler argument
+ */
+typedef void (re_pool_h)(void *arg);
+
+int      re_pool_start(unsigned n);
+void     re_pool_stop(void);
+unsigned re_pool_count(void);
+int      re_pool_index(void);
+int      re_pool_call(unsigned idx, re_pool_h *h, void *arg);
 
 
 /** Polling methods */
@@ -59,6 +75,7 @@ enum poll_method {
 	METHOD_SELECT,
 	METHOD_EPOLL,
 	METHOD_KQUEUE,
+	METHOD_IO_URING,
 	/* sep */
 	METHOD_MAX
 };
@@ -42,6 +42,7 @@ struct re_printf;
 
 struct mbuf *mbuf_alloc(size_t size);
 struct mbuf *mbuf_alloc_ref(struct mbuf *mbr);
+struct mbuf *mbuf_share(struct mbuf *mb);
 void     mbuf_init(struct mbuf *mb);
 void     mbuf_reset(struct mbuf *mb);
 int      mbuf_resize(struct mbuf *mb, size_t size);
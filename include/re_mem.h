@@ -25,6 +25,9 @@ struct memstat {
 
 void    *mem_alloc(size_t size, mem_destroy_h *dh);
 void    *mem_zalloc(size_t size, mem_destroy_h *dh);
+void    *mem_pool_alloc(size_t size, mem_destroy_h *dh);
+void    *mem_alloc_shared(size_t size, mem_destroy_h *dh);
+void    *mem_share(void *data);
 void    *mem_realloc(void *data, size_t size);
 void    *mem_reallocarray(void *ptr, size_t nmemb,
 			  size_t membsize, mem_destroy_h *dh);
@@ -43,3 +46,4 @@ int      mem_get_stat(struct memstat *mstat);
 int  mem_seccmp(const volatile uint8_t *volatile s1,
 		const volatile uint8_t *volatile s2,
 		size_t n);
+void mem_secclean(void *data, size_t size);
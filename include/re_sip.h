@@ -165,6 +165,12 @@ struct sip_taddr {
 	struct pl val;
 };
 
+/** SIP To/From header, as decoded by sip_msg_decode() */
+struct sip_tagval {
+	struct pl tag;         /**< Tag parameter */
+	struct pl val;         /**< Header value  */
+};
+
 /** SIP CSeq header */
 struct sip_cseq {
 	struct pl met;
@@ -180,30 +186,35 @@ struct sip_hdr {
 	enum sip_hdrid id;     /**< SIP Header id (unique) */
 };
 
-/** SIP Message */
+/**
+ * SIP Message
+ *
+ * @note Since version 0.6.0 the Request-URI, the Content-Type, the opaque
+ *       tag and the address parts of To and From are decoded on first use.
+ *       The fields uri, ctyp, tag and hdrht were removed, and to and from
+ *       only hold the tag and value. Use sip_msg_uri(), sip_msg_ctype(),
+ *       sip_msg_tag(), sip_msg_to(), sip_msg_from() and sip_msg_hdr().
+ */
 struct sip_msg {
 	struct sa src;         /**< Source network address               */
 	struct sa dst;         /**< Destination network address          */
 	struct pl ver;         /**< SIP Version number                   */
 	struct pl met;         /**< Request method                       */
 	struct pl ruri;        /**< Raw request URI                      */
-	struct uri uri;        /**< Parsed request URI                   */
 	uint16_t scode;        /**< Response status code                 */
 	struct pl reason;      /**< Response reason phrase               */
 	struct list hdrl;      /**< List of SIP Headers (struct sip_hdr) */
 	struct sip_via via;    /**< Parsed first Via header              */
-	struct sip_taddr to;   /**< Parsed To header                     */
-	struct sip_taddr from; /**< Parsed From header                   */
+	struct sip_tagval to;  /**< To tag and value, see sip_msg_to()   */
+	struct sip_tagval from; /**< From tag and value, sip_msg_from()  */
 	struct sip_cseq cseq;  /**< Parsed CSeq header                   */
-	struct msg_ctype ctyp; /**< Content Type                         */
 	struct pl callid;      /**< Cached Call-ID header                */
 	struct pl maxfwd;      /**< Cached Max-Forwards header           */
 	struct pl expires;     /**< Cached Expires header                */
 	struct pl clen;        /**< Cached Content-Length header         */
-	struct hash *hdrht;    /**< Hash-table with all SIP headers      */
+	struct sip_msgpriv *priv; /**< Private, headers and decoded fields */
 	struct mbuf *mb;       /**< Buffer containing the SIP message    */
 	void *sock;            /**< Transport socket                     */
-	uint64_t tag;          /**< Opaque tag                           */
 	enum sip_transp tp;    /**< SIP Transport                        */
 	bool req;              /**< True if Request, False if Response  */
 };
@@ -225,6 +236,7 @@ struct sip;
 struct sip_lsnr;
 struct sip_request;
 struct sip_strans;
+struct sip_rtmpl;
 struct sip_auth;
 struct sip_dialog;
 struct sip_keepalive;
@@ -303,6 +315,13 @@ int  sip_replyf(struct sip *sip, const struct sip_msg *msg, uint16_t scode,
 int  sip_reply(struct sip *sip, const struct sip_msg *msg, uint16_t scode,
 	       const char *reason);
 void sip_reply_addr(struct sa *addr, const struct sip_msg *msg, bool rport);
+int  sip_rtmpl_alloc(struct sip_rtmpl **tmplp, const struct sip *sip,
+		     uint16_t scode, const char *reason, const char *fmt, ...);
+int  sip_rtmpl_treply(struct sip_strans **stp, struct sip *sip,
+		      const struct sip_msg *msg, bool rec_route,
+		      const struct sip_rtmpl *tmpl, const struct pl *hdrs);
+int  sip_rtmpl_reply(struct sip *sip, const struct sip_msg *msg,
+		     const struct sip_rtmpl *tmpl, const struct pl *hdrs);
 
 
 /* auth */
@@ -356,6 +375,11 @@ bool sip_msg_hdr_has_value(const struct sip_msg *msg, enum sip_hdrid id,
 			   const char *value);
 bool sip_msg_xhdr_has_value(const struct sip_msg *msg, const char *name,
 			    const char *value);
+uint64_t sip_msg_tag(const struct sip_msg *msg);
+const struct sip_taddr *sip_msg_to(const struct sip_msg *msg);
+const struct sip_taddr *sip_msg_from(const struct sip_msg *msg);
+const struct uri *sip_msg_uri(const struct sip_msg *msg);
+const struct msg_ctype *sip_msg_ctype(const struct sip_msg *msg);
 struct tcp_conn *sip_msg_tcpconn(const struct sip_msg *msg);
 void sip_msg_dump(const struct sip_msg *msg);
 
@@ -24,7 +24,14 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 	       const uint8_t *key, size_t key_bytes, int flags);
 int srtp_encrypt(struct srtp *srtp, struct mbuf *mb);
 int srtp_decrypt(struct srtp *srtp, struct mbuf *mb);
+int srtp_encrypt_batch(struct srtp *srtp, struct mbuf **mbv, int *errv,
+		       size_t n);
+int srtp_decrypt_batch(struct srtp *srtp, struct mbuf **mbv, int *errv,
+		       size_t n);
 int srtcp_encrypt(struct srtp *srtp, struct mbuf *mb);
 int srtcp_decrypt(struct srtp *srtp, struct mbuf *mb);
+int srtp_set_stream_limit(struct srtp *srtp, uint32_t max_streams,
+			  uint32_t idle);
+uint32_t srtp_stream_count(const struct srtp *srtp);
 
 const char *srtp_suite_name(enum srtp_suite suite);
@@ -22,15 +22,21 @@ typedef void (udp_error_h)(int err, void *arg);
 
 int  udp_listen(struct udp_sock **usp, const struct sa *local,
 		udp_recv_h *rh, void *arg);
+int  udp_listen_reuseport(struct udp_sock **usp, const struct sa *local,
+			  udp_recv_h *rh, void *arg);
 int  udp_connect(struct udp_sock *us, const struct sa *peer);
 int  udp_send(struct udp_sock *us, const struct sa *dst, struct mbuf *mb);
 int  udp_send_anon(const struct sa *dst, struct mbuf *mb);
+int  udp_send_batch(struct udp_sock *us, const struct sa *dst,
+		    struct mbuf *mb);
+int  udp_send_flush(struct udp_sock *us);
 int  udp_local_get(const struct udp_sock *us, struct sa *local);
 int  udp_setsockopt(struct udp_sock *us, int level, int optname,
 		    const void *optval, uint32_t optlen);
 int  udp_sockbuf_set(struct udp_sock *us, int size);
 void udp_rxsz_set(struct udp_sock *us, size_t rxsz);
 void udp_rxbuf_presz_set(struct udp_sock *us, size_t rx_presz);
+int  udp_rxbatch_set(struct udp_sock *us, unsigned n);
 void udp_handler_set(struct udp_sock *us, udp_recv_h *rh, void *arg);
 void udp_error_handler_set(struct udp_sock *us, udp_error_h *eh);
 int  udp_thread_attach(struct udp_sock *us);
@@ -556,6 +556,10 @@ HAVE_EPOLL   := $(shell [ -f $(SYSROOT)/include/sys/epoll.h ] || \
 			[ -f $(SYSROOT)/include/$(MACHINE)/sys/epoll.h ] \
 			&& echo "1")
 endif
+ifeq ($(OS),linux)
+HAVE_IO_URING := $(shell grep -qs IORING_POLL_ADD_MULTI \
+			$(SYSROOT)/include/linux/io_uring.h && echo "1")
+endif
 
 HAVE_RESOLV := $(shell [ -f $(SYSROOT)/include/resolv.h ] && echo "1")
 
@@ -588,6 +592,9 @@ CFLAGS  += -DHAVE_SYS_TIME_H
 ifneq ($(HAVE_EPOLL),)
 CFLAGS  += -DHAVE_EPOLL
 endif
+ifneq ($(HAVE_IO_URING),)
+CFLAGS  += -DHAVE_IO_URING
+endif
 ifneq ($(HAVE_KQUEUE),)
 CFLAGS  += -DHAVE_KQUEUE
 endif
@@ -1,5 +1,5 @@
 %define name     re
-%define ver      0.5.9
+%define ver      0.6.0
 %define rel      1
 
 Summary: Generic library for real-time communications with async IO support
@@ -143,3 +143,34 @@ int aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen)
 
 	return ENOSYS;
 }
+
+
+/**
+ * Encrypt or decrypt a batch of buffers in Counter mode, each with its
+ * own initial counter block
+ *
+ * @param aes  AES Context
+ * @param bufv Buffers, processed in place
+ * @param n    Number of buffers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_ctr_batch(struct aes *aes, const struct aes_ctr_buf *bufv, size_t n)
+{
+	size_t i;
+	int err;
+
+	if (!aes || (!bufv && n))
+		return EINVAL;
+
+	for (i=0; i<n; i++) {
+
+		aes_set_iv(aes, bufv[i].iv);
+
+		err = aes_encr(aes, bufv[i].data, bufv[i].data, bufv[i].len);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
@@ -6,6 +6,10 @@
 
 ifneq ($(USE_OPENSSL_AES),)
 SRCS	+= aes/openssl/aes.c
+ifeq ($(ARCH),x86_64)
+SRCS	+= aes/native/aesni.c
+CFLAGS	+= -DUSE_AESNI
+endif
 else ifneq ($(USE_APPLE_COMMONCRYPTO),)
 SRCS	+= aes/apple/aes.c
 else
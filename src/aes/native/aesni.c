@@ -0,0 +1,994 @@
+/**
+ * @file native/aesni.c  AES using AES-NI and PCLMULQDQ instructions
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <cpuid.h>
+#include <immintrin.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_aes.h>
+#include "aesni.h"
+
+
+#define DEBUG_MODULE "aesni"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * Counter mode and GCM for small packets, without the per-call overhead
+ * of a generic cipher API. The instructions are enabled per function, and
+ * only used if the CPU has them and the known-answer tests pass.
+ */
+#define TARGET __attribute__((target("aes,pclmul,sse4.1")))
+
+
+enum {
+	MAX_ROUNDS = 14,   /**< Rounds of AES-256        */
+	PIPELINE   = 4,    /**< Blocks encrypted at once */
+};
+
+
+/** Defines an AES-NI cipher context */
+struct aesni {
+	uint8_t rk[MAX_ROUNDS+1][AES_BLOCK_SIZE]; /**< Round keys          */
+	int rounds;                  /**< Number of rounds                 */
+	enum aes_mode mode;          /**< AES mode                         */
+	uint64_t hi;                 /**< Counter block, high 64 bits      */
+	uint64_t lo;                 /**< Counter block, low 64 bits       */
+	uint8_t ks[AES_BLOCK_SIZE];  /**< Keystream of a partial block     */
+	size_t ksoff;                /**< Used bytes of the keystream      */
+
+	/* GCM only */
+	uint8_t h[PIPELINE][AES_BLOCK_SIZE]; /**< Powers of the hash key  */
+	uint8_t ekj0[AES_BLOCK_SIZE]; /**< Encrypted first counter block   */
+	uint8_t y[AES_BLOCK_SIZE];   /**< GHASH state, byte reversed       */
+	uint8_t gbuf[AES_BLOCK_SIZE]; /**< Partial GHASH block             */
+	size_t glen;                 /**< Length of the partial block      */
+	uint64_t alen;               /**< Associated data [bytes]          */
+	uint64_t clen;               /**< Ciphertext [bytes]               */
+	bool data;                   /**< Associated data is complete      */
+};
+
+
+static inline uint64_t get_be64(const uint8_t *p)
+{
+	return (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 |
+		(uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+		(uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+		(uint64_t)p[6] << 8  | (uint64_t)p[7];
+}
+
+
+static inline void put_be64(uint8_t *p, uint64_t v)
+{
+	p[0] = (uint8_t)(v >> 56);
+	p[1] = (uint8_t)(v >> 48);
+	p[2] = (uint8_t)(v >> 40);
+	p[3] = (uint8_t)(v >> 32);
+	p[4] = (uint8_t)(v >> 24);
+	p[5] = (uint8_t)(v >> 16);
+	p[6] = (uint8_t)(v >> 8);
+	p[7] = (uint8_t)v;
+}
+
+
+static inline TARGET __m128i load(const uint8_t *p)
+{
+	return _mm_loadu_si128((const __m128i *)(const void *)p);
+}
+
+
+static inline TARGET void store(uint8_t *p, __m128i v)
+{
+	_mm_storeu_si128((__m128i *)(void *)p, v);
+}
+
+
+static inline TARGET __m128i bswap128(__m128i v)
+{
+	return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+						8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+
+static inline TARGET __m128i key_exp(__m128i k, __m128i t)
+{
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+
+	return _mm_xor_si128(k, t);
+}
+
+
+/* The round constant must be an immediate */
+#define EXP128(i, rcon)							\
+	k[i] = key_exp(k[i-1], _mm_shuffle_epi32(			\
+		_mm_aeskeygenassist_si128(k[i-1], rcon), 0xff))
+#define EXP256A(i, rcon)						\
+	k[i] = key_exp(k[i-2], _mm_shuffle_epi32(			\
+		_mm_aeskeygenassist_si128(k[i-1], rcon), 0xff))
+#define EXP256B(i)							\
+	k[i] = key_exp(k[i-2], _mm_shuffle_epi32(			\
+		_mm_aeskeygenassist_si128(k[i-1], 0x00), 0xaa))
+
+
+static TARGET void key_expand(struct aesni *a, const uint8_t *key,
+			      size_t key_bits)
+{
+	__m128i k[MAX_ROUNDS+1];
+	int i;
+
+	k[0] = load(key);
+
+	if (key_bits == 128) {
+		EXP128(1, 0x01);
+		EXP128(2, 0x02);
+		EXP128(3, 0x04);
+		EXP128(4, 0x08);
+		EXP128(5, 0x10);
+		EXP128(6, 0x20);
+		EXP128(7, 0x40);
+		EXP128(8, 0x80);
+		EXP128(9, 0x1b);
+		EXP128(10, 0x36);
+		a->rounds = 10;
+	}
+	else {
+		k[1] = load(key + 16);
+		EXP256A(2, 0x01);
+		EXP256B(3);
+		EXP256A(4, 0x02);
+		EXP256B(5);
+		EXP256A(6, 0x04);
+		EXP256B(7);
+		EXP256A(8, 0x08);
+		EXP256B(9);
+		EXP256A(10, 0x10);
+		EXP256B(11);
+		EXP256A(12, 0x20);
+		EXP256B(13);
+		EXP256A(14, 0x40);
+		a->rounds = 14;
+	}
+
+	for (i=0; i<=a->rounds; i++)
+		store(a->rk[i], k[i]);
+
+	mem_secclean(k, sizeof(k));
+}
+
+
+static inline TARGET __m128i encrypt1(const struct aesni *a, __m128i b)
+{
+	int r;
+
+	b = _mm_xor_si128(b, load(a->rk[0]));
+
+	for (r=1; r<a->rounds; r++)
+		b = _mm_aesenc_si128(b, load(a->rk[r]));
+
+	return _mm_aesenclast_si128(b, load(a->rk[a->rounds]));
+}
+
+
+/* Four independent blocks hide the latency of the AES instructions */
+static inline TARGET void encrypt4(const struct aesni *a, __m128i *b)
+{
+	__m128i k = load(a->rk[0]);
+	__m128i b0 = _mm_xor_si128(b[0], k);
+	__m128i b1 = _mm_xor_si128(b[1], k);
+	__m128i b2 = _mm_xor_si128(b[2], k);
+	__m128i b3 = _mm_xor_si128(b[3], k);
+	int r;
+
+	for (r=1; r<a->rounds; r++) {
+		k  = load(a->rk[r]);
+		b0 = _mm_aesenc_si128(b0, k);
+		b1 = _mm_aesenc_si128(b1, k);
+		b2 = _mm_aesenc_si128(b2, k);
+		b3 = _mm_aesenc_si128(b3, k);
+	}
+
+	k    = load(a->rk[a->rounds]);
+	b[0] = _mm_aesenclast_si128(b0, k);
+	b[1] = _mm_aesenclast_si128(b1, k);
+	b[2] = _mm_aesenclast_si128(b2, k);
+	b[3] = _mm_aesenclast_si128(b3, k);
+}
+
+
+/* The next counter block. GCM only increments the low 32 bits. */
+static inline TARGET __m128i ctr_next(uint64_t *hi, uint64_t *lo, bool gcm)
+{
+	__m128i c = _mm_set_epi64x((long long)__builtin_bswap64(*lo),
+				   (long long)__builtin_bswap64(*hi));
+
+	if (gcm)
+		*lo = (*lo & 0xffffffff00000000ULL) | (uint32_t)(*lo + 1);
+	else if (!++*lo)
+		++*hi;
+
+	return c;
+}
+
+
+static TARGET void ctr_xor(struct aesni *a, uint8_t *out, const uint8_t *in,
+			   size_t len)
+{
+	const bool gcm = a->mode == AES_MODE_GCM;
+	uint64_t hi = a->hi, lo = a->lo;
+	__m128i b[PIPELINE];
+	size_t i;
+
+	/* Rest of the keystream of the last partial block */
+	while (a->ksoff < AES_BLOCK_SIZE && len) {
+		*out++ = *in++ ^ a->ks[a->ksoff++];
+		--len;
+	}
+
+	while (len >= PIPELINE * AES_BLOCK_SIZE) {
+
+		for (i=0; i<PIPELINE; i++)
+			b[i] = ctr_next(&hi, &lo, gcm);
+
+		encrypt4(a, b);
+
+		for (i=0; i<PIPELINE; i++) {
+			const size_t o = i * AES_BLOCK_SIZE;
+
+			store(out + o, _mm_xor_si128(load(in + o), b[i]));
+		}
+
+		in  += PIPELINE * AES_BLOCK_SIZE;
+		out += PIPELINE * AES_BLOCK_SIZE;
+		len -= PIPELINE * AES_BLOCK_SIZE;
+	}
+
+	while (len >= AES_BLOCK_SIZE) {
+
+		b[0] = encrypt1(a, ctr_next(&hi, &lo, gcm));
+		store(out, _mm_xor_si128(load(in), b[0]));
+
+		in  += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+		len -= AES_BLOCK_SIZE;
+	}
+
+	if (len) {
+		store(a->ks, encrypt1(a, ctr_next(&hi, &lo, gcm)));
+
+		for (i=0; i<len; i++)
+			out[i] = in[i] ^ a->ks[i];
+
+		a->ksoff = len;
+	}
+
+	a->hi = hi;
+	a->lo = lo;
+}
+
+
+/* Carry-less multiply, to a 256-bit product (Intel CLMUL paper) */
+static inline TARGET void clmul(__m128i a, __m128i b, __m128i *lo,
+				__m128i *hi)
+{
+	__m128i t3, t4, t5, t6;
+
+	t3 = _mm_clmulepi64_si128(a, b, 0x00);
+	t4 = _mm_clmulepi64_si128(a, b, 0x10);
+	t5 = _mm_clmulepi64_si128(a, b, 0x01);
+	t6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t4 = _mm_xor_si128(t4, t5);
+	t5 = _mm_slli_si128(t4, 8);
+	t4 = _mm_srli_si128(t4, 8);
+
+	*lo = _mm_xor_si128(t3, t5);
+	*hi = _mm_xor_si128(t6, t4);
+}
+
+
+/* Reduce a product of byte reversed operands modulo the GCM polynomial */
+static inline TARGET __m128i reduce(__m128i t3, __m128i t6)
+{
+	__m128i t2, t4, t5, t7, t8, t9;
+
+	/* Shift the 256-bit product left by one */
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+
+	/* Reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+
+	return _mm_xor_si128(t6, t3);
+}
+
+
+static inline TARGET __m128i gfmul(__m128i a, __m128i b)
+{
+	__m128i lo, hi;
+
+	clmul(a, b, &lo, &hi);
+
+	return reduce(lo, hi);
+}
+
+
+/*
+ * Four blocks are multiplied by H^4..H^1 and reduced once, so that the
+ * multiplications do not wait for each other
+ */
+static TARGET void ghash_blocks(struct aesni *a, const uint8_t *p, size_t n)
+{
+	const __m128i h1 = load(a->h[0]);
+	__m128i y = load(a->y);
+
+	if (n >= PIPELINE) {
+
+		const __m128i h2 = load(a->h[1]);
+		const __m128i h3 = load(a->h[2]);
+		const __m128i h4 = load(a->h[3]);
+
+		while (n >= PIPELINE) {
+
+			__m128i lo, hi, l, h;
+
+			clmul(_mm_xor_si128(y, bswap128(load(p))), h4,
+			      &lo, &hi);
+
+			clmul(bswap128(load(p + 16)), h3, &l, &h);
+			lo = _mm_xor_si128(lo, l);
+			hi = _mm_xor_si128(hi, h);
+
+			clmul(bswap128(load(p + 32)), h2, &l, &h);
+			lo = _mm_xor_si128(lo, l);
+			hi = _mm_xor_si128(hi, h);
+
+			clmul(bswap128(load(p + 48)), h1, &l, &h);
+			lo = _mm_xor_si128(lo, l);
+			hi = _mm_xor_si128(hi, h);
+
+			y = reduce(lo, hi);
+
+			p += PIPELINE * AES_BLOCK_SIZE;
+			n -= PIPELINE;
+		}
+	}
+
+	while (n--) {
+		y = gfmul(_mm_xor_si128(y, bswap128(load(p))), h1);
+		p += AES_BLOCK_SIZE;
+	}
+
+	store(a->y, y);
+}
+
+
+static void ghash_update(struct aesni *a, const uint8_t *p, size_t len)
+{
+	size_t n;
+
+	if (a->glen) {
+		n = min(AES_BLOCK_SIZE - a->glen, len);
+
+		memcpy(a->gbuf + a->glen, p, n);
+		a->glen += n;
+		p   += n;
+		len -= n;
+
+		if (a->glen < AES_BLOCK_SIZE)
+			return;
+
+		ghash_blocks(a, a->gbuf, 1);
+		a->glen = 0;
+	}
+
+	n = len / AES_BLOCK_SIZE;
+	if (n)
+		ghash_blocks(a, p, n);
+
+	p   += n * AES_BLOCK_SIZE;
+	len -= n * AES_BLOCK_SIZE;
+
+	if (len) {
+		memcpy(a->gbuf, p, len);
+		a->glen = len;
+	}
+}
+
+
+/* Zero-pad a partial block */
+static void ghash_flush(struct aesni *a)
+{
+	if (!a->glen)
+		return;
+
+	memset(a->gbuf + a->glen, 0, AES_BLOCK_SIZE - a->glen);
+	ghash_blocks(a, a->gbuf, 1);
+	a->glen = 0;
+}
+
+
+static TARGET void encrypt_block(const struct aesni *a, uint8_t *out,
+				 const uint8_t *in)
+{
+	store(out, encrypt1(a, load(in)));
+}
+
+
+static void gcm_tag(struct aesni *a, uint8_t *tag)
+{
+	uint8_t lens[AES_BLOCK_SIZE];
+	size_t i;
+
+	ghash_flush(a);
+
+	put_be64(lens,     a->alen * 8);
+	put_be64(lens + 8, a->clen * 8);
+	ghash_blocks(a, lens, 1);
+
+	for (i=0; i<AES_BLOCK_SIZE; i++)
+		tag[i] = a->y[AES_BLOCK_SIZE-1-i] ^ a->ekj0[i];
+}
+
+
+/* H is the encrypted zero block, and its powers are for ghash_blocks() */
+static TARGET void hash_key(struct aesni *a)
+{
+	__m128i h, p;
+	int i;
+
+	h = p = bswap128(encrypt1(a, _mm_setzero_si128()));
+	store(a->h[0], h);
+
+	for (i=1; i<PIPELINE; i++) {
+		p = gfmul(p, h);
+		store(a->h[i], p);
+	}
+}
+
+
+static bool cpu_check(void)
+{
+	unsigned eax, ebx, ecx, edx;
+	const unsigned need = bit_AES | bit_PCLMUL | bit_SSSE3 | bit_SSE4_1;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return (ecx & need) == need;
+}
+
+
+/* FIPS-197 C.1 and C.3, and SP 800-38A F.5.1 */
+static const uint8_t kat_pt[16] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+static const uint8_t kat_ct128[16] = {
+	0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+	0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+};
+static const uint8_t kat_ct256[16] = {
+	0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+	0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89
+};
+static const uint8_t ctr_key[16] = {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const uint8_t ctr_iv[16] = {
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+static const uint8_t ctr_pt[64] = {
+	0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+	0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+	0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+	0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+	0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+	0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+	0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+	0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+static const uint8_t ctr_ct[64] = {
+	0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26,
+	0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+	0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff,
+	0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+	0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e,
+	0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+	0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1,
+	0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee
+};
+
+
+/* GCM test cases 2, 3 and 4 */
+static const uint8_t gcm_key[16] = {
+	0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+	0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08
+};
+static const uint8_t gcm_iv[12] = {
+	0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad,
+	0xde, 0xca, 0xf8, 0x88
+};
+static const uint8_t gcm_pt[64] = {
+	0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5,
+	0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+	0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda,
+	0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+	0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53,
+	0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+	0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57,
+	0xba, 0x63, 0x7b, 0x39, 0x1a, 0xaf, 0xd2, 0x55
+};
+static const uint8_t gcm_ct[64] = {
+	0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24,
+	0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+	0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0,
+	0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+	0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c,
+	0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+	0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97,
+	0x3d, 0x58, 0xe0, 0x91, 0x47, 0x3f, 0x59, 0x85
+};
+static const uint8_t gcm_aad[20] = {
+	0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+	0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+	0xab, 0xad, 0xda, 0xd2
+};
+static const uint8_t gcm_zero_ct[16] = {
+	0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92,
+	0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78
+};
+static const uint8_t gcm_tag2[16] = {
+	0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd,
+	0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf
+};
+static const uint8_t gcm_tag3[16] = {
+	0x4d, 0x5c, 0x2a, 0xf3, 0x27, 0xcd, 0x64, 0xa6,
+	0x2c, 0xf3, 0x5a, 0xbd, 0x2b, 0xa6, 0xfa, 0xb4
+};
+static const uint8_t gcm_tag4[16] = {
+	0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb,
+	0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47
+};
+
+
+/* One block of counter mode, the keystream of a zero block */
+static bool test_block(const uint8_t *key, size_t key_bits,
+		       const uint8_t *ct)
+{
+	uint8_t buf[AES_BLOCK_SIZE];
+	struct aesni *a;
+	bool ok;
+
+	if (aesni_alloc(&a, AES_MODE_CTR, key, key_bits))
+		return false;
+
+	memset(buf, 0, sizeof(buf));
+	aesni_set_iv(a, kat_pt);
+	aesni_crypt(a, buf, buf, sizeof(buf), true);
+	ok = !memcmp(buf, ct, sizeof(buf));
+
+	mem_deref(a);
+
+	return ok;
+}
+
+
+/* Four blocks in one call, then split over a partial block, then batch */
+static bool test_ctr(void)
+{
+	uint8_t buf[64], iv2[AES_BLOCK_SIZE];
+	struct aes_ctr_buf bufv[2];
+	struct aesni *a;
+	bool ok;
+
+	if (aesni_alloc(&a, AES_MODE_CTR, ctr_key, 128))
+		return false;
+
+	aesni_set_iv(a, ctr_iv);
+	aesni_crypt(a, buf, ctr_pt, sizeof(buf), true);
+	ok = !memcmp(buf, ctr_ct, sizeof(buf));
+
+	aesni_set_iv(a, ctr_iv);
+	aesni_crypt(a, buf, ctr_ct, 21, false);
+	aesni_crypt(a, buf + 21, ctr_ct + 21, sizeof(buf) - 21, false);
+	ok = ok && !memcmp(buf, ctr_pt, sizeof(buf));
+
+	/* The third block starts at counter + 2 */
+	memcpy(iv2, ctr_iv, sizeof(iv2));
+	iv2[14] = 0xff;
+	iv2[15] = 0x01;
+
+	memcpy(buf, ctr_pt, sizeof(buf));
+
+	bufv[0].iv   = ctr_iv;
+	bufv[0].data = buf;
+	bufv[0].len  = 32;
+	bufv[1].iv   = iv2;
+	bufv[1].data = buf + 32;
+	bufv[1].len  = 27;
+
+	ok = ok && !aesni_ctr_batch(a, bufv, 2) &&
+		!memcmp(buf, ctr_ct, 59) &&
+		!memcmp(buf + 59, ctr_pt + 59, sizeof(buf) - 59);
+
+	mem_deref(a);
+
+	return ok;
+}
+
+
+/* Encrypt in one call, decrypt split over a partial block */
+static bool test_gcm(const uint8_t *key, const uint8_t *iv,
+		     const uint8_t *aad, size_t aadlen,
+		     const uint8_t *pt, const uint8_t *ct, size_t len,
+		     const uint8_t *tag)
+{
+	uint8_t buf[64], t[AES_BLOCK_SIZE], iv16[AES_BLOCK_SIZE];
+	const size_t split = min(len, (size_t)19);
+	struct aesni *a;
+	bool ok;
+
+	if (aesni_alloc(&a, AES_MODE_GCM, key, 128))
+		return false;
+
+	memset(iv16, 0, sizeof(iv16));
+	memcpy(iv16, iv, 12);
+
+	aesni_set_iv(a, iv16);
+	if (aadlen)
+		aesni_crypt(a, NULL, aad, aadlen, true);
+	aesni_crypt(a, buf, pt, len, true);
+	ok = !memcmp(buf, ct, len) &&
+		!aesni_get_authtag(a, t, sizeof(t)) &&
+		!memcmp(t, tag, sizeof(t));
+
+	aesni_set_iv(a, iv16);
+	if (aadlen) {
+		aesni_crypt(a, NULL, aad, 7, false);
+		aesni_crypt(a, NULL, aad + 7, aadlen - 7, false);
+	}
+	aesni_crypt(a, buf, ct, split, false);
+	aesni_crypt(a, buf + split, ct + split, len - split, false);
+	ok = ok && !memcmp(buf, pt, len) &&
+		!aesni_authenticate(a, tag, AES_BLOCK_SIZE);
+
+	/* A modified tag must not authenticate */
+	memcpy(t, tag, sizeof(t));
+	t[0] ^= 0x01;
+
+	aesni_set_iv(a, iv16);
+	if (aadlen)
+		aesni_crypt(a, NULL, aad, aadlen, false);
+	aesni_crypt(a, buf, ct, len, false);
+	ok = ok && aesni_authenticate(a, t, sizeof(t)) == EAUTH;
+
+	mem_deref(a);
+
+	return ok;
+}
+
+
+static bool selftest(void)
+{
+	static const uint8_t zero[16];
+	uint8_t key[32];
+	int i;
+
+	for (i=0; i<32; i++)
+		key[i] = (uint8_t)i;
+
+	return test_block(key, 128, kat_ct128) &&
+		test_block(key, 256, kat_ct256) &&
+		test_ctr() &&
+		test_gcm(zero, zero, NULL, 0, zero, gcm_zero_ct, 16,
+			 gcm_tag2) &&
+		test_gcm(gcm_key, gcm_iv, NULL, 0, gcm_pt, gcm_ct, 64,
+			 gcm_tag3) &&
+		test_gcm(gcm_key, gcm_iv, gcm_aad, sizeof(gcm_aad),
+			 gcm_pt, gcm_ct, 60, gcm_tag4);
+}
+
+
+/**
+ * Check if AES-NI can be used, the result is cached
+ *
+ * @return true if available, otherwise false
+ */
+bool aesni_available(void)
+{
+	static int state;
+	int s, zero = 0;
+
+	s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+	if (s)
+		return s > 0;
+
+	/* Threads may race to run the checks, only the first one is kept */
+	s = (cpu_check() && selftest()) ? 1 : -1;
+
+	if (__atomic_compare_exchange_n(&state, &zero, s, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		if (s < 0 && cpu_check())
+			DEBUG_WARNING("known-answer tests failed\n");
+	}
+	else {
+		s = zero;
+	}
+
+	return s > 0;
+}
+
+
+static void destructor(void *arg)
+{
+	struct aesni *a = arg;
+
+	mem_secclean(a, sizeof(*a));
+}
+
+
+/**
+ * Allocate an AES-NI cipher context
+ *
+ * @param ap       Pointer to allocated context
+ * @param mode     AES mode, Counter mode or GCM
+ * @param key      Key
+ * @param key_bits Key length in bits, 128 or 256
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aesni_alloc(struct aesni **ap, enum aes_mode mode,
+		const uint8_t *key, size_t key_bits)
+{
+	struct aesni *a;
+
+	if (!ap || !key)
+		return EINVAL;
+
+	if (key_bits != 128 && key_bits != 256)
+		return ENOTSUP;
+
+	if (mode != AES_MODE_CTR && mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	a = mem_zalloc(sizeof(*a), destructor);
+	if (!a)
+		return ENOMEM;
+
+	a->mode  = mode;
+	a->ksoff = AES_BLOCK_SIZE;
+
+	key_expand(a, key, key_bits);
+
+	if (mode == AES_MODE_GCM)
+		hash_key(a);
+
+	*ap = a;
+
+	return 0;
+}
+
+
+/**
+ * Set the initial counter block. For GCM, the first 12 bytes are the IV.
+ *
+ * @param a  AES-NI cipher context
+ * @param iv Initial counter block, or IV
+ */
+void aesni_set_iv(struct aesni *a, const uint8_t *iv)
+{
+	if (!a || !iv)
+		return;
+
+	a->hi    = get_be64(iv);
+	a->lo    = get_be64(iv + 8);
+	a->ksoff = AES_BLOCK_SIZE;
+
+	if (a->mode != AES_MODE_GCM)
+		return;
+
+	/* J0 is IV || 1, and the data starts at J0 + 1 */
+	a->lo = (a->lo & 0xffffffff00000000ULL) | 1;
+
+	put_be64(a->ekj0,     a->hi);
+	put_be64(a->ekj0 + 8, a->lo);
+	encrypt_block(a, a->ekj0, a->ekj0);
+
+	++a->lo;
+
+	memset(a->y, 0, sizeof(a->y));
+	a->glen = 0;
+	a->alen = 0;
+	a->clen = 0;
+	a->data = false;
+}
+
+
+/**
+ * Encrypt or decrypt data. For GCM, the associated data is passed first
+ * with a NULL output.
+ *
+ * @param a    AES-NI cipher context
+ * @param out  Output buffer, or NULL for GCM associated data
+ * @param in   Input buffer
+ * @param len  Number of bytes
+ * @param encr True to encrypt, false to decrypt
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aesni_crypt(struct aesni *a, uint8_t *out, const uint8_t *in,
+		size_t len, bool encr)
+{
+	if (!a || !in)
+		return EINVAL;
+
+	if (a->mode != AES_MODE_GCM) {
+		if (!out)
+			return EINVAL;
+
+		ctr_xor(a, out, in, len);
+		return 0;
+	}
+
+	if (!out) {
+		if (a->data)
+			return EPROTO;
+
+		ghash_update(a, in, len);
+		a->alen += len;
+		return 0;
+	}
+
+	if (!a->data) {
+		ghash_flush(a);
+		a->data = true;
+	}
+
+	/* The hash is over the ciphertext */
+	if (!encr)
+		ghash_update(a, in, len);
+
+	ctr_xor(a, out, in, len);
+
+	if (encr)
+		ghash_update(a, out, len);
+
+	a->clen += len;
+
+	return 0;
+}
+
+
+/**
+ * Get the GCM authentication tag
+ *
+ * @param a      AES-NI cipher context
+ * @param tag    Authentication tag
+ * @param taglen Length of authentication tag
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aesni_get_authtag(struct aesni *a, uint8_t *tag, size_t taglen)
+{
+	uint8_t t[AES_BLOCK_SIZE];
+
+	if (!a || !tag || !taglen || taglen > sizeof(t))
+		return EINVAL;
+
+	if (a->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	gcm_tag(a, t);
+	memcpy(tag, t, taglen);
+
+	return 0;
+}
+
+
+/**
+ * Authenticate the GCM authentication tag of decrypted data
+ *
+ * @param a      AES-NI cipher context
+ * @param tag    Authentication tag
+ * @param taglen Length of authentication tag
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @retval EAUTH if authentication failed
+ */
+int aesni_authenticate(struct aesni *a, const uint8_t *tag, size_t taglen)
+{
+	uint8_t t[AES_BLOCK_SIZE];
+	int r;
+
+	if (!a || !tag || !taglen || taglen > sizeof(t))
+		return EINVAL;
+
+	if (a->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	gcm_tag(a, t);
+
+	r = mem_seccmp(t, tag, taglen);
+	mem_secclean(t, sizeof(t));
+
+	return r ? EAUTH : 0;
+}
+
+
+/**
+ * Encrypt or decrypt a batch of buffers in Counter mode, each with its
+ * own initial counter block. The counter of the context is not changed.
+ *
+ * @param a    AES-NI cipher context
+ * @param bufv Buffers, processed in place
+ * @param n    Number of buffers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aesni_ctr_batch(struct aesni *a, const struct aes_ctr_buf *bufv,
+		    size_t n)
+{
+	uint64_t hi, lo;
+	uint8_t ks[AES_BLOCK_SIZE];
+	size_t i, ksoff;
+
+	if (!a || (!bufv && n))
+		return EINVAL;
+
+	if (a->mode != AES_MODE_CTR)
+		return ENOTSUP;
+
+	hi    = a->hi;
+	lo    = a->lo;
+	ksoff = a->ksoff;
+	memcpy(ks, a->ks, sizeof(ks));
+
+	for (i=0; i<n; i++) {
+
+		a->hi    = get_be64(bufv[i].iv);
+		a->lo    = get_be64(bufv[i].iv + 8);
+		a->ksoff = AES_BLOCK_SIZE;
+
+		ctr_xor(a, bufv[i].data, bufv[i].data, bufv[i].len);
+	}
+
+	a->hi    = hi;
+	a->lo    = lo;
+	a->ksoff = ksoff;
+	memcpy(a->ks, ks, sizeof(ks));
+	mem_secclean(ks, sizeof(ks));
+
+	return 0;
+}
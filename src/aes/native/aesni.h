@@ -0,0 +1,19 @@
+/**
+ * @file native/aesni.h  AES using AES-NI instructions -- internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+struct aesni;
+
+bool aesni_available(void);
+int  aesni_alloc(struct aesni **ap, enum aes_mode mode,
+		 const uint8_t *key, size_t key_bits);
+void aesni_set_iv(struct aesni *a, const uint8_t *iv);
+int  aesni_crypt(struct aesni *a, uint8_t *out, const uint8_t *in,
+		 size_t len, bool encr);
+int  aesni_get_authtag(struct aesni *a, uint8_t *tag, size_t taglen);
+int  aesni_authenticate(struct aesni *a, const uint8_t *tag, size_t taglen);
+int  aesni_ctr_batch(struct aesni *a, const struct aes_ctr_buf *bufv,
+		     size_t n);
@@ -11,12 +11,24 @@
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_aes.h>
+#ifdef USE_AESNI
+#include "../native/aesni.h"
+#endif
+
+
+enum {
+	BATCH_BLOCKS = 64,  /**< Keystream blocks per cipher call */
+};
 
 
 struct aes {
 	EVP_CIPHER_CTX *ctx;
+	EVP_CIPHER_CTX *ecb;  /**< Keystream context for CTR batches */
 	enum aes_mode mode;
 	bool encr;
+#ifdef USE_AESNI
+	struct aesni *ni;     /**< Native cipher, used instead if set */
+#endif
 };
 
 
@@ -49,6 +61,51 @@ static const EVP_CIPHER *aes_cipher(enum aes_mode mode, size_t key_bits)
 }
 
 
+static const EVP_CIPHER *aes_cipher_ecb(size_t key_bits)
+{
+	switch (key_bits) {
+
+	case 128: return EVP_aes_128_ecb();
+	case 192: return EVP_aes_192_ecb();
+	case 256: return EVP_aes_256_ecb();
+	default:
+		return NULL;
+	}
+}
+
+
+static EVP_CIPHER_CTX *cipher_ctx_new(void)
+{
+	EVP_CIPHER_CTX *ctx;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	ctx = EVP_CIPHER_CTX_new();
+	if (!ctx)
+		ERR_clear_error();
+#else
+	ctx = mem_zalloc(sizeof(*ctx), NULL);
+	if (ctx)
+		EVP_CIPHER_CTX_init(ctx);
+#endif
+
+	return ctx;
+}
+
+
+static void cipher_ctx_free(EVP_CIPHER_CTX *ctx)
+{
+	if (!ctx)
+		return;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	EVP_CIPHER_CTX_free(ctx);
+#else
+	EVP_CIPHER_CTX_cleanup(ctx);
+	mem_deref(ctx);
+#endif
+}
+
+
 static inline bool set_crypt_dir(struct aes *aes, bool encr)
 {
 	if (aes->encr != encr) {
@@ -71,13 +128,10 @@ static void destructor(void *arg)
 {
 	struct aes *st = arg;
 
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
-	if (st->ctx)
-		EVP_CIPHER_CTX_free(st->ctx);
-#else
-	if (st->ctx)
-		EVP_CIPHER_CTX_cleanup(st->ctx);
-	mem_deref(st->ctx);
+	cipher_ctx_free(st->ctx);
+	cipher_ctx_free(st->ecb);
+#ifdef USE_AESNI
+	mem_deref(st->ni);
 #endif
 }
 
@@ -104,28 +158,45 @@ int aes_alloc(struct aes **aesp, enum aes_mode mode,
 	st->mode = mode;
 	st->encr = true;
 
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
-	st->ctx = EVP_CIPHER_CTX_new();
-	if (!st->ctx) {
-		ERR_clear_error();
-		err = ENOMEM;
+#ifdef USE_AESNI
+	/* Falls back to OpenSSL for key sizes it does not support */
+	if (aesni_available() &&
+	    !aesni_alloc(&st->ni, mode, key, key_bits)) {
+
+		aesni_set_iv(st->ni, iv);
 		goto out;
 	}
+#endif
 
-#else
-	st->ctx = mem_zalloc(sizeof(*st->ctx), NULL);
+	st->ctx = cipher_ctx_new();
 	if (!st->ctx) {
 		err = ENOMEM;
 		goto out;
 	}
 
-	EVP_CIPHER_CTX_init(st->ctx);
-#endif
-
 	r = EVP_EncryptInit_ex(st->ctx, cipher, NULL, key, iv);
 	if (!r) {
 		ERR_clear_error();
 		err = EPROTO;
+		goto out;
+	}
+
+	/* The Counter mode keystream of a batch is made in ECB mode */
+	if (mode == AES_MODE_CTR) {
+
+		st->ecb = cipher_ctx_new();
+		if (!st->ecb) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		r = EVP_EncryptInit_ex(st->ecb, aes_cipher_ecb(key_bits),
+				       NULL, key, NULL);
+		if (!r || !EVP_CIPHER_CTX_set_padding(st->ecb, 0)) {
+			ERR_clear_error();
+			err = EPROTO;
+			goto out;
+		}
 	}
 
  out:
@@ -145,6 +216,13 @@ void aes_set_iv(struct aes *aes, const uint8_t *iv)
 	if (!aes || !iv)
 		return;
 
+#ifdef USE_AESNI
+	if (aes->ni) {
+		aesni_set_iv(aes->ni, iv);
+		return;
+	}
+#endif
+
 	r = EVP_CipherInit_ex(aes->ctx, NULL, NULL, NULL, iv, -1);
 	if (!r)
 		ERR_clear_error();
@@ -158,6 +236,11 @@ int aes_encr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
 	if (!aes || !in)
 		return EINVAL;
 
+#ifdef USE_AESNI
+	if (aes->ni)
+		return aesni_crypt(aes->ni, out, in, len, true);
+#endif
+
 	if (!set_crypt_dir(aes, true))
 		return EPROTO;
 
@@ -177,6 +260,11 @@ int aes_decr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
 	if (!aes || !in)
 		return EINVAL;
 
+#ifdef USE_AESNI
+	if (aes->ni)
+		return aesni_crypt(aes->ni, out, in, len, false);
+#endif
+
 	if (!set_crypt_dir(aes, false))
 		return EPROTO;
 
@@ -205,6 +293,11 @@ int aes_get_authtag(struct aes *aes, uint8_t *tag, size_t taglen)
 	if (!aes || !tag || !taglen)
 		return EINVAL;
 
+#ifdef USE_AESNI
+	if (aes->ni)
+		return aesni_get_authtag(aes->ni, tag, taglen);
+#endif
+
 	switch (aes->mode) {
 
 	case AES_MODE_GCM:
@@ -245,6 +338,11 @@ int aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen)
 	if (!aes || !tag || !taglen)
 		return EINVAL;
 
+#ifdef USE_AESNI
+	if (aes->ni)
+		return aesni_authenticate(aes->ni, tag, taglen);
+#endif
+
 	switch (aes->mode) {
 
 	case AES_MODE_GCM:
@@ -265,3 +363,138 @@ int aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen)
 		return ENOTSUP;
 	}
 }
+
+
+static inline uint64_t get_be64(const uint8_t *p)
+{
+	return (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 |
+		(uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+		(uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+		(uint64_t)p[6] << 8  | (uint64_t)p[7];
+}
+
+
+static inline void put_be64(uint8_t *p, uint64_t v)
+{
+	p[0] = (uint8_t)(v >> 56);
+	p[1] = (uint8_t)(v >> 48);
+	p[2] = (uint8_t)(v >> 40);
+	p[3] = (uint8_t)(v >> 32);
+	p[4] = (uint8_t)(v >> 24);
+	p[5] = (uint8_t)(v >> 16);
+	p[6] = (uint8_t)(v >> 8);
+	p[7] = (uint8_t)v;
+}
+
+
+static inline void xor_keystream(uint8_t *p, const uint8_t *s, size_t len)
+{
+	uint64_t a, b;
+	size_t i;
+
+	for (i=0; i+8<=len; i+=8) {
+		memcpy(&a, p + i, 8);
+		memcpy(&b, s + i, 8);
+		a ^= b;
+		memcpy(p + i, &a, 8);
+	}
+
+	for (; i<len; i++)
+		p[i] ^= s[i];
+}
+
+
+/**
+ * Encrypt or decrypt a batch of buffers in Counter mode, each with its
+ * own initial counter block. The counter blocks of all buffers are
+ * encrypted together, so that the cipher is pipelined across buffers.
+ *
+ * @param aes  AES Context
+ * @param bufv Buffers, processed in place
+ * @param n    Number of buffers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_ctr_batch(struct aes *aes, const struct aes_ctr_buf *bufv, size_t n)
+{
+	uint8_t ks[BATCH_BLOCKS * AES_BLOCK_SIZE];
+	struct {
+		uint8_t *p;
+		size_t len;
+		size_t ks;
+	} segv[BATCH_BLOCKS];
+	uint64_t hi = 0, lo = 0;
+	size_t i = 0, pos = 0;
+
+	if (!aes || (!bufv && n))
+		return EINVAL;
+
+#ifdef USE_AESNI
+	if (aes->ni)
+		return aesni_ctr_batch(aes->ni, bufv, n);
+#endif
+
+	if (!aes->ecb)
+		return ENOTSUP;
+
+	while (i < n) {
+
+		size_t nb = 0, ns = 0, k;
+		int len;
+
+		/* Counter blocks, until the keystream buffer is full */
+		while (i < n && nb < BATCH_BLOCKS) {
+
+			size_t left, blocks;
+
+			if (pos >= bufv[i].len) {
+				++i;
+				pos = 0;
+				continue;
+			}
+
+			left = bufv[i].len - pos;
+
+			if (!pos) {
+				hi = get_be64(bufv[i].iv);
+				lo = get_be64(bufv[i].iv + 8);
+			}
+
+			blocks = (left + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+			blocks = min(blocks, BATCH_BLOCKS - nb);
+
+			segv[ns].p   = bufv[i].data + pos;
+			segv[ns].len = min(left, blocks * AES_BLOCK_SIZE);
+			segv[ns].ks  = nb * AES_BLOCK_SIZE;
+			++ns;
+
+			for (k=0; k<blocks; k++) {
+
+				uint8_t *b = &ks[nb++ * AES_BLOCK_SIZE];
+
+				put_be64(b, hi);
+				put_be64(b + 8, lo);
+
+				/* 128-bit big-endian increment */
+				if (!++lo)
+					++hi;
+			}
+
+			pos += blocks * AES_BLOCK_SIZE;
+		}
+
+		if (!nb)
+			break;
+
+		if (!EVP_EncryptUpdate(aes->ecb, ks, &len, ks,
+				       (int)(nb * AES_BLOCK_SIZE))) {
+			ERR_clear_error();
+			return EPROTO;
+		}
+
+		for (k=0; k<ns; k++)
+			xor_keystream(segv[k].p, &ks[segv[k].ks], segv[k].len);
+	}
+
+	return 0;
+}
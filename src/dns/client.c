@@ -221,7 +221,8 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 	dq.type     = ntohs(mbuf_read_u16(mb));
 	dq.dnsclass = ntohs(mbuf_read_u16(mb));
 
-	q = list_ledata(hash_lookup(dnsc->ht_query, hash_joaat_str_ci(dq.name),
+	q = list_ledata(hash_lookup(dnsc->ht_query,
+				    hash_fast32_str_ci(dq.name),
 				    query_cmp_handler, &dq));
 	if (!q) {
 		err = ENOENT;
@@ -636,7 +637,7 @@ static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 	if (!q)
 		goto nmerr;
 
-	hash_append(dnsc->ht_query, hash_joaat_str_ci(name), &q->le, q);
+	hash_append(dnsc->ht_query, hash_fast32_str_ci(name), &q->le, q);
 	tmr_init(&q->tmr);
 	mbuf_init(&q->mb);
 
@@ -824,6 +825,14 @@ static void dnsc_destructor(void *data)
 }
 
 
+static uint32_t query_key(struct le *le)
+{
+	const struct dns_query *q = le->data;
+
+	return hash_fast32_str_ci(q->name);
+}
+
+
 /**
  * Allocate a DNS Client
  *
@@ -860,7 +869,8 @@ int dnsc_alloc(struct dnsc **dcpp, const struct dnsc_conf *conf,
 	if (err)
 		goto out;
 
-	err = hash_alloc(&dnsc->ht_query, dnsc->conf.query_hash_size);
+	err = hash_alloc_resizable(&dnsc->ht_query,
+				   dnsc->conf.query_hash_size, query_key);
 	if (err)
 		goto out;
 
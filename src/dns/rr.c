@@ -64,7 +64,7 @@ static void rr_destructor(void *data)
  */
 struct dnsrr *dns_rr_alloc(void)
 {
-	return mem_zalloc(sizeof(struct dnsrr), rr_destructor);
+	return mem_pool_alloc(sizeof(struct dnsrr), rr_destructor);
 }
 
 
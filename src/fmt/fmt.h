@@ -0,0 +1,8 @@
+/**
+ * @file fmt.h  Internal interface to formatting and parsing
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+void fmt_hdrval_skip(const char **p, size_t *l);
@@ -3,18 +3,22 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
-#include <ctype.h>
 #include <sys/types.h>
-#ifdef HAVE_STRINGS_H
-#define __EXTENSIONS__ 1
-#include <strings.h>
-#endif
 #include <string.h>
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_fmt.h>
+#include "fmt.h"
+
+
+enum {
+	SCAN_SET_MAX = 8   /**< Largest character set scanned with SIMD */
+};
 
 
 /** Pointer-length NULL initialiser */
@@ -405,40 +409,151 @@ int pl_cmp(const struct pl *pl1, const struct pl *pl2)
 }
 
 
-#ifndef HAVE_STRINGS_H
-static int casecmp(const struct pl *pl, const char *str)
+static inline uint32_t ctz(uint32_t x)
 {
-	size_t i = 0;
-
-#define LOWER(d) ((d) | 0x20202020)
-	const uint32_t *p1 = (uint32_t *)pl->p;
-	const uint32_t *p2 = (uint32_t *)str;
-	const size_t len = pl->l & ~0x3;
-
-	/* Skip any unaligned pointers */
-	if (((size_t)pl->p) & (sizeof(void *) - 1))
-		goto next;
-	if (((size_t)str) & (sizeof(void *) - 1))
-		goto next;
-
-	/* Compare word-wise */
-	for (; i<len; i+=4) {
-		if (LOWER(*p1++) != LOWER(*p2++))
-			return EINVAL;
-	}
+#if defined(__GNUC__) || defined(__clang__)
+	return (uint32_t)__builtin_ctz(x);
+#else
+	uint32_t i = 0;
 
- next:
-	/* Compare byte-wise */
-	for (; i<pl->l; i++) {
-		if (tolower(pl->p[i]) != tolower(str[i]))
-			return EINVAL;
+	while (!(x & 1)) {
+		x >>= 1;
+		++i;
 	}
 
-	return 0;
+	return i;
+#endif
+}
+
+
+/* Convert the ASCII letters of 8 bytes to lowercase */
+static inline uint64_t lower8(uint64_t x)
+{
+	uint64_t h = x & 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t ge_a = h + 0x3f3f3f3f3f3f3f3fULL;   /* bit 7 if >= 'A' */
+	uint64_t gt_z = h + 0x2525252525252525ULL;   /* bit 7 if >  'Z' */
+	uint64_t upper = ~x & (ge_a ^ gt_z) & 0x8080808080808080ULL;
+
+	return x | (upper >> 2);
+}
+
+
+#ifdef __SSE2__
+/* Convert the ASCII letters of 16 bytes to lowercase */
+static inline __m128i lower16(__m128i v)
+{
+	/* Move 'A'-'Z' to the bottom of the signed range */
+	__m128i t = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A')));
+	__m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8((char)(0x80 + 26)), t);
+
+	return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+
+static inline uint64_t load8(const char *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+
+	return w;
+}
+
+
+static inline uint64_t load4(const char *p)
+{
+	uint32_t w;
+
+	memcpy(&w, p, sizeof(w));
+
+	return w;
+}
+
+
+/* Load 1-3 bytes, the middle byte may be loaded twice */
+static inline uint64_t load3(const char *p, size_t n)
+{
+	return (uint64_t)(uint8_t)p[0] | (uint64_t)(uint8_t)p[n/2] << 8 |
+		(uint64_t)(uint8_t)p[n-1] << 16;
+}
+
+
+static inline bool caseeq(uint64_t w1, uint64_t w2)
+{
+	return w1 == w2 || lower8(w1) == lower8(w2);
+}
+
+
+#ifdef __SSE2__
+static inline bool caseeq16(__m128i v1, __m128i v2)
+{
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2)) == 0xffff)
+		return true;
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(lower16(v1), lower16(v2)))
+		== 0xffff;
+}
+
+
+/* Load the first and the last 8 of 8-16 bytes */
+static inline __m128i load16(const char *p, size_t n)
+{
+	return _mm_unpacklo_epi64(_mm_loadl_epi64((const void *)p),
+				  _mm_loadl_epi64((const void *)(p + n - 8)));
 }
 #endif
 
 
+/*
+ * Compare n bytes, ignoring the case of ASCII letters. The blocks at the
+ * end overlap, so that there is no byte-wise tail.
+ */
+static bool casecmp(const char *p1, const char *p2, size_t n)
+{
+	size_t i, o;
+
+	if (n >= 16) {
+
+#ifdef __SSE2__
+		for (i=0; i<n; i+=16) {
+
+			o = min(i, n - 16);
+
+			if (!caseeq16(_mm_loadu_si128((const void *)(p1 + o)),
+				      _mm_loadu_si128((const void *)(p2 + o))))
+				return false;
+		}
+#else
+		for (i=0; i<n; i+=8) {
+
+			o = min(i, n - 8);
+
+			if (!caseeq(load8(p1 + o), load8(p2 + o)))
+				return false;
+		}
+#endif
+
+		return true;
+	}
+
+	if (n >= 8) {
+#ifdef __SSE2__
+		return caseeq16(load16(p1, n), load16(p2, n));
+#else
+		return caseeq(load8(p1), load8(p2)) &&
+			caseeq(load8(p1 + n - 8), load8(p2 + n - 8));
+#endif
+	}
+
+	if (n >= 4)
+		return caseeq(load4(p1) | load4(p1 + n - 4) << 32,
+			      load4(p2) | load4(p2 + n - 4) << 32);
+
+	return n == 0 || caseeq(load3(p1, n), load3(p2, n));
+}
+
+
 /**
  * Compare two pointer-length objects (case-insensitive)
  *
@@ -472,11 +587,7 @@ int pl_casecmp(const struct pl *pl1, const struct pl *pl2)
 	if (pl1->p == pl2->p)
 		return 0;
 
-#ifdef HAVE_STRINGS_H
-	return 0 == strncasecmp(pl1->p, pl2->p, pl1->l) ? 0 : EINVAL;
-#else
-	return casecmp(pl1, pl2->p);
-#endif
+	return casecmp(pl1->p, pl2->p, pl1->l) ? 0 : EINVAL;
 }
 
 
@@ -490,16 +601,137 @@ int pl_casecmp(const struct pl *pl1, const struct pl *pl2)
  */
 const char *pl_strchr(const struct pl *pl, char c)
 {
-	const char *p, *end;
+	if (!pl || !pl->p)
+		return NULL;
+
+	return memchr(pl->p, c, pl->l);
+}
+
+
+/**
+ * Locate the first occurrence of any of a set of characters in a
+ * pointer-length string
+ *
+ * @param pl  Pointer-length string
+ * @param set NULL-terminated string with the characters to locate
+ *
+ * @return Pointer to first char if found, otherwise NULL
+ */
+const char *pl_find_any(const struct pl *pl, const char *set)
+{
+	const uint8_t *p;
+	uint32_t map[8];
+	size_t i = 0, n;
+
+	if (!pl || !pl->p || !set)
+		return NULL;
 
-	if (!pl)
+	n = strlen(set);
+	if (n == 0)
 		return NULL;
+	else if (n == 1)
+		return memchr(pl->p, set[0], pl->l);
+
+	p = (const uint8_t *)pl->p;
+
+#ifdef __SSE2__
+	/* Compare 16 bytes at a time with each character of small sets */
+	if (n <= SCAN_SET_MAX) {
+
+		__m128i setv[SCAN_SET_MAX];
+		size_t j;
+
+		for (j=0; j<n; j++)
+			setv[j] = _mm_set1_epi8(set[j]);
+
+		for (; i + 16 <= pl->l; i += 16) {
+
+			__m128i v = _mm_loadu_si128((const void *)(p + i));
+			__m128i m = _mm_cmpeq_epi8(v, setv[0]);
+			uint32_t bits;
+
+			for (j=1; j<n; j++) {
+				m = _mm_or_si128(m,
+						 _mm_cmpeq_epi8(v, setv[j]));
+			}
+
+			bits = (uint32_t)_mm_movemask_epi8(m);
+			if (bits)
+				return pl->p + i + ctz(bits);
+		}
+	}
+#endif
+
+	memset(map, 0, sizeof(map));
+	for (; *set; set++)
+		map[(uint8_t)*set >> 5] |= 1u << ((uint8_t)*set & 0x1f);
 
-	end = pl->p + pl->l;
-	for (p = pl->p; p < end; p++) {
-		if (*p == c)
-			return p;
+	for (; i < pl->l; i++) {
+		if (map[p[i] >> 5] & (1u << (p[i] & 0x1f)))
+			return pl->p + i;
 	}
 
 	return NULL;
 }
+
+
+/**
+ * Skip over the characters of a SIP or HTTP header value that do not
+ * change the state of the header parser. The current character is always
+ * skipped, and the position is left on the last skipped character.
+ *
+ * @param p Current position, at least one character must be left
+ * @param l Number of characters left
+ */
+void fmt_hdrval_skip(const char **p, size_t *l)
+{
+	struct pl pl;
+	const char *q;
+	size_t n;
+
+	if (!p || !l || !*l)
+		return;
+
+	pl.p = *p + 1;
+	pl.l = *l - 1;
+
+	q = pl_find_any(&pl, " \t\r\n\",");
+	n = q ? (size_t)(q - pl.p) : pl.l;
+
+	*p += n;
+	*l -= n;
+}
+
+
+/**
+ * Get the next line of a pointer-length string. A line is terminated by
+ * CRLF, LF or CR, and the pointer-length string is advanced past it.
+ *
+ * @param pl   Pointer-length string
+ * @param line Returned line, without the line terminator
+ *
+ * @return 0 if success, ENODATA if there is no complete line
+ */
+int pl_getline(struct pl *pl, struct pl *line)
+{
+	const char *eol;
+	size_t n;
+
+	if (!pl || !line)
+		return EINVAL;
+
+	eol = pl_find_any(pl, "\r\n");
+	if (!eol)
+		return ENODATA;
+
+	line->p = pl->p;
+	line->l = eol - pl->p;
+
+	n = line->l + 1;
+	if (*eol == '\r' && n < pl->l && eol[1] == '\n')
+		++n;
+
+	pl_advance(pl, n);
+
+	return 0;
+}
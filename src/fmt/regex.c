@@ -3,92 +3,140 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
-#include <ctype.h>
+#include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
+#include <re_mem.h>
 
 
-/** Defines a character range */
-struct chr {
-	uint8_t min;  /**< Minimum value */
-	uint8_t max;  /**< Maximum value */
+#if defined(__GNUC__) || defined(__clang__)
+#define REGEX_ATOMIC 1 /**< Publish cached expressions atomically */
+#endif
+
+
+/*
+ * An expression is compiled to a list of elements, each with a literal
+ * string followed by an optional character class. The class is a bitmap
+ * of the matching input bytes, with case and negation already applied.
+ */
+enum {
+	REGEX_STACK_ELEM = 16,    /**< Elements compiled on the stack     */
+	REGEX_STACK_LIT  = 128,   /**< Literal bytes compiled on the stack */
+};
+
+
+/** Defines an element of a compiled expression */
+struct elem {
+	uint8_t map[32];  /**< Character class, one bit per input byte  */
+	uint32_t nmin;    /**< Minimum number of matches                */
+	uint32_t nmax;    /**< Maximum number of matches                */
+	uint32_t lit;     /**< Offset of the literal before the class   */
+	uint32_t litlen;  /**< Length of the literal                    */
+	bool cls;         /**< Element has a character class            */
+	bool qesc;        /**< Skip quoted strings and escaped bytes    */
+};
+
+/** Defines a compiled regular expression */
+struct regex {
+	struct elem *elemv;      /**< Elements                            */
+	char *lit;               /**< Lower-case literals                 */
+	uint32_t n;              /**< Number of elements                  */
+	uint32_t argc;           /**< Number of character classes         */
+	bool empty;              /**< Expression is an empty string       */
+	struct regex *next;      /**< Next cached expression              */
+	struct regex **cachep;   /**< Cache of this expression            */
 };
 
 
-static bool expr_match(const struct chr *chrv, uint32_t n, uint8_t c,
-		       bool neg)
+static struct regex *cachel;  /**< All cached expressions */
+
+
+static inline uint8_t lower(uint8_t c)
 {
-	uint32_t i;
+	return ('A' <= c && c <= 'Z') ? c + ('a' - 'A') : c;
+}
 
-	for (i=0; i<n; i++) {
 
-		if (c < chrv[i].min)
-			continue;
+static inline bool map_test(const uint8_t *map, uint8_t c)
+{
+	return (map[c >> 3] >> (c & 7)) & 1;
+}
 
-		if (c > chrv[i].max)
-			continue;
 
-		break;
+/* Upper bounds of the elements and literal bytes of an expression */
+static void expr_size(const char *expr, uint32_t *np, size_t *litp)
+{
+	uint32_t n = 1;
+	size_t l = 0;
+
+	for (; expr[l]; l++) {
+		if (expr[l] == '[')
+			++n;
 	}
 
-	return neg ? (i == n) : (i != n);
+	*np   = n;
+	*litp = l;
 }
 
 
-/**
- * Parse a string using basic regular expressions. Any number of matching
- * expressions can be given, and each match will be stored in a "struct pl"
- * pointer-length type.
- *
- * @param ptr  String to parse
- * @param len  Length of string
- * @param expr Regular expressions string
- *
- * @return 0 if success, otherwise errorcode
- *
- * Example:
- *
- *   We parse the buffer for any numerical values, to get a match we must have
- *   1 or more occurences of the digits 0-9. The result is stored in 'num',
- *   which is of pointer-length type and will point to the first location in
- *   the buffer that contains "42".
- *
- * <pre>
- const char buf[] = "foo 42 bar";
- struct pl num;
- int err = re_regex(buf, strlen(buf), "[0-9]+", &num);
+static void range_add(uint8_t *map, uint8_t min, uint8_t max)
+{
+	unsigned c;
 
- here num contains a pointer to '42'
- * </pre>
+	for (c=min; c<=max; c++)
+		map[c >> 3] |= (uint8_t)(1 << (c & 7));
+}
+
+
+/*
+ * Upper-case bytes match as lower-case bytes, and apply the negation.
+ * The bits of 'A'-'Z' are at the same positions as 'a'-'z', 4 bytes
+ * lower in the bitmap.
  */
-int re_regex(const char *ptr, size_t len, const char *expr, ...)
+static void class_finish(uint8_t *map, bool neg)
 {
-	struct chr chrv[64];
-	const char *p, *ep;
-	bool fm, range = false, ec = false, neg = false, qesc = false;
-	uint32_t n = 0;
-	va_list ap;
-	bool eesc;
-	size_t l;
+	unsigned i;
 
-	if (!ptr || !expr)
-		return EINVAL;
+	map[8]  = (uint8_t)((map[8] & 0x01) | (map[12] & 0xfe));
+	map[9]  = map[13];
+	map[10] = map[14];
+	map[11] = (uint8_t)((map[11] & 0xf8) | (map[15] & 0x07));
 
- again:
-	eesc = false;
-	fm = false;
-	l  = len--;
-	p  = ptr++;
-	ep = expr;
+	if (!neg)
+		return;
 
-	va_start(ap, expr);
+	for (i=0; i<32; i++)
+		map[i] = (uint8_t)~map[i];
+}
 
-	if (!l)
-		goto out;
 
-	for (; *ep; ep++) {
+/*
+ * Compile an expression, with the same syntax as the interpreter that
+ * preceded it: '\' escapes the next byte, '[' starts a character class
+ * with ranges, '^' negates and '~' negates with quoted strings, and ']'
+ * is followed by '*', '+' or a count from '1' to '9'.
+ */
+static int compile(struct regex *rx, const char *expr)
+{
+	bool fm = false, ec = false, range = false, neg = false;
+	bool eesc = false, pend = false;
+	uint8_t pmin = 0, pmax = 0;
+	struct elem *e;
+	uint32_t nr = 0;
+	size_t nlit = 0;
+
+	rx->n     = 0;
+	rx->argc  = 0;
+	rx->empty = !*expr;
+
+	e = &rx->elemv[0];
+	memset(e, 0, sizeof(*e));
+
+	for (; *expr; expr++) {
 
-		if ('\\' == *ep && !eesc) {
+		uint8_t c = (uint8_t)*expr;
+
+		if ('\\' == c && !eesc) {
 			eesc = true;
 			continue;
 		}
@@ -96,62 +144,163 @@ int re_regex(const char *ptr, size_t len, const char *expr, ...)
 		if (!fm) {
 
 			/* Start of character class */
-			if ('[' == *ep && !eesc) {
-				n     = 0;
+			if ('[' == c && !eesc) {
+				memset(e->map, 0, sizeof(e->map));
+				nr    = 0;
 				fm    = true;
 				ec    = false;
 				neg   = false;
 				range = false;
-				qesc  = false;
+				pend  = false;
 				continue;
 			}
 
-			if (!l)
-				break;
-
-			if (tolower(*ep) != tolower(*p)) {
-				va_end(ap);
-				goto again;
-			}
-
+			rx->lit[nlit++] = (char)lower(c);
+			++e->litlen;
 			eesc = false;
-			++p;
-			--l;
 			continue;
 		}
 		/* End of character class */
 		else if (ec) {
 
-			uint32_t nm, nmin, nmax;
-			struct pl lpl, *pl = va_arg(ap, struct pl *);
-			bool quote = false, esc = false;
-
 			/* Match 0 or more times */
-			if ('*' == *ep) {
-				nmin = 0;
-				nmax = -1;
+			if ('*' == c) {
+				e->nmin = 0;
+				e->nmax = UINT32_MAX;
 			}
 			/* Match 1 or more times */
-			else if ('+' == *ep) {
-				nmin = 1;
-				nmax = -1;
+			else if ('+' == c) {
+				e->nmin = 1;
+				e->nmax = UINT32_MAX;
 			}
 			/* Match exactly n times */
-			else if ('1' <= *ep && *ep <= '9') {
-				nmin = *ep - '0';
-				nmax = *ep - '0';
+			else if ('1' <= c && c <= '9') {
+				e->nmin = c - '0';
+				e->nmax = c - '0';
 			}
 			else
+				return EINVAL;
+
+			/* A dangling range drops its first byte */
+			if (pend && !range)
+				range_add(e->map, pmin, pmax);
+
+			class_finish(e->map, neg);
+			e->cls = true;
+			++rx->argc;
+
+			e = &rx->elemv[++rx->n];
+			memset(e, 0, sizeof(*e));
+			e->lit = (uint32_t)nlit;
+
+			fm   = false;
+			eesc = false;
+			continue;
+		}
+
+		if (eesc) {
+			eesc = false;
+			goto chr;
+		}
+
+		switch (c) {
+
+			/* End of character class */
+		case ']':
+			ec = true;
+			continue;
+
+			/* Negate with quote escape */
+		case '~':
+			if (nr)
 				break;
 
-			fm = false;
+			e->qesc = true;
+			neg = true;
+			continue;
+
+			/* Negate */
+		case '^':
+			if (nr)
+				break;
+
+			neg = true;
+			continue;
+
+			/* Range */
+		case '-':
+			if (!nr || range)
+				break;
+
+			range = true;
+			--nr;
+			continue;
+		}
+
+	chr:
+		if (range) {
+			pmax  = lower(c);
+			range = false;
+		}
+		else {
+			if (pend)
+				range_add(e->map, pmin, pmax);
+
+			pmin = pmax = lower(c);
+			pend = true;
+		}
+
+		++nr;
+	}
+
+	if (fm)
+		return EINVAL;
+
+	if (e->litlen)
+		++rx->n;
+
+	return 0;
+}
+
+
+static int exec(const struct regex *rx, const char *ptr, size_t len,
+		struct pl **plv)
+{
+	for (; ; ++ptr, --len) {
+
+		const char *p = ptr;
+		size_t l = len;
+		uint32_t i, k = 0;
+
+		if (!len)
+			return rx->empty ? 0 : ENOENT;
+
+		for (i=0; i<rx->n; i++) {
+
+			const struct elem *e = &rx->elemv[i];
+			const char *lit = rx->lit + e->lit;
+			bool quote = false, esc = false;
+			struct pl lpl;
+			uint32_t j, nm;
+
+			for (j=0; j<e->litlen; j++, p++, l--) {
+
+				if (!l)
+					return ENOENT;
+
+				if (lower((uint8_t)*p) != (uint8_t)lit[j])
+					goto next;
+			}
+
+			if (!e->cls)
+				continue;
 
 			lpl.p = p;
 			lpl.l = 0;
 
-			for (nm = 0; l && nm < nmax; nm++, p++, l--, lpl.l++) {
+			for (nm=0; l && nm<e->nmax; nm++, p++, l--, lpl.l++) {
 
-				if (qesc) {
+				if (e->qesc) {
 
 					if (esc) {
 						esc = false;
@@ -173,12 +322,12 @@ int re_regex(const char *ptr, size_t len, const char *expr, ...)
 						continue;
 				}
 
-				if (!expr_match(chrv, n, tolower(*p), neg))
+				if (!map_test(e->map, (uint8_t)*p))
 					break;
 			}
 
 			/* Strip quotes */
-			if (qesc && lpl.l > 1 &&
+			if (e->qesc && lpl.l > 1 &&
 			    lpl.p[0] == '"' && lpl.p[lpl.l - 1] == '"') {
 
 				lpl.p += 1;
@@ -186,73 +335,299 @@ int re_regex(const char *ptr, size_t len, const char *expr, ...)
 				nm    -= 2;
 			}
 
-			if ((nm < nmin) || (nm > nmax)) {
-				va_end(ap);
-				goto again;
-			}
+			if (nm < e->nmin || nm > e->nmax)
+				goto next;
 
-			if (pl)
-				*pl = lpl;
+			if (plv[k])
+				*plv[k] = lpl;
 
-			eesc = false;
-			continue;
+			++k;
 		}
 
-		if (eesc) {
-			eesc = false;
-			goto chr;
-		}
+		return 0;
 
-		switch (*ep) {
+	next:
+		;
+	}
+}
 
-			/* End of character class */
-		case ']':
-			ec = true;
-			continue;
 
-			/* Negate with quote escape */
-		case '~':
-			if (n)
-				break;
+static int vexec(const struct regex *rx, const char *ptr, size_t len,
+		 va_list ap)
+{
+	struct pl *stackv[REGEX_STACK_ELEM], **plv = stackv;
+	uint32_t i;
+	int err;
 
-			qesc = true;
-			neg  = true;
-			continue;
+	if (rx->argc > ARRAY_SIZE(stackv)) {
+		plv = mem_alloc(rx->argc * sizeof(*plv), NULL);
+		if (!plv)
+			return ENOMEM;
+	}
 
-			/* Negate */
-		case '^':
-			if (n)
-				break;
+	for (i=0; i<rx->argc; i++)
+		plv[i] = va_arg(ap, struct pl *);
 
-			neg = true;
-			continue;
+	err = exec(rx, ptr, len, plv);
 
-			/* Range */
-		case '-':
-			if (!n || range)
-				break;
+	if (plv != stackv)
+		mem_deref(plv);
 
-			range = true;
-			--n;
-			continue;
-		}
+	return err;
+}
 
-	chr:
-		chrv[n].max = tolower(*ep);
 
-		if (range)
-			range = false;
-		else
-			chrv[n].min = tolower(*ep);
+static void regex_destructor(void *data)
+{
+	struct regex *rx = data;
+
+	mem_deref(rx->elemv);
+}
+
+
+/**
+ * Compile a regular expression, with the syntax of re_regex()
+ *
+ * @param rxp  Pointer to allocated expression
+ * @param expr Regular expressions string
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_regex_compile(struct regex **rxp, const char *expr)
+{
+	struct regex *rx;
+	size_t nlit;
+	uint32_t n;
+	int err;
+
+	if (!rxp || !expr)
+		return EINVAL;
 
-		if (++n > ARRAY_SIZE(chrv))
-			break;
+	rx = mem_zalloc(sizeof(*rx), regex_destructor);
+	if (!rx)
+		return ENOMEM;
+
+	expr_size(expr, &n, &nlit);
+
+	rx->elemv = mem_alloc(n * sizeof(*rx->elemv) + nlit, NULL);
+	if (!rx->elemv) {
+		err = ENOMEM;
+		goto out;
 	}
+
+	rx->lit = (char *)(rx->elemv + n);
+
+	err = compile(rx, expr);
+
  out:
+	if (err)
+		mem_deref(rx);
+	else
+		*rxp = rx;
+
+	return err;
+}
+
+
+/**
+ * Parse a string using a compiled regular expression
+ *
+ * @param rx   Compiled regular expression
+ * @param ptr  String to parse
+ * @param len  Length of string
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_regex_exec(const struct regex *rx, const char *ptr, size_t len, ...)
+{
+	va_list ap;
+	int err;
+
+	if (!rx || !ptr)
+		return EINVAL;
+
+	va_start(ap, len);
+	err = vexec(rx, ptr, len, ap);
 	va_end(ap);
 
-	if (fm)
+	return err;
+}
+
+
+/* Compile an expression once, and keep it until re_regex_flush() */
+static struct regex *cache_get(struct regex **rxp, const char *expr)
+{
+	struct regex *rx, *cur = NULL;
+
+#if REGEX_ATOMIC
+	rx = __atomic_load_n(rxp, __ATOMIC_ACQUIRE);
+#else
+	rx = *rxp;
+#endif
+	if (rx)
+		return rx;
+
+	if (re_regex_compile(&rx, expr))
+		return NULL;
+
+	rx->cachep = rxp;
+
+	/* Another thread may have compiled it meanwhile */
+#if REGEX_ATOMIC
+	if (!__atomic_compare_exchange_n(rxp, &cur, rx, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		mem_deref(rx);
+		return cur;
+	}
+
+	rx->next = __atomic_load_n(&cachel, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&cachel, &rx->next, rx, true,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+#else
+	(void)cur;
+	*rxp = rx;
+	rx->next = cachel;
+	cachel = rx;
+#endif
+
+	return rx;
+}
+
+
+/**
+ * Parse a string using a constant regular expression, which is compiled
+ * on the first call and kept in a static cache at the call site
+ *
+ * @param rxp  Static cache of the compiled expression, initially NULL
+ * @param ptr  String to parse
+ * @param len  Length of string
+ * @param expr Regular expressions string, must be the same on all calls
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * Example:
+ *
+ * <pre>
+ static struct regex *rx;
+ struct pl num;
+ int err = re_regex_cached(&rx, buf, strlen(buf), "[0-9]+", &num);
+ * </pre>
+ */
+int re_regex_cached(struct regex **rxp, const char *ptr, size_t len,
+		    const char *expr, ...)
+{
+	struct regex *rx;
+	va_list ap;
+	int err;
+
+	if (!rxp || !ptr || !expr)
+		return EINVAL;
+
+	rx = cache_get(rxp, expr);
+	if (!rx)
+		return EINVAL;
+
+	va_start(ap, expr);
+	err = vexec(rx, ptr, len, ap);
+	va_end(ap);
+
+	return err;
+}
+
+
+/**
+ * Free all cached regular expressions. Must not be called while other
+ * threads use the cache, and is called by libre_close().
+ */
+void re_regex_flush(void)
+{
+	struct regex *rx;
+
+#if REGEX_ATOMIC
+	rx = __atomic_exchange_n(&cachel, NULL, __ATOMIC_ACQ_REL);
+#else
+	rx = cachel;
+	cachel = NULL;
+#endif
+
+	while (rx) {
+
+		struct regex *next = rx->next;
+
+		*rx->cachep = NULL;
+		mem_deref(rx);
+		rx = next;
+	}
+}
+
+
+/**
+ * Parse a string using basic regular expressions. Any number of matching
+ * expressions can be given, and each match will be stored in a "struct pl"
+ * pointer-length type.
+ *
+ * @param ptr  String to parse
+ * @param len  Length of string
+ * @param expr Regular expressions string
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * Example:
+ *
+ *   We parse the buffer for any numerical values, to get a match we must have
+ *   1 or more occurences of the digits 0-9. The result is stored in 'num',
+ *   which is of pointer-length type and will point to the first location in
+ *   the buffer that contains "42".
+ *
+ * <pre>
+ const char buf[] = "foo 42 bar";
+ struct pl num;
+ int err = re_regex(buf, strlen(buf), "[0-9]+", &num);
+
+ here num contains a pointer to '42'
+ * </pre>
+ *
+ * @note The expression is compiled on every call, use re_regex_compile()
+ *       or re_regex_cached() for expressions used on hot paths
+ */
+int re_regex(const char *ptr, size_t len, const char *expr, ...)
+{
+	struct elem elemv[REGEX_STACK_ELEM];
+	char lit[REGEX_STACK_LIT];
+	struct regex srx, *rx = &srx;
+	va_list ap;
+	size_t nlit;
+	uint32_t n;
+	int err;
+
+	if (!ptr || !expr)
 		return EINVAL;
 
-	return *ep ? ENOENT : 0;
+	expr_size(expr, &n, &nlit);
+
+	if (n <= ARRAY_SIZE(elemv) && nlit <= sizeof(lit)) {
+
+		memset(&srx, 0, sizeof(srx));
+		srx.elemv = elemv;
+		srx.lit   = lit;
+
+		err = compile(&srx, expr);
+	}
+	else {
+		err = re_regex_compile(&rx, expr);
+	}
+
+	if (err)
+		return err;
+
+	va_start(ap, expr);
+	err = vexec(rx, ptr, len, ap);
+	va_end(ap);
+
+	if (rx != &srx)
+		mem_deref(rx);
+
+	return err;
 }
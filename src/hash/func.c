@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <ctype.h>
+#include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_list.h>
@@ -367,3 +368,270 @@ uint32_t hash_fast_str(const char *str)
 {
 	return hash_fast(str, str_len(str));
 }
+
+
+/*
+ * 64-bit hash, reading the key 8 bytes at a time (wyhash). The words are
+ * mixed with a 64x64 to 128-bit multiply, folded to 64 bits. The
+ * case-insensitive variants fold ASCII letters of each word to lower
+ * case, before mixing.
+ */
+#define P0 0xa0761d6478bd642fULL
+#define P1 0xe7037ed1a0b428dbULL
+#define P2 0x8ebc6af09c88c6e3ULL
+
+
+static inline uint64_t mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	uint64_t ha = a >> 32, hb = b >> 32;
+	uint64_t la = (uint32_t)a, lb = (uint32_t)b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+
+	c += lo < t;
+
+	return lo ^ (rh + (rm0 >> 32) + (rm1 >> 32) + c);
+#endif
+}
+
+
+static inline uint64_t lower8(uint64_t x)
+{
+	uint64_t h = x & 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t ge_a = h + 0x3f3f3f3f3f3f3f3fULL;   /* bit 7 if >= 'A' */
+	uint64_t gt_z = h + 0x2525252525252525ULL;   /* bit 7 if >  'Z' */
+	uint64_t upper = ~x & (ge_a ^ gt_z) & 0x8080808080808080ULL;
+
+	return x | (upper >> 2);
+}
+
+
+static inline uint64_t r8(const uint8_t *p, bool ci)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return ci ? lower8(v) : v;
+}
+
+
+static inline uint64_t r4(const uint8_t *p, bool ci)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return ci ? lower8(v) : v;
+}
+
+
+static inline uint64_t fast64(const uint8_t *p, size_t len, bool ci)
+{
+	uint64_t seed = P0 ^ len;
+	uint64_t a, b;
+	size_t n = len;
+
+	while (n > 16) {
+		seed = mum(r8(p, ci) ^ P1, r8(p + 8, ci) ^ seed);
+		p += 16;
+		n -= 16;
+	}
+
+	if (n > 8) {
+		a = r8(p, ci);
+		b = r8(p + n - 8, ci);
+	}
+	else if (n >= 4) {
+		a = r4(p, ci) << 32 | r4(p + n - 4, ci);
+		b = 0;
+	}
+	else if (n > 0) {
+		a = (uint64_t)p[0] << 16 | (uint64_t)p[n >> 1] << 8 | p[n - 1];
+		a = ci ? lower8(a) : a;
+		b = 0;
+	}
+	else {
+		a = b = 0;
+	}
+
+	return mum(P2 ^ len, mum(a ^ P1, b ^ seed));
+}
+
+
+/**
+ * Calculate a 64-bit hash-value, reading the key a word at a time
+ *
+ * @param key  Pointer to key
+ * @param len  Key length
+ *
+ * @return Calculated hash-value
+ */
+uint64_t hash_fast64(const void *key, size_t len)
+{
+	return fast64(key, key ? len : 0, false);
+}
+
+
+/**
+ * Calculate a 64-bit hash-value for a case-insensitive string
+ *
+ * @param str  String
+ * @param len  Length of string
+ *
+ * @return Calculated hash-value
+ */
+uint64_t hash_fast64_ci(const char *str, size_t len)
+{
+	return fast64((const uint8_t *)str, str ? len : 0, true);
+}
+
+
+/**
+ * Calculate a 64-bit hash-value for a NULL-terminated string
+ *
+ * @param str  String
+ *
+ * @return Calculated hash-value
+ */
+uint64_t hash_fast64_str(const char *str)
+{
+	return fast64((const uint8_t *)str, str_len(str), false);
+}
+
+
+/**
+ * Calculate a 64-bit hash-value for a case-insensitive NULL-terminated
+ * string
+ *
+ * @param str  String
+ *
+ * @return Calculated hash-value
+ */
+uint64_t hash_fast64_str_ci(const char *str)
+{
+	return fast64((const uint8_t *)str, str_len(str), true);
+}
+
+
+/**
+ * Calculate a 64-bit hash-value for a pointer-length object
+ *
+ * @param pl Pointer-length object
+ *
+ * @return Calculated hash-value
+ */
+uint64_t hash_fast64_pl(const struct pl *pl)
+{
+	return pl ? hash_fast64(pl->p, pl->l) : hash_fast64(NULL, 0);
+}
+
+
+/**
+ * Calculate a 64-bit hash-value for a case-insensitive pointer-length
+ * object
+ *
+ * @param pl Pointer-length object
+ *
+ * @return Calculated hash-value
+ */
+uint64_t hash_fast64_pl_ci(const struct pl *pl)
+{
+	return pl ? hash_fast64_ci(pl->p, pl->l) : hash_fast64_ci(NULL, 0);
+}
+
+
+/* Fold a 64-bit hash-value to the 32-bit keys of struct hash */
+static inline uint32_t fold32(uint64_t h)
+{
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+
+/**
+ * Calculate a 32-bit hash-value for hash tables, folded from
+ * hash_fast64()
+ *
+ * @param key  Pointer to key
+ * @param len  Key length
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast32(const void *key, size_t len)
+{
+	return fold32(hash_fast64(key, len));
+}
+
+
+/**
+ * Calculate a 32-bit hash-value for a case-insensitive string
+ *
+ * @param str  String
+ * @param len  Length of string
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast32_ci(const char *str, size_t len)
+{
+	return fold32(hash_fast64_ci(str, len));
+}
+
+
+/**
+ * Calculate a 32-bit hash-value for a NULL-terminated string
+ *
+ * @param str  String
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast32_str(const char *str)
+{
+	return fold32(hash_fast64_str(str));
+}
+
+
+/**
+ * Calculate a 32-bit hash-value for a case-insensitive NULL-terminated
+ * string
+ *
+ * @param str  String
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast32_str_ci(const char *str)
+{
+	return fold32(hash_fast64_str_ci(str));
+}
+
+
+/**
+ * Calculate a 32-bit hash-value for a pointer-length object
+ *
+ * @param pl Pointer-length object
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast32_pl(const struct pl *pl)
+{
+	return fold32(hash_fast64_pl(pl));
+}
+
+
+/**
+ * Calculate a 32-bit hash-value for a case-insensitive pointer-length
+ * object
+ *
+ * @param pl Pointer-length object
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast32_pl_ci(const struct pl *pl)
+{
+	return fold32(hash_fast64_pl_ci(pl));
+}
@@ -3,17 +3,47 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
+#include <re_fmt.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_list.h>
 #include <re_hash.h>
 
 
+/*
+ * Resizable tables grow by a factor of 2, and shrink to fit the number of
+ * elements. The elements of the old buckets are moved a few buckets at a
+ * time with each hash_append(), and lookups check both tables until all
+ * buckets are moved.
+ */
+enum {
+	HASH_MIN_SIZE  = 16,       /**< Smallest resizable bucket size  */
+	HASH_MAX_SIZE  = 1u<<24,   /**< Largest resizable bucket size   */
+	HASH_GROW_LOAD = 2,        /**< Grow above 2 elements/bucket    */
+	HASH_SHRINK    = 8,        /**< Shrink below 1/8 element/bucket */
+	HASH_STEP      = 4,        /**< Buckets moved per append        */
+	HASH_SCAN      = 64,       /**< Buckets scanned per append      */
+};
+
+
+/** Defines a hash bucket */
+struct bucket {
+	struct list list;     /**< Linked list, must be first   */
+	struct hash *h;       /**< Parent hashmap table         */
+};
+
 /** Defines a hashmap table */
 struct hash {
-	struct list *bucket;  /**< Bucket with linked lists */
-	uint32_t bsize;       /**< Bucket size              */
+	struct bucket *bucket;   /**< Bucket with linked lists     */
+	uint32_t bsize;          /**< Bucket size                  */
+	struct bucket *obucket;  /**< Old buckets, while resizing  */
+	uint32_t osize;          /**< Old bucket size              */
+	uint32_t opos;           /**< Next old bucket to move      */
+	uint32_t n;              /**< Number of elements           */
+	uint32_t busy;           /**< Traversals in progress       */
+	hash_key_h *keyh;        /**< Key handler, if resizable    */
 };
 
 
@@ -22,6 +52,117 @@ static void hash_destructor(void *data)
 	struct hash *h = data;
 
 	mem_deref(h->bucket);
+	mem_deref(h->obucket);
+}
+
+
+static struct bucket *bucket_alloc(struct hash *h, uint32_t bsize)
+{
+	struct bucket *bv;
+	uint32_t i;
+
+	bv = mem_zalloc(bsize * sizeof(*bv), NULL);
+	if (!bv)
+		return NULL;
+
+	for (i=0; i<bsize; i++)
+		bv[i].h = h;
+
+	return bv;
+}
+
+
+static inline struct list *bucket_list(const struct hash *h, uint32_t key)
+{
+	return &h->bucket[key & (h->bsize-1)].list;
+}
+
+
+/* Move all elements of an old bucket to the new buckets */
+static void bucket_move(struct hash *h, uint32_t i)
+{
+	struct list *old = &h->obucket[i].list;
+	struct le *le;
+
+	while ((le = old->head)) {
+
+		void *data = le->data;
+
+		list_unlink(le);
+		list_append(bucket_list(h, h->keyh(le)), le, data);
+	}
+}
+
+
+static void resize_done(struct hash *h)
+{
+	h->obucket = mem_deref(h->obucket);
+	h->osize = 0;
+	h->opos  = 0;
+}
+
+
+/* Move a few non-empty buckets, and skip over empty buckets */
+static void resize_step(struct hash *h)
+{
+	uint32_t nb = HASH_STEP, ns = HASH_SCAN;
+
+	for (; nb && ns && h->opos < h->osize; --ns, ++h->opos) {
+
+		if (!h->obucket[h->opos].list.head)
+			continue;
+
+		bucket_move(h, h->opos);
+		--nb;
+	}
+
+	if (h->opos >= h->osize)
+		resize_done(h);
+}
+
+
+static void resize_start(struct hash *h, uint32_t bsize)
+{
+	struct bucket *bv;
+
+	bv = bucket_alloc(h, bsize);
+	if (!bv)
+		return;
+
+	h->obucket = h->bucket;
+	h->osize   = h->bsize;
+	h->opos    = 0;
+	h->bucket  = bv;
+	h->bsize   = bsize;
+}
+
+
+/* Check the load factor, and resize or continue resizing */
+static void resize_check(struct hash *h)
+{
+	if (!h->keyh || h->busy)
+		return;
+
+	if (h->obucket) {
+		resize_step(h);
+		return;
+	}
+
+	if (h->n > h->bsize * HASH_GROW_LOAD && h->bsize < HASH_MAX_SIZE)
+		resize_start(h, h->bsize * 2);
+	else if (h->n < h->bsize / HASH_SHRINK && h->bsize > HASH_MIN_SIZE)
+		resize_start(h, max(hash_valid_size(h->n), HASH_MIN_SIZE));
+}
+
+
+/*
+ * Move the old bucket of a key first, so that all elements with the
+ * key are in one bucket, and in order
+ */
+static inline void resize_key(struct hash *h, uint32_t key)
+{
+	if (h->obucket && !h->busy)
+		bucket_move(h, key & (h->osize-1));
 }
 
 
@@ -51,7 +192,7 @@ int hash_alloc(struct hash **hp, uint32_t bsize)
 
 	h->bsize = bsize;
 
-	h->bucket = mem_zalloc(bsize*sizeof(*h->bucket), NULL);
+	h->bucket = bucket_alloc(h, bsize);
 	if (!h->bucket) {
 		err = ENOMEM;
 		goto out;
@@ -67,6 +208,34 @@ int hash_alloc(struct hash **hp, uint32_t bsize)
 }
 
 
+/**
+ * Allocate a new hashmap table, which is resized by its load factor.
+ * The table grows and shrinks incrementally with each hash_append(),
+ * without moving all elements at once.
+ *
+ * @param hp     Address of hashmap pointer
+ * @param bsize  Initial bucket size
+ * @param keyh   Key handler, returns the hash key of an element
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hash_alloc_resizable(struct hash **hp, uint32_t bsize, hash_key_h *keyh)
+{
+	int err;
+
+	if (!keyh)
+		return EINVAL;
+
+	err = hash_alloc(hp, hash_valid_size(max(bsize, HASH_MIN_SIZE)));
+	if (err)
+		return err;
+
+	(*hp)->keyh = keyh;
+
+	return 0;
+}
+
+
 /**
  * Add an element to the hashmap table
  *
@@ -80,7 +249,11 @@ void hash_append(struct hash *h, uint32_t key, struct le *le, void *data)
 	if (!h || !le)
 		return;
 
-	list_append(&h->bucket[key & (h->bsize-1)], le, data);
+	resize_check(h);
+	resize_key(h, key);
+
+	list_append(bucket_list(h, key), le, data);
+	++h->n;
 }
 
 
@@ -91,6 +264,15 @@ void hash_append(struct hash *h, uint32_t key, struct le *le, void *data)
  */
 void hash_unlink(struct le *le)
 {
+	struct bucket *b;
+
+	if (!le || !le->list)
+		return;
+
+	b = (struct bucket *)le->list;
+	if (b->h->n)
+		--b->h->n;
+
 	list_unlink(le);
 }
 
@@ -108,10 +290,24 @@ void hash_unlink(struct le *le)
 struct le *hash_lookup(const struct hash *h, uint32_t key, list_apply_h *ah,
 		       void *arg)
 {
+	struct hash *hm = (struct hash *)h;
+	struct le *le;
+
 	if (!h || !ah)
 		return NULL;
 
-	return list_apply(&h->bucket[key & (h->bsize-1)], true, ah, arg);
+	resize_key(hm, key);
+
+	++hm->busy;
+	le = list_apply(bucket_list(h, key), true, ah, arg);
+
+	/* Only while traversing this table */
+	if (!le && h->obucket)
+		le = list_apply(&h->obucket[key & (h->osize-1)].list, true,
+				ah, arg);
+	--hm->busy;
+
+	return le;
 }
 
 
@@ -126,14 +322,22 @@ struct le *hash_lookup(const struct hash *h, uint32_t key, list_apply_h *ah,
  */
 struct le *hash_apply(const struct hash *h, list_apply_h *ah, void *arg)
 {
+	struct hash *hm = (struct hash *)h;
 	struct le *le = NULL;
 	uint32_t i;
 
 	if (!h || !ah)
 		return NULL;
 
+	++hm->busy;
+
+	for (i=h->opos; (i<h->osize) && !le; i++)
+		le = list_apply(&h->obucket[i].list, true, ah, arg);
+
 	for (i=0; (i<h->bsize) && !le; i++)
-		le = list_apply(&h->bucket[i], true, ah, arg);
+		le = list_apply(&h->bucket[i].list, true, ah, arg);
+
+	--hm->busy;
 
 	return le;
 }
@@ -146,10 +350,18 @@ struct le *hash_apply(const struct hash *h, list_apply_h *ah, void *arg)
  * @param key Hash key
  *
  * @return Bucket list if valid input, otherwise NULL
+ *
+ * @note For resizable tables, the list is only valid until the next call
+ *       to hash_append()
  */
 struct list *hash_list(const struct hash *h, uint32_t key)
 {
-	return h ? &h->bucket[key & (h->bsize - 1)] : NULL;
+	if (!h)
+		return NULL;
+
+	resize_key((struct hash *)h, key);
+
+	return bucket_list(h, key);
 }
 
 
@@ -178,8 +390,18 @@ void hash_flush(struct hash *h)
 	if (!h)
 		return;
 
+	++h->busy;
+
+	for (i=h->opos; i<h->osize; i++)
+		list_flush(&h->obucket[i].list);
+
 	for (i=0; i<h->bsize; i++)
-		list_flush(&h->bucket[i]);
+		list_flush(&h->bucket[i].list);
+
+	--h->busy;
+
+	resize_done(h);
+	h->n = 0;
 }
 
 
@@ -195,8 +417,90 @@ void hash_clear(struct hash *h)
 	if (!h)
 		return;
 
+	++h->busy;
+
+	for (i=h->opos; i<h->osize; i++)
+		list_clear(&h->obucket[i].list);
+
 	for (i=0; i<h->bsize; i++)
-		list_clear(&h->bucket[i]);
+		list_clear(&h->bucket[i].list);
+
+	--h->busy;
+
+	resize_done(h);
+	h->n = 0;
+}
+
+
+/**
+ * Get statistics of a hashmap table
+ *
+ * @param h     Hashmap table
+ * @param hstat Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hash_get_stat(const struct hash *h, struct hashstat *hstat)
+{
+	uint32_t i;
+
+	if (!h || !hstat)
+		return EINVAL;
+
+	memset(hstat, 0, sizeof(*hstat));
+
+	hstat->elements = h->n;
+	hstat->bsize    = h->bsize;
+	hstat->osize    = h->osize;
+
+	for (i=0; i<h->bsize + h->osize; i++) {
+
+		const struct list *lst = i < h->bsize ?
+			&h->bucket[i].list : &h->obucket[i - h->bsize].list;
+		uint32_t n = list_count(lst);
+
+		if (!n)
+			continue;
+
+		++hstat->used;
+		hstat->chain_max = max(hstat->chain_max, n);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Print statistics of a hashmap table
+ *
+ * @param pf Print function
+ * @param h  Hashmap table
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hash_debug(struct re_printf *pf, const struct hash *h)
+{
+	struct hashstat hstat;
+	int err;
+
+	err = hash_get_stat(h, &hstat);
+	if (err)
+		return err;
+
+	err = re_hprintf(pf, "elements=%u buckets=%u used=%u chain_max=%u"
+			 " load=%u.%02u",
+			 hstat.elements, hstat.bsize, hstat.used,
+			 hstat.chain_max,
+			 hstat.elements / hstat.bsize,
+			 hstat.elements % hstat.bsize * 100 / hstat.bsize);
+
+	if (hstat.osize)
+		err |= re_hprintf(pf, " (resizing from %u)", hstat.osize);
+
+	if (h->keyh)
+		err |= re_hprintf(pf, " resizable");
+
+	return err;
 }
 
 
@@ -0,0 +1,487 @@
+/**
+ * @file intmap.c  Open addressing map with integer keys
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_list.h>
+#include <re_hash.h>
+
+
+/*
+ * The slots are stored inline in one array, and probed a group of 16
+ * slots at a time. Each slot has a control byte with the low 7 bits of
+ * the key hash, or the empty/deleted state, so that a group is scanned
+ * with a single SSE2 compare. A lookup stops at the first group with an
+ * empty slot.
+ */
+enum {
+	GROUP      = 16,     /**< Slots per group                  */
+	CTRL_EMPTY = 0x80,   /**< Slot was never used              */
+	CTRL_DEL   = 0xfe,   /**< Slot was removed (tombstone)     */
+	LOAD_NUM   = 7,      /**< Maximum load factor is 7/8       */
+	LOAD_DEN   = 8,
+	TOMB_DEN   = 8,      /**< Maximum tombstones are 1/8       */
+};
+
+
+/** Defines a slot */
+struct slot {
+	uint64_t key;
+	void *val;
+};
+
+/** Defines an integer key map */
+struct intmap {
+	struct slot *slotv;   /**< Slots, followed by control bytes  */
+	uint8_t *ctrl;        /**< Control bytes, one per slot       */
+	uint32_t mask;        /**< Number of groups - 1              */
+	uint32_t n;           /**< Number of elements                */
+	uint32_t used;        /**< Number of elements and tombstones */
+	uint32_t busy;        /**< Traversals in progress            */
+};
+
+
+static inline uint64_t key_hash(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+
+	return k;
+}
+
+
+static inline uint32_t ctz(uint32_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return (uint32_t)__builtin_ctz(x);
+#else
+	uint32_t i = 0;
+
+	while (!(x & 1)) {
+		x >>= 1;
+		++i;
+	}
+
+	return i;
+#endif
+}
+
+
+/* Bitmask of the slots in a group with the given control byte */
+static inline uint32_t group_match(const uint8_t *g, uint8_t c)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i *)(const void *)g);
+
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,
+						  _mm_set1_epi8((char)c)));
+#else
+	uint32_t i, bits = 0;
+
+	for (i=0; i<GROUP; i++)
+		bits |= (uint32_t)(g[i] == c) << i;
+
+	return bits;
+#endif
+}
+
+
+/* Bitmask of the empty or deleted slots in a group */
+static inline uint32_t group_free(const uint8_t *g)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i *)(const void *)g);
+
+	return (uint32_t)_mm_movemask_epi8(v);
+#else
+	uint32_t i, bits = 0;
+
+	for (i=0; i<GROUP; i++)
+		bits |= (uint32_t)(g[i] >> 7) << i;
+
+	return bits;
+#endif
+}
+
+
+static inline uint32_t capacity(const struct intmap *m)
+{
+	return (m->mask + 1) * GROUP;
+}
+
+
+static void destructor(void *data)
+{
+	struct intmap *m = data;
+
+	mem_deref(m->slotv);
+}
+
+
+static int table_alloc(struct intmap *m, uint32_t ngroups)
+{
+	uint32_t cap = ngroups * GROUP;
+	struct slot *slotv;
+
+	slotv = mem_alloc(cap * (sizeof(*slotv) + 1), NULL);
+	if (!slotv)
+		return ENOMEM;
+
+	m->slotv = slotv;
+	m->ctrl  = (uint8_t *)(slotv + cap);
+	m->mask  = ngroups - 1;
+	m->used  = 0;
+
+	memset(m->ctrl, CTRL_EMPTY, cap);
+
+	return 0;
+}
+
+
+static inline bool need_rehash(const struct intmap *m)
+{
+	uint32_t cap = capacity(m);
+
+	return (m->used + 1) * LOAD_DEN > cap * LOAD_NUM ||
+		m->used - m->n > cap / TOMB_DEN;
+}
+
+
+/* Number of groups to hold n elements below the maximum load */
+static uint32_t groups_for(uint32_t n)
+{
+	uint32_t slots = n * LOAD_DEN / LOAD_NUM + 1;
+
+	return hash_valid_size((slots + GROUP - 1) / GROUP);
+}
+
+
+/* Find a free slot for a new key, which must not be in the map */
+static uint32_t slot_free(const struct intmap *m, uint64_t h)
+{
+	uint32_t g = (uint32_t)(h >> 7) & m->mask;
+	uint32_t i;
+
+	for (i=0; i<=m->mask; i++) {
+
+		uint32_t bits = group_free(&m->ctrl[g * GROUP]);
+
+		if (bits)
+			return g * GROUP + ctz(bits);
+
+		g = (g + i + 1) & m->mask;
+	}
+
+	return UINT32_MAX;
+}
+
+
+static struct slot *slot_find(const struct intmap *m, uint64_t key,
+			      uint64_t h)
+{
+	uint32_t g = (uint32_t)(h >> 7) & m->mask;
+	uint8_t h2 = (uint8_t)(h & 0x7f);
+	uint32_t i;
+
+	for (i=0; i<=m->mask; i++) {
+
+		const uint8_t *ctrl = &m->ctrl[g * GROUP];
+		uint32_t bits = group_match(ctrl, h2);
+
+		while (bits) {
+
+			struct slot *s = &m->slotv[g * GROUP + ctz(bits)];
+
+			if (s->key == key)
+				return s;
+
+			bits &= bits - 1;
+		}
+
+		if (group_match(ctrl, CTRL_EMPTY))
+			return NULL;
+
+		g = (g + i + 1) & m->mask;
+	}
+
+	return NULL;
+}
+
+
+static int rehash(struct intmap *m, uint32_t ngroups)
+{
+	struct intmap old = *m;
+	uint32_t i, cap = capacity(m);
+	int err;
+
+	err = table_alloc(m, ngroups);
+	if (err)
+		return err;
+
+	for (i=0; i<cap; i++) {
+
+		uint64_t h;
+		uint32_t j;
+
+		if (old.ctrl[i] & 0x80)
+			continue;
+
+		h = key_hash(old.slotv[i].key);
+		j = slot_free(m, h);
+
+		m->ctrl[j]  = (uint8_t)(h & 0x7f);
+		m->slotv[j] = old.slotv[i];
+		++m->used;
+	}
+
+	mem_deref(old.slotv);
+
+	return 0;
+}
+
+
+/**
+ * Allocate a new integer key map
+ *
+ * @param mp   Pointer to allocated map
+ * @param size Expected number of elements
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int intmap_alloc(struct intmap **mp, uint32_t size)
+{
+	struct intmap *m;
+	int err;
+
+	if (!mp)
+		return EINVAL;
+
+	m = mem_zalloc(sizeof(*m), destructor);
+	if (!m)
+		return ENOMEM;
+
+	err = table_alloc(m, groups_for(size));
+	if (err)
+		mem_deref(m);
+	else
+		*mp = m;
+
+	return err;
+}
+
+
+/**
+ * Add an element to the map
+ *
+ * @param m   Integer key map
+ * @param key Key, must be unique
+ * @param val Element data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int intmap_add(struct intmap *m, uint64_t key, void *val)
+{
+	uint64_t h;
+	uint32_t i;
+
+	if (!m)
+		return EINVAL;
+
+	h = key_hash(key);
+
+	if (slot_find(m, key, h))
+		return EALREADY;
+
+	/* Grow, or clean up the tombstones, but not while traversing */
+	if (need_rehash(m) && !m->busy) {
+
+		int err = rehash(m, groups_for(m->n + 1));
+		if (err)
+			return err;
+	}
+
+	i = slot_free(m, h);
+	if (i == UINT32_MAX)
+		return ENOMEM;
+
+	if (m->ctrl[i] == CTRL_EMPTY)
+		++m->used;
+
+	m->ctrl[i] = (uint8_t)(h & 0x7f);
+	m->slotv[i].key = key;
+	m->slotv[i].val = val;
+	++m->n;
+
+	return 0;
+}
+
+
+/**
+ * Remove an element from the map
+ *
+ * @param m   Integer key map
+ * @param key Key
+ *
+ * @return Element data if found, otherwise NULL
+ */
+void *intmap_remove(struct intmap *m, uint64_t key)
+{
+	struct slot *s;
+	uint8_t *ctrl;
+	uint32_t i;
+
+	if (!m)
+		return NULL;
+
+	s = slot_find(m, key, key_hash(key));
+	if (!s)
+		return NULL;
+
+	i = (uint32_t)(s - m->slotv);
+	ctrl = &m->ctrl[i & ~(GROUP - 1)];
+
+	/* Lookups already stop at a group with an empty slot */
+	if (group_match(ctrl, CTRL_EMPTY)) {
+		m->ctrl[i] = CTRL_EMPTY;
+		--m->used;
+	}
+	else {
+		m->ctrl[i] = CTRL_DEL;
+	}
+
+	--m->n;
+
+	return s->val;
+}
+
+
+/**
+ * Find an element in the map
+ *
+ * @param m   Integer key map
+ * @param key Key
+ *
+ * @return Element data if found, otherwise NULL
+ */
+void *intmap_find(const struct intmap *m, uint64_t key)
+{
+	const struct slot *s;
+
+	if (!m)
+		return NULL;
+
+	s = slot_find(m, key, key_hash(key));
+
+	return s ? s->val : NULL;
+}
+
+
+/**
+ * Apply a handler function to all elements in the map. The handler may
+ * remove elements, but elements added meanwhile may or may not be visited.
+ *
+ * @param m   Integer key map
+ * @param ah  Apply handler
+ * @param arg Handler argument
+ *
+ * @return Element data if traversing stopped, otherwise NULL
+ */
+void *intmap_apply(const struct intmap *m, intmap_apply_h *ah, void *arg)
+{
+	struct intmap *mm = (struct intmap *)m;
+	void *val = NULL;
+	uint32_t i, cap;
+
+	if (!m || !ah)
+		return NULL;
+
+	cap = capacity(m);
+
+	++mm->busy;
+
+	for (i=0; i<cap; i++) {
+
+		if (m->ctrl[i] & 0x80)
+			continue;
+
+		if (ah(m->slotv[i].key, m->slotv[i].val, arg)) {
+			val = m->slotv[i].val;
+			break;
+		}
+	}
+
+	--mm->busy;
+
+	return val;
+}
+
+
+/**
+ * Get the number of elements in the map
+ *
+ * @param m Integer key map
+ *
+ * @return Number of elements
+ */
+uint32_t intmap_count(const struct intmap *m)
+{
+	return m ? m->n : 0;
+}
+
+
+/**
+ * Flush the map and free all elements
+ *
+ * @param m Integer key map
+ */
+void intmap_flush(struct intmap *m)
+{
+	uint32_t i, cap;
+
+	if (!m)
+		return;
+
+	cap = capacity(m);
+
+	++m->busy;
+
+	/* The element destructors may remove other elements */
+	for (i=0; i<cap; i++) {
+
+		if (m->ctrl[i] & 0x80)
+			continue;
+
+		m->ctrl[i] = CTRL_DEL;
+		--m->n;
+		mem_deref(m->slotv[i].val);
+	}
+
+	--m->busy;
+
+	intmap_clear(m);
+}
+
+
+/**
+ * Clear the map without dereferencing the elements
+ *
+ * @param m Integer key map
+ */
+void intmap_clear(struct intmap *m)
+{
+	if (!m)
+		return;
+
+	memset(m->ctrl, CTRL_EMPTY, capacity(m));
+	m->n    = 0;
+	m->used = 0;
+}
@@ -6,3 +6,4 @@
 
 SRCS	+= hash/hash.c
 SRCS	+= hash/func.c
+SRCS	+= hash/intmap.c
@@ -8,6 +8,10 @@ SRCS	+= hmac/hmac_sha1.c
 
 ifneq ($(USE_OPENSSL_HMAC),)
 SRCS	+= hmac/openssl/hmac.c
+ifeq ($(ARCH),x86_64)
+SRCS	+= hmac/native/sha1ni.c
+CFLAGS	+= -DUSE_SHA_NI
+endif
 else ifneq ($(USE_APPLE_COMMONCRYPTO),)
 SRCS	+= hmac/apple/hmac.c
 else
@@ -0,0 +1,321 @@
+/**
+ * @file native/sha1ni.c  HMAC-SHA1 using SHA-NI instructions
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <cpuid.h>
+#include <immintrin.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include "sha1ni.h"
+
+
+#define DEBUG_MODULE "sha1ni"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * The inner and outer states after the padded key blocks are computed
+ * once per key, so that a digest of a short packet is three compressions
+ * without any per-call setup.
+ */
+#define TARGET __attribute__((target("sha,sse4.1")))
+
+
+enum {
+	BLOCK_SIZE  = 64,  /**< SHA-1 block size [bytes]  */
+	DIGEST_SIZE = 20,  /**< SHA-1 digest size [bytes] */
+};
+
+
+static const uint32_t sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+
+static inline TARGET __m128i load_msg(const uint8_t *p)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607LL,
+					    0x08090a0b0c0d0e0fLL);
+
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)
+						(const void *)p), mask);
+}
+
+
+/*
+ * Four rounds, with message schedule. The message words rotate through
+ * m0-m3 and the E values alternate between e0 and e1.
+ */
+#define SHA1_GROUP(ea, eb, mx, my, mz, mw, f)				\
+	ea   = _mm_sha1nexte_epu32(ea, mx);				\
+	eb   = abcd;							\
+	my   = _mm_sha1msg2_epu32(my, mx);				\
+	abcd = _mm_sha1rnds4_epu32(abcd, ea, f);			\
+	mz   = _mm_sha1msg1_epu32(mz, mx);				\
+	mw   = _mm_xor_si128(mw, mx)
+
+
+static TARGET void compress(uint32_t *state, const uint8_t *p,
+			    size_t blocks)
+{
+	__m128i abcd, abcd_save, e0, e0_save, e1, m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)
+						 (const void *)state), 0x1b);
+	e0   = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	while (blocks--) {
+
+		abcd_save = abcd;
+		e0_save   = e0;
+
+		/* Rounds 0-15 load the message */
+		m0   = load_msg(p);
+		e0   = _mm_add_epi32(e0, m0);
+		e1   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		m1   = load_msg(p + 16);
+		e1   = _mm_sha1nexte_epu32(e1, m1);
+		e0   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0   = _mm_sha1msg1_epu32(m0, m1);
+
+		m2   = load_msg(p + 32);
+		e0   = _mm_sha1nexte_epu32(e0, m2);
+		e1   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1   = _mm_sha1msg1_epu32(m1, m2);
+		m0   = _mm_xor_si128(m0, m2);
+
+		m3   = load_msg(p + 48);
+		SHA1_GROUP(e1, e0, m3, m0, m2, m1, 0);
+
+		/* Rounds 16-79 */
+		SHA1_GROUP(e0, e1, m0, m1, m3, m2, 0);
+		SHA1_GROUP(e1, e0, m1, m2, m0, m3, 1);
+		SHA1_GROUP(e0, e1, m2, m3, m1, m0, 1);
+		SHA1_GROUP(e1, e0, m3, m0, m2, m1, 1);
+		SHA1_GROUP(e0, e1, m0, m1, m3, m2, 1);
+		SHA1_GROUP(e1, e0, m1, m2, m0, m3, 1);
+		SHA1_GROUP(e0, e1, m2, m3, m1, m0, 2);
+		SHA1_GROUP(e1, e0, m3, m0, m2, m1, 2);
+		SHA1_GROUP(e0, e1, m0, m1, m3, m2, 2);
+		SHA1_GROUP(e1, e0, m1, m2, m0, m3, 2);
+		SHA1_GROUP(e0, e1, m2, m3, m1, m0, 2);
+		SHA1_GROUP(e1, e0, m3, m0, m2, m1, 3);
+		SHA1_GROUP(e0, e1, m0, m1, m3, m2, 3);
+		SHA1_GROUP(e1, e0, m1, m2, m0, m3, 3);
+		SHA1_GROUP(e0, e1, m2, m3, m1, m0, 3);
+		SHA1_GROUP(e1, e0, m3, m0, m2, m1, 3);
+
+		e0   = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+
+		p += BLOCK_SIZE;
+	}
+
+	_mm_storeu_si128((__m128i *)(void *)state,
+			 _mm_shuffle_epi32(abcd, 0x1b));
+	state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+
+/*
+ * Hash the rest of a message, after 'done' bytes of whole blocks are
+ * already in the state, and write the digest.
+ */
+static void sha1_final(uint32_t *state, uint64_t done, const uint8_t *p,
+		       size_t len, uint8_t *md)
+{
+	uint8_t buf[2 * BLOCK_SIZE];
+	uint64_t bits = (done + len) * 8;
+	size_t n = len / BLOCK_SIZE, rest, i;
+
+	if (n)
+		compress(state, p, n);
+
+	p   += n * BLOCK_SIZE;
+	rest = len - n * BLOCK_SIZE;
+
+	n = (rest + 9 > BLOCK_SIZE) ? 2 : 1;
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, p, rest);
+	buf[rest] = 0x80;
+
+	for (i=0; i<8; i++)
+		buf[n * BLOCK_SIZE - 1 - i] = (uint8_t)(bits >> (8 * i));
+
+	compress(state, buf, n);
+	mem_secclean(buf, sizeof(buf));
+
+	for (i=0; i<5; i++) {
+		md[4*i]   = (uint8_t)(state[i] >> 24);
+		md[4*i+1] = (uint8_t)(state[i] >> 16);
+		md[4*i+2] = (uint8_t)(state[i] >> 8);
+		md[4*i+3] = (uint8_t)state[i];
+	}
+}
+
+
+static bool cpu_check(void)
+{
+	unsigned eax, ebx, ecx, edx;
+	const unsigned need = bit_SSSE3 | bit_SSE4_1;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	if ((ecx & need) != need)
+		return false;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	return (ebx & bit_SHA) != 0;
+}
+
+
+/* Known-answer tests, FIPS 180 "abc" and RFC 2202 test case 2 */
+static bool selftest(void)
+{
+	static const uint8_t abc[DIGEST_SIZE] = {
+		0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+		0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d
+	};
+	static const uint8_t hmac[DIGEST_SIZE] = {
+		0xef, 0xfc, 0xdf, 0x6a, 0xe5, 0xeb, 0x2f, 0xa2, 0xd2, 0x74,
+		0x16, 0xd5, 0xf1, 0x84, 0xdf, 0x9c, 0x25, 0x9a, 0x7c, 0x79
+	};
+	static const char data[] = "what do ya want for nothing?";
+	uint8_t md[DIGEST_SIZE];
+	struct sha1ni_hmac h;
+	uint32_t state[5];
+
+	memcpy(state, sha1_iv, sizeof(state));
+	sha1_final(state, 0, (const uint8_t *)"abc", 3, md);
+
+	if (memcmp(md, abc, sizeof(md)))
+		return false;
+
+	sha1ni_hmac_init(&h, (const uint8_t *)"Jefe", 4);
+	sha1ni_hmac_digest(&h, md, sizeof(md), (const uint8_t *)data,
+			   sizeof(data) - 1);
+
+	return !memcmp(md, hmac, sizeof(md));
+}
+
+
+/**
+ * Check if SHA-NI can be used, the result is cached
+ *
+ * @return true if available, otherwise false
+ */
+bool sha1ni_available(void)
+{
+	static int state;
+	int s, zero = 0;
+
+	s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+	if (s)
+		return s > 0;
+
+	/* Threads may race to run the checks, only the first one is kept */
+	s = (cpu_check() && selftest()) ? 1 : -1;
+
+	if (__atomic_compare_exchange_n(&state, &zero, s, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		if (s < 0 && cpu_check())
+			DEBUG_WARNING("known-answer tests failed\n");
+	}
+	else {
+		s = zero;
+	}
+
+	return s > 0;
+}
+
+
+/**
+ * Precompute the HMAC-SHA1 states of a key
+ *
+ * @param h       HMAC-SHA1 states
+ * @param key     Key
+ * @param key_len Key length in bytes
+ */
+void sha1ni_hmac_init(struct sha1ni_hmac *h, const uint8_t *key,
+		      size_t key_len)
+{
+	uint8_t ipad[BLOCK_SIZE], opad[BLOCK_SIZE], md[DIGEST_SIZE];
+	size_t i;
+
+	if (!h || !key)
+		return;
+
+	/* Longer keys are hashed first */
+	if (key_len > BLOCK_SIZE) {
+		uint32_t state[5];
+
+		memcpy(state, sha1_iv, sizeof(state));
+		sha1_final(state, 0, key, key_len, md);
+		mem_secclean(state, sizeof(state));
+
+		key     = md;
+		key_len = sizeof(md);
+	}
+
+	memset(ipad, 0x36, sizeof(ipad));
+	memset(opad, 0x5c, sizeof(opad));
+
+	for (i=0; i<key_len; i++) {
+		ipad[i] ^= key[i];
+		opad[i] ^= key[i];
+	}
+
+	memcpy(h->istate, sha1_iv, sizeof(h->istate));
+	memcpy(h->ostate, sha1_iv, sizeof(h->ostate));
+
+	compress(h->istate, ipad, 1);
+	compress(h->ostate, opad, 1);
+
+	mem_secclean(ipad, sizeof(ipad));
+	mem_secclean(opad, sizeof(opad));
+	mem_secclean(md, sizeof(md));
+}
+
+
+/**
+ * Calculate the HMAC-SHA1 of data
+ *
+ * @param h      Precomputed HMAC-SHA1 states
+ * @param md     Message digest, truncated to at most 20 bytes
+ * @param md_len Size of the message digest buffer
+ * @param data   Data
+ * @param len    Length of data
+ */
+void sha1ni_hmac_digest(const struct sha1ni_hmac *h, uint8_t *md,
+			size_t md_len, const uint8_t *data, size_t len)
+{
+	uint8_t inner[DIGEST_SIZE], outer[DIGEST_SIZE];
+	uint32_t state[5];
+
+	if (!h || !md || !data)
+		return;
+
+	memcpy(state, h->istate, sizeof(state));
+	sha1_final(state, BLOCK_SIZE, data, len, inner);
+
+	memcpy(state, h->ostate, sizeof(state));
+	sha1_final(state, BLOCK_SIZE, inner, sizeof(inner), outer);
+
+	memcpy(md, outer, min(md_len, sizeof(outer)));
+
+	mem_secclean(state, sizeof(state));
+	mem_secclean(inner, sizeof(inner));
+}
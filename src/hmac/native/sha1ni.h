@@ -0,0 +1,18 @@
+/**
+ * @file native/sha1ni.h  HMAC-SHA1 using SHA-NI instructions -- internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/** Defines the precomputed inner and outer HMAC-SHA1 states */
+struct sha1ni_hmac {
+	uint32_t istate[5];  /**< State after the key XOR ipad block */
+	uint32_t ostate[5];  /**< State after the key XOR opad block */
+};
+
+bool sha1ni_available(void);
+void sha1ni_hmac_init(struct sha1ni_hmac *h, const uint8_t *key,
+		      size_t key_len);
+void sha1ni_hmac_digest(const struct sha1ni_hmac *h, uint8_t *md,
+			size_t md_len, const uint8_t *data, size_t len);
@@ -9,10 +9,16 @@
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_hmac.h>
+#ifdef USE_SHA_NI
+#include "../native/sha1ni.h"
+#endif
 
 
 struct hmac {
 	HMAC_CTX *ctx;
+#ifdef USE_SHA_NI
+	struct sha1ni_hmac ni;  /**< Native HMAC-SHA1, used if no ctx */
+#endif
 };
 
 
@@ -20,6 +26,10 @@ static void destructor(void *arg)
 {
 	struct hmac *hmac = arg;
 
+#ifdef USE_SHA_NI
+	mem_secclean(&hmac->ni, sizeof(hmac->ni));
+#endif
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
 	!defined(LIBRESSL_VERSION_NUMBER)
 
@@ -61,6 +71,13 @@ int hmac_create(struct hmac **hmacp, enum hmac_hash hash,
 	if (!hmac)
 		return ENOMEM;
 
+#ifdef USE_SHA_NI
+	if (hash == HMAC_HASH_SHA1 && sha1ni_available()) {
+		sha1ni_hmac_init(&hmac->ni, key, key_len);
+		goto out;
+	}
+#endif
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
 	!defined(LIBRESSL_VERSION_NUMBER)
 
@@ -107,6 +124,13 @@ int hmac_digest(struct hmac *hmac, uint8_t *md, size_t md_len,
 	if (!hmac || !md || !md_len || !data || !data_len)
 		return EINVAL;
 
+#ifdef USE_SHA_NI
+	if (!hmac->ctx) {
+		sha1ni_hmac_digest(&hmac->ni, md, md_len, data, data_len);
+		return 0;
+	}
+#endif
+
 #if (OPENSSL_VERSION_NUMBER >= 0x00909000)
 	/* the HMAC context must be reset here */
 	if (!HMAC_Init_ex(hmac->ctx, 0, 0, 0, NULL))
@@ -12,6 +12,7 @@
 #include <re_fmt.h>
 #include <re_msg.h>
 #include <re_http.h>
+#include "../fmt/fmt.h"
 
 
 enum {
@@ -142,6 +143,7 @@ static inline int hdr_add(struct http_msg *msg, const struct pl *name,
  */
 int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 {
+	static struct regex *rx_line, *rx_req, *rx_resp;
 	struct pl b, s, e, name, scode;
 	const char *p, *cv;
 	struct http_msg *msg;
@@ -157,7 +159,8 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 	p = (const char *)mbuf_buf(mb);
 	l = mbuf_get_left(mb);
 
-	if (re_regex(p, l, "[\r\n]*[^\r\n]+[\r]*[\n]1", &b, &s, NULL, &e))
+	if (re_regex_cached(&rx_line, p, l, "[\r\n]*[^\r\n]+[\r]*[\n]1",
+			    &b, &s, NULL, &e))
 		return (l > STARTLINE_MAX) ? EBADMSG : ENODATA;
 
 	msg = mem_zalloc(sizeof(*msg), destructor);
@@ -173,16 +176,19 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 	}
 
 	if (req) {
-		if (re_regex(s.p, s.l, "[a-z]+ [^? ]+[^ ]* HTTP/[0-9.]+",
-			     &msg->met, &msg->path, &msg->prm, &msg->ver) ||
+		if (re_regex_cached(&rx_req, s.p, s.l,
+				    "[a-z]+ [^? ]+[^ ]* HTTP/[0-9.]+",
+				    &msg->met, &msg->path, &msg->prm,
+				    &msg->ver) ||
 		    msg->met.p != s.p) {
 			err = EBADMSG;
 			goto out;
 		}
 	}
 	else {
-		if (re_regex(s.p, s.l, "HTTP/[0-9.]+ [0-9]+[ ]*[^]*",
-			     &msg->ver, &scode, NULL, &msg->reason) ||
+		if (re_regex_cached(&rx_resp, s.p, s.l,
+				    "HTTP/[0-9.]+ [0-9]+[ ]*[^]*",
+				    &msg->ver, &scode, NULL, &msg->reason) ||
 		    msg->ver.p != s.p + 5) {
 			err = EBADMSG;
 			goto out;
@@ -290,6 +296,7 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 				quote = !quote;
 
 			ws = 0;
+			fmt_hdrval_skip(&p, &l);
 			break;
 		}
 	}
@@ -188,6 +188,7 @@ static int media_pwd_decode(struct icem *icem, const char *value)
 
 static int cand_decode(struct icem *icem, const char *val)
 {
+	static struct regex *rx_cand, *rx_ext;
 	struct pl foundation, compid, transp, prio, addr, port, cand_type;
 	struct pl extra = pl_null;
 	struct sa caddr, rel_addr;
@@ -197,10 +198,11 @@ static int cand_decode(struct icem *icem, const char *val)
 
 	sa_init(&rel_addr, AF_INET);
 
-	err = re_regex(val, strlen(val),
-		       "[^ ]+ [0-9]+ [^ ]+ [0-9]+ [^ ]+ [0-9]+ typ [a-z]+[^]*",
-		       &foundation, &compid, &transp, &prio,
-		       &addr, &port, &cand_type, &extra);
+	err = re_regex_cached(&rx_cand, val, strlen(val),
+			      "[^ ]+ [0-9]+ [^ ]+ [0-9]+ [^ ]+ [0-9]+ "
+			      "typ [a-z]+[^]*",
+			      &foundation, &compid, &transp, &prio,
+			      &addr, &port, &cand_type, &extra);
 	if (err)
 		return err;
 
@@ -216,8 +218,8 @@ static int cand_decode(struct icem *icem, const char *val)
 		struct pl name, value;
 
 		/* Loop through " SP attr SP value" pairs */
-		while (!re_regex(extra.p, extra.l, " [^ ]+ [^ ]+",
-				 &name, &value)) {
+		while (!re_regex_cached(&rx_ext, extra.p, extra.l,
+					" [^ ]+ [^ ]+", &name, &value)) {
 
 			pl_advance(&extra, value.p + value.l - extra.p);
 
@@ -361,6 +363,7 @@ int ice_cand_attr_encode(struct re_printf *pf,
 
 int ice_cand_attr_decode(struct ice_cand_attr *cand, const char *val)
 {
+	static struct regex *rx_cand, *rx_raddr, *rx_tcptype;
 	struct pl pl_fnd, pl_compid, pl_transp, pl_prio, pl_addr, pl_port;
 	struct pl pl_type, pl_raddr, pl_rport, pl_opt = PL_INIT;
 	size_t len;
@@ -374,11 +377,11 @@ int ice_cand_attr_decode(struct ice_cand_attr *cand, const char *val)
 
 	len = str_len(val);
 
-	err = re_regex(val, len,
-		       "[^ ]+ [0-9]+ [a-z]+ [0-9]+ [^ ]+ [0-9]+ typ [a-z]+"
-		       "[^]*",
-		       &pl_fnd, &pl_compid, &pl_transp, &pl_prio,
-		       &pl_addr, &pl_port, &pl_type, &pl_opt);
+	err = re_regex_cached(&rx_cand, val, len,
+			      "[^ ]+ [0-9]+ [a-z]+ [0-9]+ [^ ]+ [0-9]+ "
+			      "typ [a-z]+[^]*",
+			      &pl_fnd, &pl_compid, &pl_transp, &pl_prio,
+			      &pl_addr, &pl_port, &pl_type, &pl_opt);
 	if (err)
 		return err;
 
@@ -404,8 +407,9 @@ int ice_cand_attr_decode(struct ice_cand_attr *cand, const char *val)
 
 	/* optional */
 
-	if (0 == re_regex(pl_opt.p, pl_opt.l, "raddr [^ ]+ rport [0-9]+",
-			  &pl_raddr, &pl_rport)) {
+	if (0 == re_regex_cached(&rx_raddr, pl_opt.p, pl_opt.l,
+				 "raddr [^ ]+ rport [0-9]+",
+				 &pl_raddr, &pl_rport)) {
 
 		err = sa_set(&cand->rel_addr, &pl_raddr, pl_u32(&pl_rport));
 		if (err)
@@ -416,8 +420,8 @@ int ice_cand_attr_decode(struct ice_cand_attr *cand, const char *val)
 
 		struct pl tcptype;
 
-		err = re_regex(pl_opt.p, pl_opt.l, "tcptype [^ ]+",
-			       &tcptype);
+		err = re_regex_cached(&rx_tcptype, pl_opt.p, pl_opt.l,
+				      "tcptype [^ ]+", &tcptype);
 		if (err)
 			return err;
 
@@ -230,6 +230,7 @@ static int stunsrv_ereply(struct icem_comp *comp, const struct sa *src,
 int icem_stund_recv(struct icem_comp *comp, const struct sa *src,
 		    struct stun_msg *req, size_t presz)
 {
+	static struct regex *rx;
 	struct icem *icem = comp->icem;
 	struct stun_attr *attr;
 	struct pl lu, ru;
@@ -256,8 +257,9 @@ int icem_stund_recv(struct icem_comp *comp, const struct sa *src,
 	if (!attr)
 		goto badmsg;
 
-	err = re_regex(attr->v.username, strlen(attr->v.username),
-		       "[^:]+:[^]+", &lu, &ru);
+	err = re_regex_cached(&rx, attr->v.username,
+			      strlen(attr->v.username), "[^:]+:[^]+",
+			      &lu, &ru);
 	if (err) {
 		DEBUG_WARNING("could not parse USERNAME attribute (%s)\n",
 			      attr->v.username);
@@ -9,6 +9,7 @@
 #include <re_list.h>
 #include <re_mbuf.h>
 #include <re_mem.h>
+#include <re_tmr.h>
 #include <re_rtp.h>
 #include <re_jbuf.h>
 
@@ -23,6 +24,20 @@
 #endif
 
 
+/** Adaptive jitter buffer values */
+enum {
+	PTIME_DEFAULT = 20,        /**< [ms] Packet time until measured      */
+	PTIME_MAX     = 120,       /**< [ms] Largest packet time             */
+	JITTER_MAX    = 1000000,   /**< [us] Larger jumps are a new stream */
+};
+
+/** Frame slot values */
+enum {
+	SLOTS_MIN = 16,            /**< Smallest number of slots             */
+	SLOTS_MAX = 32768,         /**< Half of the sequence number space    */
+};
+
+
 #if JBUF_STAT
 #define STAT_ADD(var, value)  (jb->stat.var) += (value) /**< Stats add */
 #define STAT_INC(var)         ++(jb->stat.var)          /**< Stats inc */
@@ -34,9 +49,9 @@
 
 /** Defines a packet frame */
 struct frame {
-	struct le le;           /**< Linked list element       */
 	struct rtp_header hdr;  /**< RTP Header                */
 	void *mem;              /**< Reference counted pointer */
+	bool used;              /**< Slot holds a frame        */
 };
 
 
@@ -44,17 +59,38 @@ struct frame {
  * Defines a jitter buffer
  *
  * The jitter buffer is for incoming RTP packets, which are sorted by
- * sequence number.
+ * sequence number. The frames are stored in a circular array of slots,
+ * indexed by the sequence number, with at least twice the maximum number
+ * of frames so that gaps from lost packets fit. The frames from head to
+ * hi are in sequence order, and the slots of lost frames are unused.
  */
 struct jbuf {
-	struct list pooll;   /**< List of free frames in pool               */
-	struct list framel;  /**< List of buffered frames                   */
+	struct frame *slotv; /**< Frame slots, indexed by sequence number   */
+	uint32_t mask;       /**< Number of slots - 1                       */
+	uint16_t head;       /**< Sequence number of the first frame        */
+	uint16_t hi;         /**< Sequence number of the last frame         */
 	uint32_t n;          /**< [# frames] Current # of frames in buffer  */
 	uint32_t min;        /**< [# frames] Minimum # of frames to buffer  */
 	uint32_t max;        /**< [# frames] Maximum # of frames to buffer  */
 	uint16_t seq_put;    /**< Sequence number for last jbuf_put()       */
 	bool running;        /**< Jitter buffer is running                  */
 
+	enum jbuf_type type; /**< Jitter buffer type                        */
+	uint32_t srate;      /**< [Hz] RTP clock rate                       */
+	uint32_t ptime;      /**< [ms] Packet time                          */
+	uint32_t jitter;     /**< [us] Inter-arrival jitter                 */
+	uint32_t target;     /**< [ms] Target playout delay                 */
+	bool wait;           /**< Buffering up to the target delay          */
+	jbuf_delay_h *delayh; /**< Delay policy                             */
+	void *arg;           /**< Delay policy argument                     */
+
+	struct {
+		uint64_t arrival;  /**< [us] Arrival time          */
+		uint32_t ts;       /**< RTP timestamp              */
+		uint16_t seq;      /**< Sequence number            */
+		bool valid;        /**< A frame has arrived        */
+	} last;              /**< Last in-order frame, for the jitter       */
+
 #if JBUF_STAT
 	uint16_t seq_get;      /**< Timestamp of last played frame */
 	struct jbuf_stat stat; /**< Jitter buffer Statistics       */
@@ -69,57 +105,158 @@ static inline bool seq_less(uint16_t x, uint16_t y)
 }
 
 
-/**
- * Get a frame from the pool
- */
-static void frame_alloc(struct jbuf *jb, struct frame **f)
+/* Default delay policy, three times the jitter and one packet */
+static uint32_t delay_default(uint32_t jitter, uint32_t ptime, void *arg)
+{
+	(void)arg;
+
+	return 3 * jitter + ptime;
+}
+
+
+/* Update the target delay, within the size of the buffer */
+static void target_update(struct jbuf *jb)
 {
-	struct le *le;
+	uint32_t lo, hi, target;
 
-	le = jb->pooll.head;
-	if (le) {
-		list_unlink(le);
-		++jb->n;
+	if (jb->type != JBUF_ADAPTIVE) {
+		jb->target = jb->min * jb->ptime;
+		return;
 	}
-	else {
-		struct frame *f0;
 
-		/* Steal an old frame */
-		le = jb->framel.head;
-		f0 = le->data;
+	lo = max(jb->min, 1) * jb->ptime;
+	hi = max(jb->max, 2) * jb->ptime - jb->ptime;
 
-		STAT_INC(n_overflow);
-		DEBUG_INFO("drop 1 old frame seq=%u (total dropped %u)\n",
-			   f0->hdr.seq, jb->stat.n_overflow);
+	target = jb->delayh(jb->jitter / 1000, jb->ptime, jb->arg);
+
+	jb->target = min(max(target, lo), max(hi, lo));
+}
 
-		f0->mem = mem_deref(f0->mem);
-		list_unlink(le);
+
+/*
+ * Update the inter-arrival jitter (RFC 3550 A.8) from the frames that
+ * arrive in order, with a fast attack and a slow decay. Timestamps and
+ * sequence numbers are compared as signed differences, so they wrap.
+ */
+static void jitter_update(struct jbuf *jb, const struct rtp_header *hdr)
+{
+	const uint64_t now = tmr_jiffies_us();
+	int64_t d;
+	int32_t dts;
+	int16_t dseq;
+
+	if (!jb->srate)
+		return;
+
+	if (!jb->last.valid)
+		goto out;
+
+	dseq = (int16_t)(hdr->seq - jb->last.seq);
+	if (dseq <= 0)
+		return;
+
+	dts = (int32_t)(hdr->ts - jb->last.ts);
+
+	d = (int64_t)(now - jb->last.arrival) -
+		(int64_t)dts * 1000000 / jb->srate;
+	if (d < 0)
+		d = -d;
+
+	if (d > JITTER_MAX)
+		goto out;
+
+	if (d > jb->jitter)
+		jb->jitter += (uint32_t)(d - jb->jitter) / 4;
+	else
+		jb->jitter -= (uint32_t)(jb->jitter - d) / 64;
+
+	/* The first packet of a talkspurt follows a DTX gap */
+	if (dseq == 1 && dts > 0 && !hdr->m) {
+
+		uint32_t ptime = (uint32_t)((int64_t)dts * 1000 / jb->srate);
+
+		if (ptime && ptime <= PTIME_MAX)
+			jb->ptime = ptime;
 	}
 
-	*f = le->data;
+ out:
+	jb->last.arrival = now;
+	jb->last.ts      = hdr->ts;
+	jb->last.seq     = hdr->seq;
+	jb->last.valid   = true;
+}
+
+
+static inline struct frame *frame_slot(const struct jbuf *jb, uint16_t seq)
+{
+	return &jb->slotv[seq & jb->mask];
+}
+
+
+/**
+ * Release the first frame, and move the head to the next frame
+ */
+static void frame_pop(struct jbuf *jb)
+{
+	struct frame *f = frame_slot(jb, jb->head);
+
+	f->mem  = mem_deref(f->mem);
+	f->used = false;
+
+	if (!--jb->n)
+		return;
+
+	do {
+		++jb->head;
+	} while (!frame_slot(jb, jb->head)->used);
 }
 
 
 /**
- * Release a frame, put it back in the pool
+ * Drop the first frame to make room for a new frame
  */
-static void frame_deref(struct jbuf *jb, struct frame *f)
+static void frame_drop(struct jbuf *jb)
 {
-	f->mem = mem_deref(f->mem);
-	list_unlink(&f->le);
-	list_append(&jb->pooll, &f->le, f);
-	--jb->n;
+	STAT_INC(n_overflow);
+	DEBUG_INFO("drop 1 old frame seq=%u (total dropped %u)\n",
+		   jb->head, jb->stat.n_overflow);
+
+	frame_pop(jb);
 }
 
 
+#if JBUF_STAT
+/* Count the frames lost before a played frame */
+static void seq_check(struct jbuf *jb, uint16_t seq)
+{
+	/* Check timestamp of previously played frame */
+	if (jb->seq_get) {
+		const int16_t seq_diff = seq - jb->seq_get;
+		if (seq_less(seq, jb->seq_get)) {
+			DEBUG_WARNING("get: seq=%u too late\n", seq);
+		}
+		else if (seq_diff > 1) {
+			STAT_ADD(n_lost, 1);
+			DEBUG_INFO("get: n_lost: diff=%d,seq=%u,seq_get=%u\n",
+				   seq_diff, seq, jb->seq_get);
+		}
+	}
+
+	/* Update sequence number for 'get' */
+	jb->seq_get = seq;
+}
+#else
+#define seq_check(jb, seq)
+#endif
+
+
 static void jbuf_destructor(void *data)
 {
 	struct jbuf *jb = data;
 
 	jbuf_flush(jb);
 
-	/* Free all frames in the pool list */
-	list_flush(&jb->pooll);
+	mem_deref(jb->slotv);
 }
 
 
@@ -135,7 +272,7 @@ static void jbuf_destructor(void *data)
 int jbuf_alloc(struct jbuf **jbp, uint32_t min, uint32_t max)
 {
 	struct jbuf *jb;
-	uint32_t i;
+	uint32_t size;
 	int err = 0;
 
 	if (!jbp || ( min > max))
@@ -153,23 +290,26 @@ int jbuf_alloc(struct jbuf **jbp, uint32_t min, uint32_t max)
 	if (!jb)
 		return ENOMEM;
 
-	list_init(&jb->pooll);
-	list_init(&jb->framel);
+	jb->min    = min;
+	jb->max    = max;
+	jb->type   = JBUF_FIXED;
+	jb->ptime  = PTIME_DEFAULT;
+	jb->delayh = delay_default;
+	jb->wait   = true;
 
-	jb->min  = min;
-	jb->max  = max;
+	target_update(jb);
 
-	/* Allocate all frames now */
-	for (i=0; i<jb->max; i++) {
-		struct frame *f = mem_zalloc(sizeof(*f), NULL);
-		if (!f) {
-			err = ENOMEM;
-			break;
-		}
+	/* Allocate all slots now, a power of 2 above twice the frames */
+	for (size = SLOTS_MIN; size / 2 < max && size < SLOTS_MAX; size *= 2)
+		;
 
-		list_append(&jb->pooll, &f->le, f);
-		DEBUG_INFO("alloc: adding to pool list %u\n", i);
-	}
+	jb->slotv = mem_zalloc(size * sizeof(*jb->slotv), NULL);
+	if (!jb->slotv)
+		err = ENOMEM;
+
+	jb->mask = size - 1;
+
+	DEBUG_INFO("alloc: %u frame slots\n", size);
 
 	if (err)
 		mem_deref(jb);
@@ -180,6 +320,55 @@ int jbuf_alloc(struct jbuf **jbp, uint32_t min, uint32_t max)
 }
 
 
+/**
+ * Set the type of the jitter buffer. The adaptive type measures the
+ * inter-arrival jitter from the RTP timestamps, and keeps a target delay
+ * from the delay policy, between min and max frames.
+ *
+ * @param jb    Jitter buffer
+ * @param type  Jitter buffer type
+ * @param srate RTP clock rate [Hz], required for the adaptive type
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int jbuf_set_type(struct jbuf *jb, enum jbuf_type type, uint32_t srate)
+{
+	if (!jb)
+		return EINVAL;
+
+	if (type == JBUF_ADAPTIVE && !srate)
+		return EINVAL;
+
+	jb->type       = type;
+	jb->srate      = srate;
+	jb->wait       = true;
+	jb->last.valid = false;
+
+	target_update(jb);
+
+	return 0;
+}
+
+
+/**
+ * Set the delay policy of an adaptive jitter buffer
+ *
+ * @param jb     Jitter buffer
+ * @param delayh Delay policy handler, NULL for the default policy
+ * @param arg    Handler argument
+ */
+void jbuf_set_delay_handler(struct jbuf *jb, jbuf_delay_h *delayh, void *arg)
+{
+	if (!jb)
+		return;
+
+	jb->delayh = delayh ? delayh : delay_default;
+	jb->arg    = arg;
+
+	target_update(jb);
+}
+
+
 /**
  * Put one frame into the jitter buffer
  *
@@ -192,9 +381,7 @@ int jbuf_alloc(struct jbuf **jbp, uint32_t min, uint32_t max)
 int jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem)
 {
 	struct frame *f;
-	struct le *le, *tail;
 	uint16_t seq;
-	int err = 0;
 
 	if (!jb || !hdr)
 		return EINVAL;
@@ -203,6 +390,9 @@ int jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem)
 
 	STAT_INC(n_put);
 
+	jitter_update(jb, hdr);
+	target_update(jb);
+
 	if (jb->running) {
 
 		/* Packet arrived too late to be put into buffer */
@@ -214,60 +404,148 @@ int jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem)
 		}
 	}
 
-	frame_alloc(jb, &f);
-
-	tail = jb->framel.tail;
+	f = frame_slot(jb, seq);
 
-	/* If buffer is empty -> append to tail
-	   Frame is later than tail -> append to tail
-	*/
-	if (!tail || seq_less(((struct frame *)tail->data)->hdr.seq, seq)) {
-		list_append(&jb->framel, &f->le, f);
+	if (!jb->n)
 		goto out;
-	}
 
-	/* Out-of-sequence, find right position */
-	for (le = tail; le; le = le->prev) {
-		const uint16_t seq_le = ((struct frame *)le->data)->hdr.seq;
+	if (seq_less(jb->hi, seq)) {
 
-		if (seq_less(seq_le, seq)) { /* most likely */
-			DEBUG_INFO("put: out-of-sequence"
-				   " - inserting after seq=%u (seq=%u)\n",
-				   seq_le, seq);
-			list_insert_after(&jb->framel, le, &f->le, f);
-			break;
-		}
-		else if (seq == seq_le) { /* less likely */
-			/* Detect duplicates */
-			DEBUG_INFO("duplicate: seq=%u\n", seq);
-			STAT_INC(n_dups);
-			list_insert_after(&jb->framel, le, &f->le, f);
-			frame_deref(jb, f);
-			return EALREADY;
-		}
-
-		/* sequence number less than current seq, continue */
+		/* Later than tail, drop frames that do not fit */
+		while (jb->n && (uint16_t)(seq - jb->head) > jb->mask)
+			frame_drop(jb);
 	}
+	else if (seq_less(seq, jb->head) &&
+		 (uint16_t)(jb->hi - seq) > jb->mask) {
 
-	/* no earlier timestamps found, put in head */
-	if (!le) {
-		DEBUG_INFO("put: out-of-sequence"
-			   " - put in head (seq=%u)\n", seq);
-		list_prepend(&jb->framel, &f->le, f);
+		STAT_INC(n_late);
+		DEBUG_INFO("packet too old: seq=%u (head=%u)\n",
+			   seq, jb->head);
+		return ETIMEDOUT;
+	}
+	else if (f->used) {
+		/* Detect duplicates */
+		DEBUG_INFO("duplicate: seq=%u\n", seq);
+		STAT_INC(n_dups);
+		return EALREADY;
+	}
+	else {
+		DEBUG_INFO("put: out-of-sequence (seq=%u)\n", seq);
+		STAT_INC(n_oos);
 	}
 
-	STAT_INC(n_oos);
+	if (jb->n >= jb->max && jb->n)
+		frame_drop(jb);
 
  out:
+	if (!jb->n) {
+		jb->head = seq;
+		jb->hi   = seq;
+	}
+	else if (seq_less(seq, jb->head)) {
+		jb->head = seq;
+	}
+	else if (seq_less(jb->hi, seq)) {
+		jb->hi = seq;
+	}
+
+	++jb->n;
+
 	/* Update last timestamp */
 	jb->running = true;
 	jb->seq_put = seq;
 
 	/* Success */
-	f->hdr = *hdr;
-	f->mem = mem_ref(mem);
+	f->hdr  = *hdr;
+	f->mem  = mem_ref(mem);
+	f->used = true;
 
-	return err;
+	return 0;
+}
+
+
+/*
+ * An adaptive buffer waits until it holds the target delay when it
+ * starts, after an underflow, and at the start of a talkspurt if the
+ * delay is too short. Frames are skipped while the delay is more than
+ * two packets above the target.
+ */
+static bool adaptive_ready(struct jbuf *jb)
+{
+	struct frame *f;
+	uint32_t delay;
+
+	if (!jb->n) {
+		jb->wait = true;
+		return false;
+	}
+
+	f = frame_slot(jb, jb->head);
+	delay = jb->n * jb->ptime;
+
+	if (f->hdr.m && delay < jb->target)
+		jb->wait = true;
+
+	if (jb->wait) {
+		if (delay < jb->target)
+			return false;
+
+		jb->wait = false;
+	}
+
+	if (delay > jb->target + 2 * jb->ptime && jb->n > 1) {
+
+		DEBUG_INFO("skip: seq=%u delay=%ums target=%ums\n",
+			   f->hdr.seq, delay, jb->target);
+
+		STAT_INC(n_skip);
+#if JBUF_STAT
+		jb->seq_get = f->hdr.seq;
+#endif
+		frame_pop(jb);
+	}
+
+	return true;
+}
+
+
+/* Is the first frame ready to be played? */
+static bool get_ready(struct jbuf *jb)
+{
+	if (jb->type == JBUF_ADAPTIVE) {
+		if (!adaptive_ready(jb)) {
+			DEBUG_INFO("buffering.. (n=%u target=%ums)\n",
+				   jb->n, jb->target);
+			STAT_INC(n_underflow);
+			return false;
+		}
+	}
+	else if (jb->n <= jb->min || !jb->n) {
+		DEBUG_INFO("not enough buffer frames - wait.. (n=%u min=%u)\n",
+			   jb->n, jb->min);
+		STAT_INC(n_underflow);
+		return false;
+	}
+
+	return true;
+}
+
+
+/* Take the first frame, the memory reference is passed on */
+static void frame_take(struct jbuf *jb, struct rtp_header *hdr, void **mem)
+{
+	struct frame *f = frame_slot(jb, jb->head);
+
+	/* When we get one frame F[i], check that the next frame F[i+1]
+	   is present and have a seq no. of seq[i] + 1 !
+	   if not, we should consider that packet lost */
+	seq_check(jb, f->hdr.seq);
+
+	*hdr = f->hdr;
+	*mem = f->mem;
+
+	f->mem = NULL;
+	frame_pop(jb);
 }
 
 
@@ -282,48 +560,60 @@ int jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem)
  */
 int jbuf_get(struct jbuf *jb, struct rtp_header *hdr, void **mem)
 {
-	struct frame *f;
-
 	if (!jb || !hdr || !mem)
 		return EINVAL;
 
 	STAT_INC(n_get);
 
-	if (jb->n <= jb->min || !jb->framel.head) {
-		DEBUG_INFO("not enough buffer frames - wait.. (n=%u min=%u)\n",
-			   jb->n, jb->min);
-		STAT_INC(n_underflow);
+	if (!get_ready(jb))
 		return ENOENT;
-	}
 
-	/* When we get one frame F[i], check that the next frame F[i+1]
-	   is present and have a seq no. of seq[i] + 1 !
-	   if not, we should consider that packet lost */
+	frame_take(jb, hdr, mem);
 
-	f = jb->framel.head->data;
+	return 0;
+}
 
-#if JBUF_STAT
-	/* Check timestamp of previously played frame */
-	if (jb->seq_get) {
-		const int16_t seq_diff = f->hdr.seq - jb->seq_get;
-		if (seq_less(f->hdr.seq, jb->seq_get)) {
-			DEBUG_WARNING("get: seq=%u too late\n", f->hdr.seq);
-		}
-		else if (seq_diff > 1) {
-			STAT_ADD(n_lost, 1);
-			DEBUG_INFO("get: n_lost: diff=%d,seq=%u,seq_get=%u\n",
-				   seq_diff, f->hdr.seq, jb->seq_get);
-		}
+
+/**
+ * Get all frames with the RTP timestamp of the first frame from the
+ * jitter buffer, such as the packets of one video picture
+ *
+ * @param jb   Jitter buffer
+ * @param hdrv Returned RTP Headers, in sequence order
+ * @param memv Returned memory objects - referenced on success
+ * @param n    Maximum number of frames, returned number of frames
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note Frames of the same timestamp that arrive later are returned by
+ *       the next call
+ */
+int jbuf_get_ts(struct jbuf *jb, struct rtp_header *hdrv, void **memv,
+		size_t *n)
+{
+	size_t i;
+	uint32_t ts;
+
+	if (!jb || !hdrv || !memv || !n || !*n)
+		return EINVAL;
+
+	if (!get_ready(jb)) {
+		STAT_INC(n_get);
+		return ENOENT;
 	}
 
-	/* Update sequence number for 'get' */
-	jb->seq_get = f->hdr.seq;
-#endif
+	ts = frame_slot(jb, jb->head)->hdr.ts;
 
-	*hdr = f->hdr;
-	*mem = mem_ref(f->mem);
+	for (i=0; i<*n && jb->n; i++) {
+
+		if (frame_slot(jb, jb->head)->hdr.ts != ts)
+			break;
 
-	frame_deref(jb, f);
+		STAT_INC(n_get);
+		frame_take(jb, &hdrv[i], &memv[i]);
+	}
+
+	*n = i;
 
 	return 0;
 }
@@ -336,7 +626,6 @@ int jbuf_get(struct jbuf *jb, struct rtp_header *hdr, void **mem)
  */
 void jbuf_flush(struct jbuf *jb)
 {
-	struct le *le;
 #if JBUF_STAT
 	uint32_t n_flush;
 #endif
@@ -344,20 +633,21 @@ void jbuf_flush(struct jbuf *jb)
 	if (!jb)
 		return;
 
-	if (jb->framel.head) {
+	if (jb->n) {
 		DEBUG_INFO("flush: %u frames\n", jb->n);
 	}
 
-	/* put all buffered frames back in free list */
-	for (le = jb->framel.head; le; le = jb->framel.head) {
-		DEBUG_INFO(" flush frame: seq=%u\n",
-			   ((struct frame *)(le->data))->hdr.seq);
+	/* release all buffered frames */
+	while (jb->n) {
+		DEBUG_INFO(" flush frame: seq=%u\n", jb->head);
 
-		frame_deref(jb, le->data);
+		frame_pop(jb);
 	}
 
 	jb->n       = 0;
 	jb->running = false;
+	jb->wait    = true;
+	jb->last.valid = false;
 
 #if JBUF_STAT
 	n_flush = STAT_INC(n_flush);
@@ -385,6 +675,10 @@ int jbuf_stats(const struct jbuf *jb, struct jbuf_stat *jstat)
 #if JBUF_STAT
 	*jstat = jb->stat;
 
+	jstat->jitter = jb->jitter / 1000;
+	jstat->target = jb->target;
+	jstat->delay  = jb->n * jb->ptime;
+
 	return 0;
 #else
 	return ENOSYS;
@@ -412,7 +706,14 @@ int jbuf_debug(struct re_printf *pf, const struct jbuf *jb)
 	err |= re_hprintf(pf, " running=%d", jb->running);
 	err |= re_hprintf(pf, " min=%u cur=%u max=%u [frames]\n",
 			  jb->min, jb->n, jb->max);
-	err |= re_hprintf(pf, " seq_put=%u\n", jb->seq_put);
+	err |= re_hprintf(pf, " seq_put=%u", jb->seq_put);
+	err |= re_hprintf(pf, " slots=%u head=%u hi=%u\n",
+			  jb->mask + 1, jb->head, jb->hi);
+	err |= re_hprintf(pf, " type=%s ptime=%ums jitter=%u.%03ums"
+			  " target=%ums delay=%ums\n",
+			  jb->type == JBUF_ADAPTIVE ? "adaptive" : "fixed",
+			  jb->ptime, jb->jitter / 1000, jb->jitter % 1000,
+			  jb->target, jb->n * jb->ptime);
 
 #if JBUF_STAT
 	err |= re_hprintf(pf, " Stat: put=%u", jb->stat.n_put);
@@ -423,6 +724,7 @@ int jbuf_debug(struct re_printf *pf, const struct jbuf *jb)
 	err |= re_hprintf(pf, " or=%u", jb->stat.n_overflow);
 	err |= re_hprintf(pf, " ur=%u", jb->stat.n_underflow);
 	err |= re_hprintf(pf, " flush=%u", jb->stat.n_flush);
+	err |= re_hprintf(pf, " skip=%u", jb->stat.n_skip);
 	err |= re_hprintf(pf, "       put/get_ratio=%u%%", jb->stat.n_get ?
 			  100*jb->stat.n_put/jb->stat.n_get : 0);
 	err |= re_hprintf(pf, " lost=%u (%u.%02u%%)\n",
@@ -283,6 +283,24 @@ static inline int chkval(struct pl *val, const char *p)
 }
 
 
+/* Skip over the characters of a string value, up to the last one */
+static inline void string_skip(const char **str, size_t *len)
+{
+	struct pl pl;
+	const char *q;
+	size_t n;
+
+	pl.p = *str;
+	pl.l = *len;
+
+	q = pl_find_any(&pl, "\"\\");
+	n = q ? (size_t)(q - pl.p) : pl.l - 1;
+
+	*str += n;
+	*len -= n;
+}
+
+
 static int _json_decode(const char **str, size_t *len,
 			unsigned depth, unsigned maxdepth,
 			json_object_h *oh, json_array_h *ah,
@@ -298,6 +316,9 @@ static int _json_decode(const char **str, size_t *len,
 	for (; *len>0; ++(*str), --(*len)) {
 
 		if (inquot) {
+			if (!esc)
+				string_skip(str, len);
+
 			if (esc)
 				esc = false;
 			else if (**str == '\"')
@@ -51,8 +51,10 @@ int libre_init(void)
 void libre_close(void)
 {
 	(void)fd_setsize(0);
+	tmrw_free(tmrw_get());
 	net_sock_close();
 #ifdef USE_OPENSSL
 	openssl_close();
 #endif
+	re_regex_flush();
 }
@@ -27,6 +27,9 @@
 #ifdef HAVE_EPOLL
 #include <sys/epoll.h>
 #endif
+#ifdef HAVE_IO_URING
+#include <poll.h>
+#endif
 #ifdef HAVE_KQUEUE
 #include <sys/types.h>
 #include <sys/event.h>
@@ -84,6 +87,9 @@ enum {
 };
 
 
+struct tmrw;
+
+
 /** Polling loop data */
 struct re {
 	/** File descriptor handler set */
@@ -91,14 +97,22 @@ struct re {
 		int flags;           /**< Polling flags (Read, Write, etc.) */
 		fd_h *fh;            /**< Event handler                     */
 		void *arg;           /**< Handler argument                  */
+#ifdef HAVE_IO_URING
+		uint32_t ugen;       /**< io_uring poll generation          */
+		bool uarmed;         /**< io_uring poll is armed            */
+#endif
 	} *fhs;
 	int maxfds;                  /**< Maximum number of polling fds     */
 	int nfds;                    /**< Number of active file descriptors */
 	enum poll_method method;     /**< The current polling method        */
 	bool update;                 /**< File descriptor set need updating */
 	bool polling;                /**< Is polling flag                   */
+	bool edge;                   /**< Edge-triggered mode enabled       */
 	int sig;                     /**< Last caught signal                */
 	struct list tmrl;            /**< List of timers                    */
+	struct tmrw *tmrw;           /**< Timer wheel, if used              */
+	uint64_t jfs;                /**< Cached jiffies in [us]            */
+	bool jfs_cached;             /**< Cached jiffies are valid          */
 
 #ifdef HAVE_POLL
 	struct pollfd *fds;          /**< Event set for poll()              */
@@ -114,6 +128,11 @@ struct re {
 	int kqfd;
 #endif
 
+#ifdef HAVE_IO_URING
+	struct uring *uring;         /**< io_uring rings                    */
+	struct uring_event *uevents; /**< Event set for io_uring            */
+#endif
+
 #ifdef HAVE_PTHREAD
 	pthread_mutex_t mutex;       /**< Mutex for thread synchronization  */
 	pthread_mutex_t *mutexp;     /**< Pointer to active mutex           */
@@ -127,8 +146,12 @@ static struct re global_re = {
 	METHOD_NULL,
 	false,
 	false,
+	false,
 	0,
 	LIST_INIT,
+	NULL,
+	0,
+	false,
 #ifdef HAVE_POLL
 	NULL,
 #endif
@@ -140,6 +163,10 @@ static struct re global_re = {
 	NULL,
 	-1,
 #endif
+#ifdef HAVE_IO_URING
+	NULL,
+	NULL,
+#endif
 #ifdef HAVE_PTHREAD
 #if MAIN_DEBUG && defined (PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP)
 	PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP,
@@ -157,18 +184,23 @@ static void poll_close(struct re *re);
 
 static pthread_once_t pt_once = PTHREAD_ONCE_INIT;
 static pthread_key_t  pt_key;
+static pthread_key_t  pt_poll_key;  /**< Loop polled by this thread */
 
 
 static void thread_destructor(void *arg)
 {
-	poll_close(arg);
-	free(arg);
+	struct re *re = arg;
+
+	poll_close(re);
+	tmrw_free(&re->tmrw);
+	free(re);
 }
 
 
 static void re_once(void)
 {
 	pthread_key_create(&pt_key, thread_destructor);
+	pthread_key_create(&pt_poll_key, NULL);
 }
 
 
@@ -222,6 +254,18 @@ static struct re *re_get(void)
 #endif
 
 
+/**
+ * Update the cached jiffies, once per iteration of the polling loop
+ *
+ * @param re Poll state
+ */
+static inline void jfs_update(struct re *re)
+{
+	re->jfs = tmr_clock_us();
+	re->jfs_cached = true;
+}
+
+
 #if MAIN_DEBUG
 /**
  * Call the application event handler
@@ -232,14 +276,14 @@ static struct re *re_get(void)
  */
 static void fd_handler(struct re *re, int fd, int flags)
 {
-	const uint64_t tick = tmr_jiffies();
+	const uint64_t tick = tmr_clock_us();
 	uint32_t diff;
 
 	DEBUG_INFO("event on fd=%d (flags=0x%02x)...\n", fd, flags);
 
 	re->fhs[fd].fh(flags, re->fhs[fd].arg);
 
-	diff = (uint32_t)(tmr_jiffies() - tick);
+	diff = (uint32_t)((tmr_clock_us() - tick) / 1000);
 
 	if (diff > MAX_BLOCKING) {
 		DEBUG_WARNING("long async blocking: %u>%u ms (h=%p arg=%p)\n",
@@ -274,6 +318,13 @@ static int set_poll_fds(struct re *re, int fd, int flags)
 #endif
 
 
+/** Check if the file descriptor flags use edge-triggered polling */
+static inline bool poll_edge(const struct re *re, int flags)
+{
+	return re->edge && (flags & FD_EDGE) && (flags & ~FD_EDGE);
+}
+
+
 #ifdef HAVE_EPOLL
 static int set_epoll_fds(struct re *re, int fd, int flags)
 {
@@ -297,6 +348,10 @@ static int set_epoll_fds(struct re *re, int fd, int flags)
 		if (flags & FD_EXCEPT)
 			event.events |= EPOLLERR;
 
+		/* Write interest is tracked in user-space */
+		if (poll_edge(re, flags))
+			event.events |= EPOLLOUT | EPOLLET;
+
 		/* Try to add it first */
 		if (-1 == epoll_ctl(re->epfd, EPOLL_CTL_ADD, fd, &event)) {
 
@@ -373,6 +428,91 @@ static int set_kqueue_fds(struct re *re, int fd, int flags)
 #endif
 
 
+#ifdef HAVE_IO_URING
+static inline uint64_t uring_data(const struct re *re, int fd)
+{
+	return (uint64_t)re->fhs[fd].ugen << 32 | (uint32_t)fd;
+}
+
+
+/*
+ * Level-triggered file descriptors use a oneshot poll, which is re-armed
+ * after each event. Edge-triggered ones use a multishot poll, with write
+ * interest tracked in user-space.
+ */
+static int uring_arm(struct re *re, int fd)
+{
+	const int flags = re->fhs[fd].flags;
+	const bool edge = poll_edge(re, flags);
+	uint32_t events = 0;
+	int err;
+
+	if (flags & FD_READ)
+		events |= POLLIN;
+	if ((flags & FD_WRITE) || edge)
+		events |= POLLOUT;
+	if (flags & FD_EXCEPT)
+		events |= POLLERR;
+
+	err = uring_poll_add(re->uring, fd, events, uring_data(re, fd), edge);
+	if (err) {
+		DEBUG_WARNING("uring: poll add fd=%d (%m)\n", fd, err);
+		return err;
+	}
+
+	re->fhs[fd].uarmed = true;
+
+	return 0;
+}
+
+
+static int set_uring_fds(struct re *re, int fd, int flags)
+{
+	int err = 0;
+
+	if (!re->uring)
+		return EBADFD;
+
+	if (re->fhs[fd].uarmed) {
+		err = uring_poll_remove(re->uring, uring_data(re, fd));
+		re->fhs[fd].uarmed = false;
+	}
+
+	/* Events from the previous poll are stale */
+	++re->fhs[fd].ugen;
+
+	if (err)
+		return err;
+
+	if (flags)
+		return uring_arm(re, fd);
+
+	/* Submit now, so the poll no longer holds on to the socket */
+	return uring_submit(re->uring);
+}
+
+
+static void uring_close(struct re *re)
+{
+	int i;
+
+	re->uring   = mem_deref(re->uring);
+	re->uevents = mem_deref(re->uevents);
+
+	if (!re->fhs)
+		return;
+
+	for (i=0; i<re->nfds; i++) {
+
+		if (re->fhs[i].uarmed) {
+			re->fhs[i].uarmed = false;
+			++re->fhs[i].ugen;
+		}
+	}
+}
+#endif
+
+
 /**
  * Rebuild the file descriptor mapping table. This must be done whenever
  * the polling method is changed.
@@ -407,6 +547,12 @@ static int rebuild_fds(struct re *re)
 			break;
 #endif
 
+#ifdef HAVE_IO_URING
+		case METHOD_IO_URING:
+			err = set_uring_fds(re, i, re->fhs[i].flags);
+			break;
+#endif
+
 		default:
 			break;
 		}
@@ -484,6 +630,24 @@ static int poll_init(struct re *re)
 		break;
 #endif
 
+#ifdef HAVE_IO_URING
+	case METHOD_IO_URING:
+		if (!re->uevents) {
+			size_t sz = re->maxfds * sizeof(*re->uevents);
+			re->uevents = mem_zalloc(sz, NULL);
+			if (!re->uevents)
+				return ENOMEM;
+		}
+
+		if (!re->uring) {
+			int err = uring_alloc(&re->uring, re->maxfds);
+			if (err)
+				return err;
+		}
+
+		break;
+#endif
+
 	default:
 		break;
 	}
@@ -521,6 +685,11 @@ static void poll_close(struct re *re)
 
 	re->evlist = mem_deref(re->evlist);
 #endif
+
+#ifdef HAVE_IO_URING
+	re->uring   = mem_deref(re->uring);
+	re->uevents = mem_deref(re->uevents);
+#endif
 }
 
 
@@ -564,6 +733,7 @@ static int poll_setup(struct re *re)
 int fd_listen(int fd, int flags, fd_h *fh, void *arg)
 {
 	struct re *re = re_get();
+	int oflags = 0;
 	int err = 0;
 
 	DEBUG_INFO("fd_listen: fd=%d flags=0x%02x\n", fd, flags);
@@ -590,6 +760,7 @@ int fd_listen(int fd, int flags, fd_h *fh, void *arg)
 
 	/* Update fh set */
 	if (re->fhs) {
+		oflags = re->fhs[fd].flags;
 		re->fhs[fd].flags = flags;
 		re->fhs[fd].fh    = fh;
 		re->fhs[fd].arg   = arg;
@@ -609,6 +780,12 @@ int fd_listen(int fd, int flags, fd_h *fh, void *arg)
 	case METHOD_EPOLL:
 		if (re->epfd < 0)
 			return EBADFD;
+
+		/* Edge-triggered: only FD_WRITE changed, no need to update */
+		if (poll_edge(re, flags) && poll_edge(re, oflags)
+		    && (flags | FD_WRITE) == (oflags | FD_WRITE))
+			break;
+
 		err = set_epoll_fds(re, fd, flags);
 		break;
 #endif
@@ -619,6 +796,18 @@ int fd_listen(int fd, int flags, fd_h *fh, void *arg)
 		break;
 #endif
 
+#ifdef HAVE_IO_URING
+	case METHOD_IO_URING:
+		/* Edge-triggered: only FD_WRITE changed, no need to update */
+		if (poll_edge(re, flags) && poll_edge(re, oflags)
+		    && (flags | FD_WRITE) == (oflags | FD_WRITE)
+		    && re->fhs[fd].uarmed)
+			break;
+
+		err = set_uring_fds(re, fd, flags);
+		break;
+#endif
+
 	default:
 		break;
 	}
@@ -655,14 +844,24 @@ void fd_close(int fd)
  */
 static int fd_poll(struct re *re)
 {
-	const uint64_t to = tmr_next_timeout(&re->tmrl);
-	int i, n;
+	uint64_t to;
+	int i, n, nfds;
 #ifdef HAVE_SELECT
 	fd_set rfds, wfds, efds;
 #endif
 
+	jfs_update(re);
+	to = tmr_next_timeout(&re->tmrl);
+
 	DEBUG_INFO("next timer: %llu ms\n", to);
 
+	/* The cached jiffies are not valid while waiting for I/O */
+	re->jfs_cached = false;
+
+	/* Edge-triggered events are lost if the dispatch loop is aborted,
+	   so only abort it if the polling method changes while dispatching */
+	re->update = false;
+
 	/* Wait for I/O */
 	switch (re->method) {
 
@@ -730,6 +929,15 @@ static int fd_poll(struct re *re)
 		break;
 #endif
 
+#ifdef HAVE_IO_URING
+	case METHOD_IO_URING:
+		re_unlock(re);
+		n = uring_wait(re->uring, re->uevents, re->maxfds,
+			       to ? (int)to : -1);
+		re_lock(re);
+		break;
+#endif
+
 	default:
 		(void)to;
 		DEBUG_WARNING("no polling method set\n");
@@ -739,8 +947,24 @@ static int fd_poll(struct re *re)
 	if (n < 0)
 		return errno;
 
+	jfs_update(re);
+
+	/* epoll, kqueue and io_uring return only the ready events */
+	switch (re->method) {
+
+	case METHOD_EPOLL:
+	case METHOD_KQUEUE:
+	case METHOD_IO_URING:
+		nfds = n;
+		break;
+
+	default:
+		nfds = re->nfds;
+		break;
+	}
+
 	/* Check for events */
-	for (i=0; (n > 0) && (i < re->nfds); i++) {
+	for (i=0; (n > 0) && (i < nfds); i++) {
 		int fd, flags = 0;
 
 		switch (re->method) {
@@ -791,6 +1015,13 @@ static int fd_poll(struct re *re)
 				DEBUG_WARNING("epoll: no flags fd=%d\n", fd);
 			}
 
+			/* Drop events that are not wanted */
+			if (poll_edge(re, re->fhs[fd].flags)) {
+				flags &= re->fhs[fd].flags | FD_EXCEPT;
+				if (flags)
+					flags |= FD_EDGE;
+			}
+
 			break;
 #endif
 
@@ -831,6 +1062,49 @@ static int fd_poll(struct re *re)
 			break;
 #endif
 
+#ifdef HAVE_IO_URING
+		case METHOD_IO_URING: {
+
+			const struct uring_event *ev = &re->uevents[i];
+
+			fd = (int)(uint32_t)ev->data;
+
+			/* Skip removals, and events from a previous poll */
+			if (ev->data == URING_NODATA || fd >= re->nfds
+			    || (uint32_t)(ev->data >> 32) != re->fhs[fd].ugen)
+				break;
+
+			if (!ev->more)
+				re->fhs[fd].uarmed = false;
+
+			if (ev->res < 0) {
+				DEBUG_WARNING("uring: fd=%d poll (%m)\n",
+					      fd, -ev->res);
+				flags |= FD_EXCEPT;
+			}
+			else {
+				if (ev->res & POLLIN)
+					flags |= FD_READ;
+				if (ev->res & POLLOUT)
+					flags |= FD_WRITE;
+				if (ev->res & (POLLERR|POLLHUP))
+					flags |= FD_EXCEPT;
+			}
+
+			/* Drop events that are not wanted */
+			if (poll_edge(re, re->fhs[fd].flags)) {
+				flags &= re->fhs[fd].flags | FD_EXCEPT;
+				if (flags)
+					flags |= FD_EDGE;
+			}
+
+			/* Submitted with the next wait, after the handler */
+			if (!re->fhs[fd].uarmed && re->fhs[fd].flags)
+				(void)uring_arm(re, fd);
+		}
+			break;
+#endif
+
 		default:
 			return EINVAL;
 		}
@@ -961,6 +1235,10 @@ int re_main(re_signal_h *signalh)
 
 	re->polling = true;
 
+#ifdef HAVE_PTHREAD
+	pthread_setspecific(pt_poll_key, re);
+#endif
+
 	re_lock(re);
 	for (;;) {
 
@@ -996,6 +1274,11 @@ int re_main(re_signal_h *signalh)
 
  out:
 	re->polling = false;
+	re->jfs_cached = false;
+
+#ifdef HAVE_PTHREAD
+	pthread_setspecific(pt_poll_key, NULL);
+#endif
 
 	return err;
 }
@@ -1032,6 +1315,8 @@ int re_debug(struct re_printf *pf, void *unused)
 	err |= re_hprintf(pf, "  nfds:    %d\n", re->nfds);
 	err |= re_hprintf(pf, "  method:  %d (%s)\n", re->method,
 			  poll_method_name(re->method));
+	err |= re_hprintf(pf, "  edge:    %s\n",
+			  re->edge ? "yes" : "no");
 
 	return err;
 }
@@ -1077,6 +1362,12 @@ int poll_method_set(enum poll_method method)
 #ifdef HAVE_KQUEUE
 	case METHOD_KQUEUE:
 		break;
+#endif
+#ifdef HAVE_IO_URING
+	case METHOD_IO_URING:
+		if (!uring_check())
+			return EINVAL;
+		break;
 #endif
 	default:
 		DEBUG_WARNING("poll method not supported: '%s'\n",
@@ -1084,6 +1375,12 @@ int poll_method_set(enum poll_method method)
 		return EINVAL;
 	}
 
+#ifdef HAVE_IO_URING
+	/* Stop polling with the previous io_uring */
+	if (METHOD_IO_URING == re->method && METHOD_IO_URING != method)
+		uring_close(re);
+#endif
+
 	re->method = method;
 	re->update = true;
 
@@ -1154,6 +1451,7 @@ void re_thread_close(void)
 	re = pthread_getspecific(pt_key);
 	if (re) {
 		poll_close(re);
+		tmrw_free(&re->tmrw);
 		free(re);
 		pthread_setspecific(pt_key, NULL);
 	}
@@ -1200,6 +1498,34 @@ void re_set_mutex(void *mutexp)
 }
 
 
+/**
+ * Enable or disable edge-triggered mode for this thread. In edge-triggered
+ * mode, file descriptors listening with FD_EDGE are polled edge-triggered
+ * if supported by the polling method (epoll). Their event handler is then
+ * called with FD_EDGE set, and must read until EAGAIN. Write interest is
+ * registered once and tracked in user-space, so FD_WRITE must only be
+ * enabled after a write returned EAGAIN, or while connecting.
+ *
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_set_edge_triggered(bool enable)
+{
+	struct re *re = re_get();
+
+	if (re->edge == enable)
+		return 0;
+
+	re->edge = enable;
+
+	if (!re->fhs)
+		return 0;
+
+	return rebuild_fds(re);
+}
+
+
 /**
  * Get the timer-list for this thread
  *
@@ -1207,8 +1533,46 @@ void re_set_mutex(void *mutexp)
  *
  * @note only used by tmr module
  */
-struct list *tmrl_get(void);
 struct list *tmrl_get(void)
 {
 	return &re_get()->tmrl;
 }
+
+
+/**
+ * Get the timer wheel for this thread
+ *
+ * @return Pointer to timer wheel
+ *
+ * @note only used by tmr module
+ */
+struct tmrw **tmrw_get(void)
+{
+	return &re_get()->tmrw;
+}
+
+
+/**
+ * Get the cached jiffies for this thread. Only the thread that polls the
+ * loop uses them, other threads share the main loop but not its cache.
+ *
+ * @return Pointer to cached jiffies in [us], NULL if not cached
+ *
+ * @note only used by tmr module
+ */
+const uint64_t *tmr_jfs_get(void)
+{
+	const struct re *re;
+
+#ifdef HAVE_PTHREAD
+	pthread_once(&pt_once, re_once);
+
+	re = pthread_getspecific(pt_poll_key);
+	if (!re)
+		return NULL;
+#else
+	re = re_get();
+#endif
+
+	return re->jfs_cached ? &re->jfs : NULL;
+}
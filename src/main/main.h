@@ -10,10 +10,41 @@ bool epoll_check(void);
 #endif
 
 
+#ifdef HAVE_IO_URING
+/** User data of requests without events */
+#define URING_NODATA ((uint64_t)-1)
+
+/** Defines an io_uring completion event */
+struct uring_event {
+	uint64_t data;  /**< User data of the request      */
+	int res;        /**< Result, or negative errorcode */
+	bool more;      /**< More events will follow       */
+};
+
+struct uring;
+
+bool uring_check(void);
+int  uring_alloc(struct uring **urp, unsigned entries);
+int  uring_poll_add(struct uring *ur, int fd, uint32_t events,
+		    uint64_t data, bool multishot);
+int  uring_poll_remove(struct uring *ur, uint64_t data);
+int  uring_submit(struct uring *ur);
+int  uring_wait(struct uring *ur, struct uring_event *evv, unsigned n,
+		int timeout);
+#endif
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct tmrw;
+
+struct list  *tmrl_get(void);
+struct tmrw **tmrw_get(void);
+void tmrw_free(struct tmrw **wp);
+const uint64_t *tmr_jfs_get(void);
+
 #ifdef USE_OPENSSL
 int  openssl_init(void);
 void openssl_close(void);
@@ -10,10 +10,11 @@
 #include "main.h"
 
 
-static const char str_poll[]   = "poll";     /**< POSIX.1-2001 poll       */
-static const char str_select[] = "select";   /**< POSIX.1-2001 select     */
-static const char str_epoll[]  = "epoll";    /**< Linux epoll             */
-static const char str_kqueue[] = "kqueue";
+static const char str_poll[]     = "poll";     /**< POSIX.1-2001 poll     */
+static const char str_select[]   = "select";   /**< POSIX.1-2001 select   */
+static const char str_epoll[]    = "epoll";    /**< Linux epoll           */
+static const char str_kqueue[]   = "kqueue";
+static const char str_io_uring[] = "io_uring"; /**< Linux io_uring        */
 
 
 /**
@@ -69,6 +70,7 @@ const char *poll_method_name(enum poll_method method)
 	case METHOD_SELECT:    return str_select;
 	case METHOD_EPOLL:     return str_epoll;
 	case METHOD_KQUEUE:    return str_kqueue;
+	case METHOD_IO_URING:  return str_io_uring;
 	default:               return "???";
 	}
 }
@@ -95,6 +97,8 @@ int poll_method_type(enum poll_method *method, const struct pl *name)
 		*method = METHOD_EPOLL;
 	else if (0 == pl_strcasecmp(name, str_kqueue))
 		*method = METHOD_KQUEUE;
+	else if (0 == pl_strcasecmp(name, str_io_uring))
+		*method = METHOD_IO_URING;
 	else
 		return ENOENT;
 
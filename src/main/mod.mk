@@ -8,10 +8,21 @@ SRCS	+= main/init.c
 SRCS	+= main/main.c
 SRCS	+= main/method.c
 
+ifneq ($(HAVE_PTHREAD),)
+SRCS	+= main/pool.c
+ifeq ($(OS),linux)
+CFLAGS  += -DHAVE_PTHREAD_AFFINITY
+endif
+endif
+
 ifneq ($(HAVE_EPOLL),)
 SRCS	+= main/epoll.c
 endif
 
+ifneq ($(HAVE_IO_URING),)
+SRCS	+= main/uring.c
+endif
+
 ifneq ($(USE_OPENSSL),)
 SRCS    += main/openssl.c
 endif
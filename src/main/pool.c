@@ -0,0 +1,442 @@
+/**
+ * @file pool.c  Pool of event loops
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifdef HAVE_PTHREAD_AFFINITY
+#define _GNU_SOURCE 1
+#include <sched.h>
+#endif
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <pthread.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_list.h>
+#include <re_mqueue.h>
+#include <re_main.h>
+#include <re_sys.h>
+
+
+#define DEBUG_MODULE "pool"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * The pool runs one event loop per thread, each with its own file
+ * descriptors and timers. Shared listening sockets are opened in every
+ * loop with udp_listen_reuseport(), so the kernel shards the flows
+ * between the loops.
+ * Other threads talk to a loop via its message queue, which is only
+ * pushed to with the pool mutex held and while the loop is not done.
+ */
+
+
+enum {
+	POOL_CALL = 0,
+	POOL_STOP
+};
+
+enum {
+	STOP_TRIES = 100,   /**< Attempts to queue the stop message */
+	STOP_WAIT  = 10,    /**< Wait between the attempts [ms]     */
+};
+
+/** Defines an event loop in the pool */
+struct pool_loop {
+	pthread_t tid;        /**< Thread ID                          */
+	struct mqueue *mq;    /**< Message queue for cross-loop calls */
+	struct list calls;    /**< Calls queued to the loop           */
+	unsigned idx;         /**< Index of the loop                  */
+	bool started;         /**< Thread was started                 */
+	bool ready;           /**< Loop is ready, or failed           */
+	bool done;            /**< re_main() has returned             */
+	int err;              /**< Startup error                      */
+};
+
+/** Defines a cross-loop call */
+struct pool_call {
+	struct le le;
+	re_pool_h *h;
+	void *arg;
+};
+
+static struct {
+	struct pool_loop *loopv;
+	unsigned n;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} pool = {
+	NULL,
+	0,
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  pool_key;
+
+
+static void pool_init(void)
+{
+	pthread_key_create(&pool_key, NULL);
+}
+
+
+static unsigned cpu_count(void)
+{
+#if defined (HAVE_UNISTD_H) && defined (_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n > 0)
+		return (unsigned)n;
+#endif
+
+	return 1;
+}
+
+
+#ifdef HAVE_PTHREAD_AFFINITY
+/* Pin the loop to one of the CPUs the process is allowed to run on */
+static void loop_pin(const struct pool_loop *loop)
+{
+	cpu_set_t set;
+	int cpu, i, n, err;
+
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set))
+		return;
+
+	n = CPU_COUNT(&set);
+	if (!n)
+		return;
+
+	i = loop->idx % n;
+
+	for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+
+		if (CPU_ISSET(cpu, &set) && i-- == 0)
+			break;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err) {
+		DEBUG_INFO("loop %u: could not pin to cpu %d (%m)\n",
+			   loop->idx, cpu, err);
+	}
+}
+#endif
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct pool_call *call = data;
+	(void)arg;
+
+	switch (id) {
+
+	case POOL_CALL:
+		pthread_mutex_lock(&pool.mutex);
+		list_unlink(&call->le);
+		pthread_mutex_unlock(&pool.mutex);
+
+		call->h(call->arg);
+		mem_deref(call);
+		break;
+
+	case POOL_STOP:
+		re_cancel();
+		break;
+	}
+}
+
+
+static void *loop_thread(void *arg)
+{
+	struct pool_loop *loop = arg;
+	int err;
+
+	err = re_thread_init();
+	if (err)
+		goto out;
+
+	pthread_setspecific(pool_key, loop);
+
+#ifdef HAVE_PTHREAD_AFFINITY
+	loop_pin(loop);
+#endif
+
+	err = mqueue_alloc(&loop->mq, mqueue_handler, loop);
+
+ out:
+	pthread_mutex_lock(&pool.mutex);
+	loop->err   = err;
+	loop->ready = true;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+
+	if (!err) {
+		err = re_main(NULL);
+		if (err) {
+			DEBUG_WARNING("loop %u: re_main (%m)\n",
+				      loop->idx, err);
+		}
+	}
+
+	/* No other thread pushes to the queue once the loop is done */
+	pthread_mutex_lock(&pool.mutex);
+	loop->done = true;
+	pthread_mutex_unlock(&pool.mutex);
+
+	loop->mq = mem_deref(loop->mq);
+
+	/* Calls that were still queued */
+	pthread_mutex_lock(&pool.mutex);
+	list_flush(&loop->calls);
+	pthread_mutex_unlock(&pool.mutex);
+
+	re_thread_close();
+
+	return NULL;
+}
+
+
+/* Cancel the loop, retrying while its queue is full */
+static int loop_cancel(struct pool_loop *loop)
+{
+	int i, err = 0;
+
+	for (i=0; i<STOP_TRIES; i++) {
+
+		pthread_mutex_lock(&pool.mutex);
+		if (loop->done || !loop->mq)
+			err = 0;
+		else
+			err = mqueue_push(loop->mq, POOL_STOP, NULL);
+		pthread_mutex_unlock(&pool.mutex);
+
+		if (!err)
+			break;
+
+		sys_msleep(STOP_WAIT);
+	}
+
+	return err;
+}
+
+
+/**
+ * Start a pool of event loops, each running in its own thread
+ *
+ * @param n Number of loops, 0 for one loop per CPU
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note Sockets and timers must be created and destroyed from within
+ *       the loop that uses them, see re_pool_call()
+ */
+int re_pool_start(unsigned n)
+{
+	unsigned i;
+	int err = 0;
+
+	pthread_once(&pool_once, pool_init);
+
+	if (pool.loopv)
+		return EALREADY;
+
+	if (!n)
+		n = cpu_count();
+
+	pool.loopv = mem_zalloc(n * sizeof(*pool.loopv), NULL);
+	if (!pool.loopv)
+		return ENOMEM;
+
+	for (i=0; i<n; i++) {
+		struct pool_loop *loop = &pool.loopv[i];
+
+		loop->idx = i;
+
+		err = pthread_create(&loop->tid, NULL, loop_thread, loop);
+		if (err) {
+			DEBUG_WARNING("start: pthread_create (%m)\n", err);
+			break;
+		}
+
+		loop->started = true;
+	}
+
+	/* Wait for the loops to be ready */
+	pthread_mutex_lock(&pool.mutex);
+
+	for (i=0; i<n && pool.loopv[i].started; i++) {
+		struct pool_loop *loop = &pool.loopv[i];
+
+		while (!loop->ready)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+
+		if (loop->err && !err)
+			err = loop->err;
+	}
+
+	pool.n = n;
+
+	pthread_mutex_unlock(&pool.mutex);
+
+	if (err)
+		re_pool_stop();
+
+	return err;
+}
+
+
+/**
+ * Stop all event loops in the pool, and wait for the threads to exit
+ *
+ * @note Must not be called from a loop in the pool
+ */
+void re_pool_stop(void)
+{
+	struct pool_loop *loopv;
+	bool detached = false;
+	unsigned i, n;
+
+	if (!pool.loopv)
+		return;
+
+	/* No new calls are queued to the loops */
+	pthread_mutex_lock(&pool.mutex);
+	loopv  = pool.loopv;
+	n      = pool.n;
+	pool.n = 0;
+	pthread_mutex_unlock(&pool.mutex);
+
+	for (i=0; i<n; i++) {
+		struct pool_loop *loop = &loopv[i];
+		bool done;
+		int err;
+
+		if (!loop->started)
+			continue;
+
+		err = loop_cancel(loop);
+
+		pthread_mutex_lock(&pool.mutex);
+		done = loop->done;
+		pthread_mutex_unlock(&pool.mutex);
+
+		/* A loop that was not cancelled would block the join */
+		if (err && !done) {
+			DEBUG_WARNING("stop: loop %u not cancelled (%m)\n",
+				      loop->idx, err);
+			(void)pthread_detach(loop->tid);
+			loop->started = false;
+			detached = true;
+		}
+	}
+
+	for (i=0; i<n; i++) {
+		struct pool_loop *loop = &loopv[i];
+
+		if (loop->started)
+			(void)pthread_join(loop->tid, NULL);
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.loopv = NULL;
+	pthread_mutex_unlock(&pool.mutex);
+
+	/* Detached threads still use their loop */
+	if (!detached)
+		mem_deref(loopv);
+}
+
+
+/**
+ * Get the number of event loops in the pool
+ *
+ * @return Number of loops, 0 if the pool is not running
+ */
+unsigned re_pool_count(void)
+{
+	unsigned n;
+
+	pthread_mutex_lock(&pool.mutex);
+	n = pool.n;
+	pthread_mutex_unlock(&pool.mutex);
+
+	return n;
+}
+
+
+/**
+ * Get the index of the event loop in the pool for this thread
+ *
+ * @return Index of the loop, -1 if this thread is not in the pool
+ */
+int re_pool_index(void)
+{
+	const struct pool_loop *loop;
+
+	pthread_once(&pool_once, pool_init);
+
+	loop = pthread_getspecific(pool_key);
+
+	return loop ? (int)loop->idx : -1;
+}
+
+
+/**
+ * Call a handler from an event loop in the pool. The handler is called
+ * asynchronously in the thread of the loop, and may be used from any
+ * thread, including other loops.
+ *
+ * @param idx Index of the loop
+ * @param h   Handler to call
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_pool_call(unsigned idx, re_pool_h *h, void *arg)
+{
+	struct pool_loop *loop;
+	struct pool_call *call;
+	int err;
+
+	if (!h)
+		return EINVAL;
+
+	call = mem_zalloc(sizeof(*call), NULL);
+	if (!call)
+		return ENOMEM;
+
+	call->h   = h;
+	call->arg = arg;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	loop = idx < pool.n ? &pool.loopv[idx] : NULL;
+
+	/* The pool is stopped, or the loop has returned from re_main() */
+	if (!loop || loop->done || !loop->mq) {
+		err = ENOENT;
+	}
+	else {
+		err = mqueue_push(loop->mq, POOL_CALL, call);
+		if (!err)
+			list_append(&loop->calls, &call->le, call);
+	}
+
+	pthread_mutex_unlock(&pool.mutex);
+
+	if (err)
+		mem_deref(call);
+
+	return err;
+}
@@ -0,0 +1,401 @@
+/**
+ * @file uring.c  io_uring specific routines
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#define _DEFAULT_SOURCE 1
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include "main.h"
+
+
+#define DEBUG_MODULE "uring"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/** Defines the io_uring submission and completion rings */
+struct uring {
+	int fd;                        /**< io_uring file descriptor     */
+	void *sq_ring;                 /**< Mapped submission ring       */
+	size_t sq_ringsz;              /**< Size of submission ring      */
+	void *cq_ring;                 /**< Mapped completion ring       */
+	size_t cq_ringsz;              /**< Size of completion ring      */
+	struct io_uring_sqe *sqes;     /**< Submission queue entries     */
+	size_t sqesz;                  /**< Size of submission entries   */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete,
+		     unsigned flags, const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, arg, argsz);
+}
+
+
+static void destructor(void *arg)
+{
+	struct uring *ur = arg;
+
+	if (ur->sqes)
+		(void)munmap(ur->sqes, ur->sqesz);
+	if (ur->cq_ring && ur->cq_ring != ur->sq_ring)
+		(void)munmap(ur->cq_ring, ur->cq_ringsz);
+	if (ur->sq_ring)
+		(void)munmap(ur->sq_ring, ur->sq_ringsz);
+	if (ur->fd >= 0)
+		(void)close(ur->fd);
+}
+
+
+static void *ring_map(int fd, size_t sz, off_t off)
+{
+	void *p = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, off);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+
+static inline unsigned sq_pending(const struct uring *ur)
+{
+	return *ur->sq_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+}
+
+
+static struct io_uring_sqe *sqe_get(struct uring *ur)
+{
+	struct io_uring_sqe *sqe;
+
+	/* Submission ring is full, flush it */
+	if (sq_pending(ur) >= ur->sq_entries) {
+
+		(void)uring_submit(ur);
+
+		if (sq_pending(ur) >= ur->sq_entries)
+			return NULL;
+	}
+
+	sqe = &ur->sqes[*ur->sq_tail & ur->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+
+static inline void sqe_push(struct uring *ur)
+{
+	__atomic_store_n(ur->sq_tail, *ur->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Check for working io_uring kernel support
+ *
+ * @return true if support, false if not
+ */
+bool uring_check(void)
+{
+	const unsigned feat = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG |
+		IORING_FEAT_RSRC_TAGS;
+	struct io_uring_params p;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+
+	fd = sys_setup(2, &p);
+	if (fd < 0) {
+		DEBUG_INFO("io_uring_setup: %m\n", errno);
+		return false;
+	}
+
+	(void)close(fd);
+
+	/* Multishot poll needs Linux 5.13, the first to set RSRC_TAGS */
+	if ((p.features & feat) != feat) {
+		DEBUG_INFO("io_uring features not supported (0x%x)\n",
+			   p.features);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Allocate io_uring submission and completion rings
+ *
+ * @param urp     Pointer to allocated rings
+ * @param entries Number of submission entries
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uring_alloc(struct uring **urp, unsigned entries)
+{
+	struct io_uring_params p;
+	struct uring *ur;
+	unsigned *array;
+	unsigned i;
+	int err = 0;
+
+	if (!urp || !entries)
+		return EINVAL;
+
+	ur = mem_zalloc(sizeof(*ur), destructor);
+	if (!ur)
+		return ENOMEM;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CLAMP;
+
+	ur->fd = sys_setup(entries, &p);
+	if (ur->fd < 0) {
+		err = errno;
+		DEBUG_WARNING("io_uring_setup: %m\n", err);
+		goto out;
+	}
+
+	ur->sq_ringsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cq_ringsz = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ur->sq_ringsz = ur->cq_ringsz = max(ur->sq_ringsz,
+						    ur->cq_ringsz);
+
+	ur->sq_ring = ring_map(ur->fd, ur->sq_ringsz, IORING_OFF_SQ_RING);
+	if (!ur->sq_ring) {
+		err = errno;
+		goto out;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	}
+	else {
+		ur->cq_ring = ring_map(ur->fd, ur->cq_ringsz,
+				       IORING_OFF_CQ_RING);
+		if (!ur->cq_ring) {
+			err = errno;
+			goto out;
+		}
+	}
+
+	ur->sqesz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes  = ring_map(ur->fd, ur->sqesz, IORING_OFF_SQES);
+	if (!ur->sqes) {
+		err = errno;
+		goto out;
+	}
+
+	ur->sq_head    = (unsigned *)((uint8_t *)ur->sq_ring + p.sq_off.head);
+	ur->sq_tail    = (unsigned *)((uint8_t *)ur->sq_ring + p.sq_off.tail);
+	ur->sq_mask    = *(unsigned *)((uint8_t *)ur->sq_ring +
+				       p.sq_off.ring_mask);
+	ur->sq_entries = p.sq_entries;
+
+	ur->cq_head = (unsigned *)((uint8_t *)ur->cq_ring + p.cq_off.head);
+	ur->cq_tail = (unsigned *)((uint8_t *)ur->cq_ring + p.cq_off.tail);
+	ur->cq_mask = *(unsigned *)((uint8_t *)ur->cq_ring +
+				    p.cq_off.ring_mask);
+	ur->cqes    = (struct io_uring_cqe *)((uint8_t *)ur->cq_ring +
+					      p.cq_off.cqes);
+
+	/* Submission entries are always used in ring order */
+	array = (unsigned *)((uint8_t *)ur->sq_ring + p.sq_off.array);
+	for (i=0; i<p.sq_entries; i++)
+		array[i] = i;
+
+	DEBUG_INFO("io_uring: fd=%d sq=%u cq=%u\n",
+		   ur->fd, p.sq_entries, p.cq_entries);
+
+ out:
+	if (err)
+		mem_deref(ur);
+	else
+		*urp = ur;
+
+	return err;
+}
+
+
+/**
+ * Poll a file descriptor
+ *
+ * @param ur        io_uring rings
+ * @param fd        File descriptor
+ * @param events    Poll events (POLLIN, POLLOUT, ..)
+ * @param data      User data returned with the events
+ * @param multishot True to keep polling after the first event
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note The request is submitted with the next uring_wait()
+ */
+int uring_poll_add(struct uring *ur, int fd, uint32_t events,
+		   uint64_t data, bool multishot)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!ur)
+		return EINVAL;
+
+	sqe = sqe_get(ur);
+	if (!sqe)
+		return EBUSY;
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = events << 16 | events >> 16;
+#endif
+
+	sqe->opcode        = IORING_OP_POLL_ADD;
+	sqe->fd            = fd;
+	sqe->poll32_events = events;
+	sqe->len           = multishot ? IORING_POLL_ADD_MULTI : 0;
+	sqe->user_data     = data;
+
+	sqe_push(ur);
+
+	return 0;
+}
+
+
+/**
+ * Remove a poll request
+ *
+ * @param ur   io_uring rings
+ * @param data User data of the poll request
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uring_poll_remove(struct uring *ur, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!ur)
+		return EINVAL;
+
+	sqe = sqe_get(ur);
+	if (!sqe)
+		return EBUSY;
+
+	sqe->opcode    = IORING_OP_POLL_REMOVE;
+	sqe->fd        = -1;
+	sqe->addr      = data;
+	sqe->user_data = URING_NODATA;
+
+	sqe_push(ur);
+
+	return 0;
+}
+
+
+/**
+ * Submit all pending requests without waiting
+ *
+ * @param ur io_uring rings
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uring_submit(struct uring *ur)
+{
+	unsigned n;
+
+	if (!ur)
+		return EINVAL;
+
+	while ((n = sq_pending(ur)) > 0) {
+
+		if (sys_enter(ur->fd, n, 0, 0, NULL, 0) >= 0)
+			continue;
+
+		if (EINTR == errno)
+			continue;
+
+		return errno;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Submit all pending requests, and wait for events
+ *
+ * @param ur      io_uring rings
+ * @param evv     Returned events
+ * @param n       Maximum number of events
+ * @param timeout Timeout in [ms], -1 to wait forever
+ *
+ * @return Number of events, or -1 and errno if error
+ */
+int uring_wait(struct uring *ur, struct uring_event *evv, unsigned n,
+	       int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned flags = IORING_ENTER_EXT_ARG;
+	unsigned head, tail, wait, i;
+
+	if (!ur || !evv) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+
+	if (timeout >= 0) {
+		ts.tv_sec  = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000LL;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+
+	/* Only wait if there are no events already */
+	head = *ur->cq_head;
+	wait = head == __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	if (wait)
+		flags |= IORING_ENTER_GETEVENTS;
+
+	if (sys_enter(ur->fd, sq_pending(ur), wait, flags,
+		      &arg, sizeof(arg)) < 0) {
+
+		/* Completion ring overflow, reap the events first */
+		if (ETIME != errno && EBUSY != errno)
+			return -1;
+	}
+
+	tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (i=0; i<n && head != tail; i++, head++) {
+		const struct io_uring_cqe *cqe = &ur->cqes[head & ur->cq_mask];
+
+		evv[i].data = cqe->user_data;
+		evv[i].res  = cqe->res;
+		evv[i].more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+	}
+
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+	return (int)i;
+}
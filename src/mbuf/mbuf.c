@@ -37,7 +37,7 @@ struct mbuf *mbuf_alloc(size_t size)
 {
 	struct mbuf *mb;
 
-	mb = mem_zalloc(sizeof(*mb), mbuf_destructor);
+	mb = mem_pool_alloc(sizeof(*mb), mbuf_destructor);
 	if (!mb)
 		return NULL;
 
@@ -62,7 +62,7 @@ struct mbuf *mbuf_alloc_ref(struct mbuf *mbr)
 	if (!mbr)
 		return NULL;
 
-	mb = mem_zalloc(sizeof(*mb), mbuf_destructor);
+	mb = mem_pool_alloc(sizeof(*mb), mbuf_destructor);
 	if (!mb)
 		return NULL;
 
@@ -75,6 +75,28 @@ struct mbuf *mbuf_alloc_ref(struct mbuf *mbr)
 }
 
 
+/**
+ * Mark a memory buffer and its buffer memory as shared between threads,
+ * so that it can be passed to another thread without copying
+ *
+ * @param mb Memory buffer
+ *
+ * @return Memory buffer (same as mb)
+ *
+ * @note The buffer must not be written after it was passed on
+ */
+struct mbuf *mbuf_share(struct mbuf *mb)
+{
+	if (!mb)
+		return NULL;
+
+	mem_share(mb);
+	mem_share(mb->buf);
+
+	return mb;
+}
+
+
 /**
  * Initialize a memory buffer
  *
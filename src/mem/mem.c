@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#define _DEFAULT_SOURCE 1
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,10 +26,25 @@
 #define MEM_DEBUG 1  /**< Enable memory debugging */
 #endif
 
+#ifdef HAVE_PTHREAD
+#define MEM_POOL 1   /**< Enable size-class pools */
+#endif
+
+#if defined (__GNUC__) || defined (__clang__)
+#define MEM_ATOMIC 1 /**< Atomic reference counting for shared objects */
+#endif
+
+/** Memory object flags */
+enum {
+	MEM_SHARED = 1<<0   /**< Shared between threads */
+};
+
 
 /** Defines a reference-counting memory object */
 struct mem {
 	uint32_t nrefs;     /**< Number of references  */
+	uint8_t cls;        /**< Pool size class, or 0 */
+	uint8_t flags;      /**< Memory object flags   */
 	mem_destroy_h *dh;  /**< Destroy handler       */
 #if MEM_DEBUG
 	struct le le;       /**< Linked list element   */
@@ -115,31 +131,319 @@ static inline void mem_unlock(void)
 #endif
 
 
-/**
- * Allocate a new reference-counted memory object
- *
- * @param size Size of memory object
- * @param dh   Optional destructor, called when destroyed
+#if MEM_POOL
+/*
+ * Size-class pools for small objects allocated with mem_pool_alloc().
  *
- * @return Pointer to allocated object
+ * Each thread has a cache with a list of free blocks per size class,
+ * carved from aligned chunks. A block freed by another thread is pushed
+ * lock-free on the remote list of the owner, which takes the whole list
+ * back when its own list is empty. Chunks are never returned to the
+ * system, and the cache of an exited thread is adopted by the next one.
  */
-void *mem_alloc(size_t size, mem_destroy_h *dh)
+enum {
+	MEM_CHUNK_SIZE = 65536,  /**< Size and alignment of a chunk      */
+	MEM_CHUNK_HDR  = 16,     /**< Space for the chunk header         */
+	MEM_POOL_MAXSZ = 512,    /**< Largest object size in the pools   */
+	MEM_NCLASS     = 10      /**< Number of size classes             */
+};
+
+static const size_t mem_classv[MEM_NCLASS] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
+
+/* Size class (1-based) of an object size, indexed by (size + 15) / 16 */
+static const uint8_t mem_class_tbl[MEM_POOL_MAXSZ / 16 + 1] = {
+	1, 1, 2, 3, 4, 5, 5, 6, 6, 7, 7, 7, 7, 8, 8, 8, 8,
+	9, 9, 9, 9, 9, 9, 9, 9, 10, 10, 10, 10, 10, 10, 10, 10
+};
+
+struct mem_free {
+	struct mem_free *next;
+};
+
+struct mem_class {
+	struct mem_free *freel;   /**< Free blocks, used by owner only */
+	struct mem_free *remote;  /**< Blocks freed by other threads   */
+	size_t used;              /**< Number of blocks in use         */
+	size_t chunks;            /**< Number of chunks allocated      */
+};
+
+struct mem_cache {
+	struct mem_class classv[MEM_NCLASS];
+	struct mem_cache *next;   /**< Next cache in list of all caches */
+	bool active;              /**< Cache is owned by a thread       */
+};
+
+struct mem_chunk {
+	struct mem_cache *cache;  /**< Cache owning the blocks          */
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  pool_key;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mem_cache *cachel;  /**< List of all caches */
+
+
+static inline size_t block_size(unsigned i)
 {
-	struct mem *m;
+	return (sizeof(struct mem) + mem_classv[i] + 15) & ~(size_t)15;
+}
 
-#if MEM_DEBUG
-	mem_lock();
-	if (-1 != threshold && (memstat.blocks_cur >= (size_t)threshold)) {
-		mem_unlock();
+
+static void cache_release(void *arg)
+{
+	struct mem_cache *c = arg;
+
+	pthread_mutex_lock(&pool_mutex);
+	c->active = false;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+
+static void pool_init(void)
+{
+	pthread_key_create(&pool_key, cache_release);
+}
+
+
+static struct mem_cache *cache_get(void)
+{
+	struct mem_cache *c;
+
+	pthread_once(&pool_once, pool_init);
+
+	c = pthread_getspecific(pool_key);
+	if (c)
+		return c;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	/* Adopt the cache of an exited thread */
+	for (c = cachel; c; c = c->next) {
+		if (!c->active)
+			break;
+	}
+
+	if (!c) {
+		c = calloc(1, sizeof(*c));
+		if (c) {
+			c->next = cachel;
+			cachel  = c;
+		}
+	}
+
+	if (c)
+		c->active = true;
+
+	pthread_mutex_unlock(&pool_mutex);
+
+	if (c)
+		pthread_setspecific(pool_key, c);
+
+	return c;
+}
+
+
+static bool chunk_alloc(struct mem_cache *c, unsigned i)
+{
+	const size_t bsz = block_size(i);
+	struct mem_class *mc = &c->classv[i];
+	struct mem_chunk *ch;
+	uint8_t *p, *end;
+	void *mem;
+
+	if (posix_memalign(&mem, MEM_CHUNK_SIZE, MEM_CHUNK_SIZE))
+		return false;
+
+	ch = mem;
+	ch->cache = c;
+
+	end = (uint8_t *)mem + MEM_CHUNK_SIZE;
+
+	for (p = (uint8_t *)mem + MEM_CHUNK_HDR; p + bsz <= end; p += bsz) {
+		struct mem_free *f = (void *)p;
+
+		f->next   = mc->freel;
+		mc->freel = f;
+	}
+
+	++mc->chunks;
+
+	return true;
+}
+
+
+static struct mem *pool_alloc(unsigned cls)
+{
+	struct mem_cache *c = cache_get();
+	struct mem_class *mc;
+	struct mem_free *f;
+
+	if (!c)
+		return NULL;
+
+	mc = &c->classv[cls - 1];
+
+	if (!mc->freel)
+		mc->freel = __atomic_exchange_n(&mc->remote, NULL,
+						__ATOMIC_ACQUIRE);
+
+	if (!mc->freel && !chunk_alloc(c, cls - 1))
 		return NULL;
+
+	f = mc->freel;
+	mc->freel = f->next;
+
+	__atomic_fetch_add(&mc->used, 1, __ATOMIC_RELAXED);
+
+	return (struct mem *)(void *)f;
+}
+
+
+static void pool_free(struct mem *m, unsigned cls)
+{
+	const struct mem_chunk *ch = (struct mem_chunk *)
+		((uintptr_t)m & ~(uintptr_t)(MEM_CHUNK_SIZE - 1));
+	struct mem_class *mc = &ch->cache->classv[cls - 1];
+	struct mem_free *f = (struct mem_free *)(void *)m;
+
+	__atomic_fetch_sub(&mc->used, 1, __ATOMIC_RELAXED);
+
+	if (ch->cache == pthread_getspecific(pool_key)) {
+		f->next   = mc->freel;
+		mc->freel = f;
+		return;
 	}
+
+	f->next = __atomic_load_n(&mc->remote, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(&mc->remote, &f->next, f, true,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+
+/* Move a pooled object to a malloc'ed block, if it outgrows its class */
+static struct mem *pool_realloc(struct mem *m, size_t size)
+{
+	const size_t csz = mem_classv[m->cls - 1];
+	struct mem *m2;
+
+	if (size <= csz)
+		return m;
+
+	m2 = malloc(sizeof(*m2) + size);
+	if (!m2)
+		return NULL;
+
+	memcpy(m2, m, sizeof(*m2) + csz);
+	m2->cls = 0;
+
+	pool_free(m, m->cls);
+
+	return m2;
+}
+
+
+static int pool_status(struct re_printf *pf)
+{
+	size_t chunks[MEM_NCLASS], used[MEM_NCLASS];
+	const struct mem_cache *c;
+	unsigned i;
+	int err = 0;
+
+	memset(chunks, 0, sizeof(chunks));
+	memset(used, 0, sizeof(used));
+
+	pthread_mutex_lock(&pool_mutex);
+
+	for (c = cachel; c; c = c->next) {
+
+		for (i=0; i<MEM_NCLASS; i++) {
+			chunks[i] += c->classv[i].chunks;
+			used[i]   += __atomic_load_n(&c->classv[i].used,
+						     __ATOMIC_RELAXED);
+		}
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+
+	err |= re_hprintf(pf, " Pools: (%u bytes per chunk)\n",
+			  MEM_CHUNK_SIZE);
+
+	for (i=0; i<MEM_NCLASS; i++) {
+
+		const size_t nblocks = (MEM_CHUNK_SIZE - MEM_CHUNK_HDR)
+			/ block_size(i);
+
+		if (!chunks[i])
+			continue;
+
+		err |= re_hprintf(pf, "  %3zu bytes: %zu chunks,"
+				  " %zu of %zu blocks in use\n",
+				  mem_classv[i], chunks[i], used[i],
+				  chunks[i] * nblocks);
+	}
+
+	return err;
+}
+#endif
+
+
+#if MEM_DEBUG
+static inline bool threshold_reached(void)
+{
+	bool reached;
+
+	mem_lock();
+	reached = -1 != threshold && memstat.blocks_cur >= (size_t)threshold;
 	mem_unlock();
+
+	return reached;
+}
 #endif
 
-	m = malloc(sizeof(*m) + size);
-	if (!m)
-		return NULL;
 
+static inline void nrefs_inc(struct mem *m)
+{
+#if MEM_ATOMIC
+	if (m->flags & MEM_SHARED) {
+		__atomic_add_fetch(&m->nrefs, 1, __ATOMIC_RELAXED);
+		return;
+	}
+#endif
+
+	++m->nrefs;
+}
+
+
+static inline uint32_t nrefs_dec(struct mem *m)
+{
+#if MEM_ATOMIC
+	/* Make all writes from other threads visible to the destructor */
+	if (m->flags & MEM_SHARED)
+		return __atomic_sub_fetch(&m->nrefs, 1, __ATOMIC_ACQ_REL);
+#endif
+
+	return --m->nrefs;
+}
+
+
+static inline uint32_t nrefs_get(const struct mem *m)
+{
+#if MEM_ATOMIC
+	if (m->flags & MEM_SHARED)
+		return __atomic_load_n(&m->nrefs, __ATOMIC_ACQUIRE);
+#endif
+
+	return m->nrefs;
+}
+
+
+static void *mem_init(struct mem *m, size_t size, mem_destroy_h *dh)
+{
 #if MEM_DEBUG
 	memset(&m->le, 0, sizeof(struct le));
 	mem_lock();
@@ -148,6 +452,7 @@ void *mem_alloc(size_t size, mem_destroy_h *dh)
 #endif
 
 	m->nrefs = 1;
+	m->flags = 0;
 	m->dh    = dh;
 
 	STAT_ALLOC(m, size);
@@ -156,6 +461,33 @@ void *mem_alloc(size_t size, mem_destroy_h *dh)
 }
 
 
+/**
+ * Allocate a new reference-counted memory object
+ *
+ * @param size Size of memory object
+ * @param dh   Optional destructor, called when destroyed
+ *
+ * @return Pointer to allocated object
+ */
+void *mem_alloc(size_t size, mem_destroy_h *dh)
+{
+	struct mem *m;
+
+#if MEM_DEBUG
+	if (threshold_reached())
+		return NULL;
+#endif
+
+	m = malloc(sizeof(*m) + size);
+	if (!m)
+		return NULL;
+
+	m->cls = 0;
+
+	return mem_init(m, size, dh);
+}
+
+
 /**
  * Allocate a new reference-counted memory object. Memory is zeroed.
  *
@@ -178,6 +510,50 @@ void *mem_zalloc(size_t size, mem_destroy_h *dh)
 }
 
 
+/**
+ * Allocate a new reference-counted memory object from the size-class pools
+ * of this thread. This is faster than mem_zalloc() for small objects that
+ * are allocated and freed often. The object can be used and freed from any
+ * thread, like any other memory object. Memory is zeroed.
+ *
+ * @param size Size of memory object
+ * @param dh   Optional destructor, called when destroyed
+ *
+ * @return Pointer to allocated object
+ */
+void *mem_pool_alloc(size_t size, mem_destroy_h *dh)
+{
+#if MEM_POOL
+	struct mem *m;
+	unsigned cls;
+	void *p;
+
+	if (size > MEM_POOL_MAXSZ)
+		return mem_zalloc(size, dh);
+
+#if MEM_DEBUG
+	if (threshold_reached())
+		return NULL;
+#endif
+
+	cls = mem_class_tbl[(size + 15) / 16];
+
+	m = pool_alloc(cls);
+	if (!m)
+		return mem_zalloc(size, dh);
+
+	m->cls = cls;
+
+	p = mem_init(m, size, dh);
+	memset(p, 0, size);
+
+	return p;
+#else
+	return mem_zalloc(size, dh);
+#endif
+}
+
+
 /**
  * Re-allocate a reference-counted memory object
  *
@@ -214,7 +590,12 @@ void *mem_realloc(void *data, size_t size)
 	mem_unlock();
 #endif
 
-	m2 = realloc(m, sizeof(*m2) + size);
+#if MEM_POOL
+	if (m->cls)
+		m2 = pool_realloc(m, size);
+	else
+#endif
+		m2 = realloc(m, sizeof(*m2) + size);
 
 #if MEM_DEBUG
 	mem_lock();
@@ -285,7 +666,7 @@ void *mem_ref(void *data)
 
 	MAGIC_CHECK(m);
 
-	++m->nrefs;
+	nrefs_inc(m);
 
 	return data;
 }
@@ -303,6 +684,9 @@ void *mem_ref(void *data)
 void *mem_deref(void *data)
 {
 	struct mem *m;
+#if MEM_POOL
+	unsigned cls;
+#endif
 
 	if (!data)
 		return NULL;
@@ -311,14 +695,14 @@ void *mem_deref(void *data)
 
 	MAGIC_CHECK(m);
 
-	if (--m->nrefs > 0)
+	if (nrefs_dec(m) > 0)
 		return NULL;
 
 	if (m->dh)
 		m->dh(data);
 
 	/* NOTE: check if the destructor called mem_ref() */
-	if (m->nrefs > 0)
+	if (nrefs_get(m) > 0)
 		return NULL;
 
 #if MEM_DEBUG
@@ -327,8 +711,19 @@ void *mem_deref(void *data)
 	mem_unlock();
 #endif
 
+#if MEM_POOL
+	cls = m->cls;
+#endif
+
 	STAT_DEREF(m);
 
+#if MEM_POOL
+	if (cls) {
+		pool_free(m, cls);
+		return NULL;
+	}
+#endif
+
 	free(m);
 
 	return NULL;
@@ -353,7 +748,55 @@ uint32_t mem_nrefs(const void *data)
 
 	MAGIC_CHECK(m);
 
-	return m->nrefs;
+	return nrefs_get(m);
+}
+
+
+/**
+ * Allocate a new reference-counted memory object, which can be shared
+ * between threads. Memory is zeroed.
+ *
+ * @param size Size of memory object
+ * @param dh   Optional destructor, called when destroyed
+ *
+ * @return Pointer to allocated object
+ *
+ * @note See mem_share()
+ */
+void *mem_alloc_shared(size_t size, mem_destroy_h *dh)
+{
+	return mem_share(mem_zalloc(size, dh));
+}
+
+
+/**
+ * Mark a reference-counted memory object as shared between threads.
+ * Any thread holding a reference can then call mem_ref() and mem_deref()
+ * on the object, which use atomic operations for shared objects only.
+ * The destructor is called in the thread that releases the last reference.
+ *
+ * @param data Memory object
+ *
+ * @return Memory object (same as data)
+ *
+ * @note Must be called before the object is passed to another thread.
+ *       The contents of the object are not protected, and
+ *       mem_realloc() must only be used while there is one reference.
+ */
+void *mem_share(void *data)
+{
+	struct mem *m;
+
+	if (!data)
+		return NULL;
+
+	m = ((struct mem *)data) - 1;
+
+	MAGIC_CHECK(m);
+
+	m->flags |= MEM_SHARED;
+
+	return data;
 }
 
 
@@ -477,8 +920,14 @@ int mem_status(struct re_printf *pf, void *unused)
 	err |= re_hprintf(pf, " Block size: min=%u, max=%u\n",
 			  stat.size_min, stat.size_max);
 	err |= re_hprintf(pf, " Total %u blocks allocated\n", c);
+#if MEM_POOL
+	err |= pool_status(pf);
+#endif
 
 	return err;
+#elif MEM_POOL
+	(void)unused;
+	return pool_status(pf);
 #else
 	(void)pf;
 	(void)unused;
@@ -35,3 +35,23 @@ int mem_seccmp(const volatile uint8_t *volatile s1,
 
 	return val;
 }
+
+
+/**
+ * Clear memory that holds secret data, such as keys. Unlike memset(),
+ * the stores are not removed by the compiler if the memory is not read
+ * afterwards.
+ *
+ * @param data Memory to clear
+ * @param size Number of bytes
+ */
+void mem_secclean(void *data, size_t size)
+{
+	volatile uint8_t *p = data;
+
+	if (!p)
+		return;
+
+	while (size--)
+		*p++ = 0;
+}
@@ -9,3 +9,7 @@ SRCS	+= mqueue/mqueue.c
 ifeq ($(OS),win32)
 SRCS	+= mqueue/win32/pipe.c
 endif
+
+ifeq ($(OS),linux)
+CFLAGS  += -DHAVE_EVENTFD
+endif
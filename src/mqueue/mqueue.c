@@ -6,6 +6,9 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
@@ -25,6 +28,25 @@
 #endif
 
 
+#ifdef HAVE_EVENTFD
+/*
+ * Messages are passed in a lock-free bounded ring, with one sequence
+ * number per cell (Vyukov). Any thread can push, only the thread that
+ * allocated the queue pops. The eventfd is only signalled when the
+ * consumer is idle, and it drains all messages on each wakeup.
+ */
+enum {
+	MQUEUE_SIZE = 4096   /**< Number of cells, must be a power of 2 */
+};
+
+struct cell {
+	size_t seq;
+	void *data;
+	int id;
+};
+#endif
+
+
 /**
  * Defines a Thread-safe Message Queue
  *
@@ -33,31 +55,93 @@
  * incoming messages from other threads. The sender thread can be any thread.
  */
 struct mqueue {
+#ifdef HAVE_EVENTFD
+	struct cell *ring;  /**< Ring of messages               */
+	size_t head;        /**< Next cell to pop               */
+	size_t tail;        /**< Next cell to push              */
+	int signalled;      /**< Consumer was signalled         */
+	int efd;            /**< Event file descriptor          */
+#else
 	int pfd[2];
+#endif
 	mqueue_h *h;
 	void *arg;
 };
 
+#ifndef HAVE_EVENTFD
 struct msg {
 	void *data;
 	uint32_t magic;
 	int id;
 };
+#endif
 
 
 static void destructor(void *arg)
 {
 	struct mqueue *q = arg;
 
+#ifdef HAVE_EVENTFD
+	if (q->efd >= 0) {
+		fd_close(q->efd);
+		(void)close(q->efd);
+	}
+
+	mem_deref(q->ring);
+#else
 	if (q->pfd[0] >= 0) {
 		fd_close(q->pfd[0]);
 		(void)close(q->pfd[0]);
 	}
 	if (q->pfd[1] >= 0)
 		(void)close(q->pfd[1]);
+#endif
+}
+
+
+#ifdef HAVE_EVENTFD
+static bool ring_pop(struct mqueue *mq, int *id, void **data)
+{
+	struct cell *c = &mq->ring[mq->head & (MQUEUE_SIZE - 1)];
+
+	/* Empty, or the producer has not finished writing */
+	if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != mq->head + 1)
+		return false;
+
+	*id   = c->id;
+	*data = c->data;
+
+	__atomic_store_n(&c->seq, mq->head + MQUEUE_SIZE, __ATOMIC_RELEASE);
+	++mq->head;
+
+	return true;
 }
 
 
+static void event_handler(int flags, void *arg)
+{
+	struct mqueue *mq = arg;
+	uint64_t val;
+	void *data;
+	int id;
+
+	if (!(flags & FD_READ))
+		return;
+
+	if (read(mq->efd, &val, sizeof(val)) < 0)
+		return;
+
+	/* New messages must signal again */
+	__atomic_store_n(&mq->signalled, 0, __ATOMIC_SEQ_CST);
+
+	mem_ref(mq);
+
+	while (mem_nrefs(mq) > 1 && ring_pop(mq, &id, &data))
+		mq->h(id, data, mq->arg);
+
+	mem_deref(mq);
+}
+#else
 static void event_handler(int flags, void *arg)
 {
 	struct mqueue *mq = arg;
@@ -85,6 +169,7 @@ static void event_handler(int flags, void *arg)
 
 	mq->h(msg.id, msg.data, mq->arg);
 }
+#endif
 
 
 /**
@@ -100,6 +185,9 @@ int mqueue_alloc(struct mqueue **mqp, mqueue_h *h, void *arg)
 {
 	struct mqueue *mq;
 	int err = 0;
+#ifdef HAVE_EVENTFD
+	size_t i;
+#endif
 
 	if (!mqp || !h)
 		return EINVAL;
@@ -111,6 +199,28 @@ int mqueue_alloc(struct mqueue **mqp, mqueue_h *h, void *arg)
 	mq->h   = h;
 	mq->arg = arg;
 
+#ifdef HAVE_EVENTFD
+	mq->efd = -1;
+
+	mq->ring = mem_zalloc(MQUEUE_SIZE * sizeof(*mq->ring), NULL);
+	if (!mq->ring) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<MQUEUE_SIZE; i++)
+		mq->ring[i].seq = i;
+
+	mq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mq->efd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	err = fd_listen(mq->efd, FD_READ, event_handler, mq);
+	if (err)
+		goto out;
+#else
 	mq->pfd[0] = mq->pfd[1] = -1;
 	if (pipe(mq->pfd) < 0) {
 		err = errno;
@@ -128,6 +238,7 @@ int mqueue_alloc(struct mqueue **mqp, mqueue_h *h, void *arg)
 	err = fd_listen(mq->pfd[0], FD_READ, event_handler, mq);
 	if (err)
 		goto out;
+#endif
 
  out:
 	if (err)
@@ -150,6 +261,50 @@ int mqueue_alloc(struct mqueue **mqp, mqueue_h *h, void *arg)
  */
 int mqueue_push(struct mqueue *mq, int id, void *data)
 {
+#ifdef HAVE_EVENTFD
+	const uint64_t val = 1;
+	size_t pos;
+	struct cell *c;
+
+	if (!mq)
+		return EINVAL;
+
+	pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		intptr_t dif;
+
+		c = &mq->ring[pos & (MQUEUE_SIZE - 1)];
+		dif = (intptr_t)__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE)
+			- (intptr_t)pos;
+
+		/* The queue is full */
+		if (dif < 0)
+			return EAGAIN;
+
+		if (dif == 0 &&
+		    __atomic_compare_exchange_n(&mq->tail, &pos, pos + 1,
+						true, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			break;
+
+		if (dif > 0)
+			pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+	}
+
+	c->id   = id;
+	c->data = data;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* Only wake up the consumer once */
+	if (__atomic_exchange_n(&mq->signalled, 1, __ATOMIC_SEQ_CST))
+		return 0;
+
+	if (write(mq->efd, &val, sizeof(val)) < 0)
+		return errno;
+
+	return 0;
+#else
 	struct msg msg;
 	ssize_t n;
 
@@ -165,4 +320,5 @@ int mqueue_push(struct mqueue *mq, int id, void *data)
 		return errno;
 
 	return (n != sizeof(msg)) ? EPIPE : 0;
+#endif
 }
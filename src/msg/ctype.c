@@ -18,16 +18,17 @@
  */
 int msg_ctype_decode(struct msg_ctype *ctype, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct pl ws;
 
 	if (!ctype || !pl)
 		return EINVAL;
 
-	if (re_regex(pl->p, pl->l,
-		     "[ \t\r\n]*[^ \t\r\n;/]+[ \t\r\n]*/[ \t\r\n]*[^ \t\r\n;]+"
-		     "[^]*",
-		     &ws, &ctype->type, NULL, NULL, &ctype->subtype,
-		     &ctype->params))
+	if (re_regex_cached(&rx, pl->p, pl->l,
+			    "[ \t\r\n]*[^ \t\r\n;/]+[ \t\r\n]*/[ \t\r\n]*"
+			    "[^ \t\r\n;]+[^]*",
+			    &ws, &ctype->type, NULL, NULL, &ctype->subtype,
+			    &ctype->params))
 		return EBADMSG;
 
 	if (ws.p != pl->p)
@@ -96,7 +96,7 @@ int odict_entry_add(struct odict *o, const char *key,
 		goto out;
 
 	list_append(&o->lst, &e->le, e);
-	hash_append(o->ht, hash_fast_str(e->key), &e->he, e);
+	hash_append(o->ht, hash_fast32_str(e->key), &e->he, e);
 
  out:
 	if (err)
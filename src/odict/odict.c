@@ -54,7 +54,7 @@ const struct odict_entry *odict_lookup(const struct odict *o, const char *key)
 	if (!o || !key)
 		return NULL;
 
-	le = list_head(hash_list(o->ht, hash_fast_str(key)));
+	le = list_head(hash_list(o->ht, hash_fast32_str(key)));
 
 	while (le) {
 		const struct odict_entry *e = le->data;
@@ -19,12 +19,12 @@ static void destructor(void *data)
 {
 	struct rtp_member *mbr = data;
 
-	hash_unlink(&mbr->le);
+	intmap_remove(mbr->map, mbr->src);
 	mem_deref(mbr->s);
 }
 
 
-struct rtp_member *member_add(struct hash *ht, uint32_t src)
+struct rtp_member *member_add(struct intmap *map, uint32_t src)
 {
 	struct rtp_member *mbr;
 
@@ -32,22 +32,18 @@ struct rtp_member *member_add(struct hash *ht, uint32_t src)
 	if (!mbr)
 		return NULL;
 
-	hash_append(ht, src, &mbr->le, mbr);
 	mbr->src = src;
 
-	return mbr;
-}
+	if (intmap_add(map, src, mbr))
+		return mem_deref(mbr);
 
+	mbr->map = map;
 
-static bool hash_cmp_handler(struct le *le, void *arg)
-{
-	const struct rtp_member *mbr = le->data;
-
-	return mbr->src == *(uint32_t *)arg;
+	return mbr;
 }
 
 
-struct rtp_member *member_find(struct hash *ht, uint32_t src)
+struct rtp_member *member_find(const struct intmap *map, uint32_t src)
 {
-	return list_ledata(hash_lookup(ht, src, hash_cmp_handler, &src));
+	return intmap_find(map, src);
 }
@@ -286,7 +286,7 @@ int rtcp_decode(struct rtcp_msg **msgp, struct mbuf *mb)
 	if (mbuf_get_left(mb) < RTCP_HDR_SIZE)
 		return EBADMSG;
 
-	msg = mem_zalloc(sizeof(*msg), rtcp_destructor);
+	msg = mem_pool_alloc(sizeof(*msg), rtcp_destructor);
 	if (!msg)
 		return ENOMEM;
 
@@ -25,7 +25,7 @@ struct ntp_time {
 	uint32_t lo;  /**< Fraction of seconds                    */
 };
 
-struct hash;
+struct intmap;
 
 /** Per-source state information */
 struct rtp_source {
@@ -41,7 +41,7 @@ struct rtp_source {
 	int transit;              /**< Relative trans time for prev pkt    */
 	uint32_t jitter;          /**< Estimated jitter                    */
 	size_t rtp_rx_bytes;      /**< Number of RTP bytes received        */
-	uint64_t sr_recv;         /**< When the last SR was received       */
+	uint64_t sr_recv;         /**< When the last SR was received [us]  */
 	struct ntp_time last_sr;  /**< NTP Timestamp from last SR received */
 	uint32_t rtp_ts;          /**< RTP timestamp                       */
 	uint32_t psent;           /**< RTP packets sent                    */
@@ -50,9 +50,9 @@ struct rtp_source {
 
 /** RTP Member */
 struct rtp_member {
-	struct le le;             /**< Hash-table element                  */
+	struct intmap *map;       /**< Member table                        */
 	struct rtp_source *s;     /**< RTP source state                    */
-	uint32_t src;             /**< Source - used for hash-table lookup */
+	uint32_t src;             /**< Source - used for member lookup     */
 	int cum_lost;             /**< Cumulative number of packets lost   */
 	uint32_t jit;             /**< Jitter in [us]                      */
 	uint32_t rtt;             /**< Round-trip time in [us]             */
@@ -60,8 +60,8 @@ struct rtp_member {
 
 
 /* Member */
-struct rtp_member *member_add(struct hash *ht, uint32_t src);
-struct rtp_member *member_find(struct hash *ht, uint32_t src);
+struct rtp_member *member_add(struct intmap *map, uint32_t src);
+struct rtp_member *member_find(const struct intmap *map, uint32_t src);
 
 /* Source */
 void source_init_seq(struct rtp_source *s, uint16_t seq);
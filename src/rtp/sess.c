@@ -47,7 +47,7 @@ struct txstat {
 /** RTCP Session */
 struct rtcp_sess {
 	struct rtp_sock *rs;        /**< RTP Socket                          */
-	struct hash *members;       /**< Member table                        */
+	struct intmap *members;     /**< Member table                        */
 	struct tmr tmr;             /**< Event sender timer                  */
 	char *cname;                /**< Canonical Name                      */
 	uint32_t memberc;           /**< Number of members                   */
@@ -76,7 +76,7 @@ static void sess_destructor(void *data)
 	tmr_cancel(&sess->tmr);
 
 	mem_deref(sess->cname);
-	hash_flush(sess->members);
+	intmap_flush(sess->members);
 	mem_deref(sess->members);
 	mem_deref(sess->lock);
 }
@@ -172,7 +172,7 @@ static void handle_incoming_sr(struct rtcp_sess *sess,
 
 	if (mbr->s) {
 		/* Save time when SR was received */
-		mbr->s->sr_recv = tmr_jiffies();
+		mbr->s->sr_recv = tmr_jiffies_us();
 
 		/* Save NTP timestamp from SR */
 		mbr->s->last_sr.hi = msg->r.sr.ntp_sec;
@@ -252,7 +252,7 @@ int rtcp_sess_alloc(struct rtcp_sess **sessp, struct rtp_sock *rs)
 	if (err)
 		goto out;
 
-	err  = hash_alloc(&sess->members, MAX_MEMBERS);
+	err  = intmap_alloc(&sess->members, MAX_MEMBERS);
 	if (err)
 		goto out;
 
@@ -347,8 +347,8 @@ static uint32_t calc_lsr(const struct ntp_time *last_sr)
 static uint32_t calc_dlsr(uint64_t sr_recv)
 {
 	if (sr_recv) {
-		const uint64_t diff = tmr_jiffies() - sr_recv;
-		return (uint32_t)((65536 * diff) / 1000);
+		const uint64_t diff = tmr_jiffies_us() - sr_recv;
+		return (uint32_t)((65536 * diff) / 1000000);
 	}
 	else {
 		return 0;
@@ -356,12 +356,13 @@ static uint32_t calc_dlsr(uint64_t sr_recv)
 }
 
 
-static bool sender_apply_handler(struct le *le, void *arg)
+static bool sender_apply_handler(uint64_t key, void *val, void *arg)
 {
-	struct rtp_member *mbr = le->data;
+	struct rtp_member *mbr = val;
 	struct rtp_source *s = mbr->s;
 	struct mbuf *mb = arg;
 	struct rtcp_rr rr;
+	(void)key;
 
 	if (!s)
 		return false;
@@ -381,10 +382,10 @@ static bool sender_apply_handler(struct le *le, void *arg)
 
 static int encode_handler(struct mbuf *mb, void *arg)
 {
-	struct hash *members = arg;
+	struct intmap *members = arg;
 
 	/* copy all report blocks */
-	if (hash_apply(members, sender_apply_handler, mb))
+	if (intmap_apply(members, sender_apply_handler, mb))
 		return ENOMEM;
 
 	return 0;
@@ -566,10 +567,12 @@ void rtcp_sess_rx_rtp(struct rtcp_sess *sess, uint16_t seq, uint32_t ts,
 
 	if (sess->srate_rx) {
 
+		const uint64_t jfs = tmr_jiffies_us();
 		uint64_t ts_arrive;
 
-		/* Convert from wall-clock time to timestamp units */
-		ts_arrive = tmr_jiffies() * sess->srate_rx / 1000;
+		/* Convert from monotonic time to timestamp units */
+		ts_arrive  = jfs / 1000000 * sess->srate_rx;
+		ts_arrive += jfs % 1000000 * sess->srate_rx / 1000000;
 
 		source_calc_jitter(mbr->s, ts, (uint32_t)ts_arrive);
 	}
@@ -622,11 +625,12 @@ int rtcp_stats(struct rtp_sock *rs, uint32_t ssrc, struct rtcp_stats *stats)
 }
 
 
-static bool debug_handler(struct le *le, void *arg)
+static bool debug_handler(uint64_t key, void *val, void *arg)
 {
-	const struct rtp_member *mbr = le->data;
+	const struct rtp_member *mbr = val;
 	struct re_printf *pf = arg;
 	int err;
+	(void)key;
 
 	err = re_hprintf(pf, "  member 0x%08x: lost=%d Jitter=%.1fms"
 			  " RTT=%.1fms\n", mbr->src, mbr->cum_lost,
@@ -664,7 +668,7 @@ int rtcp_debug(struct re_printf *pf, const struct rtp_sock *rs)
 			  rtp_sess_ssrc(sess->rs), rtp_sess_ssrc(sess->rs),
 			  sess->srate_rx);
 
-	hash_apply(sess->members, debug_handler, pf);
+	intmap_apply(sess->members, debug_handler, pf);
 
 	lock_read_get(sess->lock);
 	err |= re_hprintf(pf, "  TX: packets=%u, octets=%u\n",
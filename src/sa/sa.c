@@ -9,6 +9,7 @@
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_list.h>
+#include <re_hash.h>
 #include <re_sa.h>
 #include "sa.h"
 
@@ -404,7 +405,9 @@ bool sa_isset(const struct sa *sa, int flag)
  */
 uint32_t sa_hash(const struct sa *sa, int flag)
 {
-	uint32_t v = 0;
+	uint8_t key[18];
+	uint16_t port;
+	size_t n = 0;
 
 	if (!sa)
 		return 0;
@@ -412,20 +415,20 @@ uint32_t sa_hash(const struct sa *sa, int flag)
 	switch (sa->u.sa.sa_family) {
 
 	case AF_INET:
-		if (flag & SA_ADDR)
-			v += ntohl(sa->u.in.sin_addr.s_addr);
-		if (flag & SA_PORT)
-			v += ntohs(sa->u.in.sin_port);
+		if (flag & SA_ADDR) {
+			memcpy(key, &sa->u.in.sin_addr, 4);
+			n = 4;
+		}
+		port = sa->u.in.sin_port;
 		break;
 
 #ifdef HAVE_INET6
 	case AF_INET6:
 		if (flag & SA_ADDR) {
-			uint32_t *a = (uint32_t *)&sa->u.in6.sin6_addr;
-			v += a[0] ^ a[1] ^ a[2] ^ a[3];
+			memcpy(key, &sa->u.in6.sin6_addr, 16);
+			n = 16;
 		}
-		if (flag & SA_PORT)
-			v += ntohs(sa->u.in6.sin6_port);
+		port = sa->u.in6.sin6_port;
 		break;
 #endif
 
@@ -434,7 +437,12 @@ uint32_t sa_hash(const struct sa *sa, int flag)
 		return 0;
 	}
 
-	return v;
+	if (flag & SA_PORT) {
+		memcpy(key + n, &port, 2);
+		n += 2;
+	}
+
+	return hash_fast32(key, n);
 }
 
 
@@ -15,13 +15,14 @@
 
 static int attr_decode_fmtp(struct sdp_media *m, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct sdp_format *fmt;
 	struct pl id, params;
 
 	if (!m)
 		return 0;
 
-	if (re_regex(pl->p, pl->l, "[^ ]+ [^]*", &id, &params))
+	if (re_regex_cached(&rx, pl->p, pl->l, "[^ ]+ [^]*", &id, &params))
 		return EBADMSG;
 
 	fmt = sdp_format_find(&m->rfmtl, &id);
@@ -36,17 +37,18 @@ static int attr_decode_fmtp(struct sdp_media *m, const struct pl *pl)
 
 static int attr_decode_rtcp(struct sdp_media *m, const struct pl *pl)
 {
+	static struct regex *rx_addr, *rx_port;
 	struct pl port, addr;
 	int err = 0;
 
 	if (!m)
 		return 0;
 
-	if (!re_regex(pl->p, pl->l, "[0-9]+ IN IP[46]1 [^ ]+",
-		      &port, NULL, &addr)) {
+	if (!re_regex_cached(&rx_addr, pl->p, pl->l,
+			     "[0-9]+ IN IP[46]1 [^ ]+", &port, NULL, &addr)) {
 		(void)sa_set(&m->raddr_rtcp, &addr, pl_u32(&port));
 	}
-	else if (!re_regex(pl->p, pl->l, "[0-9]+", &port)) {
+	else if (!re_regex_cached(&rx_port, pl->p, pl->l, "[0-9]+", &port)) {
 		sa_set_port(&m->raddr_rtcp, pl_u32(&port));
 	}
 	else
@@ -58,6 +60,7 @@ static int attr_decode_rtcp(struct sdp_media *m, const struct pl *pl)
 
 static int attr_decode_rtpmap(struct sdp_media *m, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct pl id, name, srate, ch;
 	struct sdp_format *fmt;
 	int err;
@@ -65,8 +68,8 @@ static int attr_decode_rtpmap(struct sdp_media *m, const struct pl *pl)
 	if (!m)
 		return 0;
 
-	if (re_regex(pl->p, pl->l, "[^ ]+ [^/]+/[0-9]+[/]*[^]*",
-		     &id, &name, &srate, NULL, &ch))
+	if (re_regex_cached(&rx, pl->p, pl->l, "[^ ]+ [^/]+/[0-9]+[/]*[^]*",
+			    &id, &name, &srate, NULL, &ch))
 		return EBADMSG;
 
 	fmt = sdp_format_find(&m->rfmtl, &id);
@@ -89,10 +92,11 @@ static int attr_decode_rtpmap(struct sdp_media *m, const struct pl *pl)
 static int attr_decode(struct sdp_session *sess, struct sdp_media *m,
 		       enum sdp_dir *dir, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct pl name, val;
 	int err = 0;
 
-	if (re_regex(pl->p, pl->l, "[^:]+:[^]+", &name, &val)) {
+	if (re_regex_cached(&rx, pl->p, pl->l, "[^:]+:[^]+", &name, &val)) {
 		name = *pl;
 		val  = pl_null;
 	}
@@ -128,9 +132,10 @@ static int attr_decode(struct sdp_session *sess, struct sdp_media *m,
 
 static int bandwidth_decode(int32_t *bwv, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct pl type, bw;
 
-	if (re_regex(pl->p, pl->l, "[^:]+:[0-9]+", &type, &bw))
+	if (re_regex_cached(&rx, pl->p, pl->l, "[^:]+:[0-9]+", &type, &bw))
 		return EBADMSG;
 
 	if (!pl_strcmp(&type, "CT"))
@@ -154,9 +159,10 @@ static int bandwidth_decode(int32_t *bwv, const struct pl *pl)
 
 static int conn_decode(struct sa *sa, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct pl v;
 
-	if (re_regex(pl->p, pl->l, "IN IP[46]1 [^ ]+", NULL, &v))
+	if (re_regex_cached(&rx, pl->p, pl->l, "IN IP[46]1 [^ ]+", NULL, &v))
 		return EBADMSG;
 
 	(void)sa_set(sa, &v, sa_port(sa));
@@ -168,12 +174,13 @@ static int conn_decode(struct sa *sa, const struct pl *pl)
 static int media_decode(struct sdp_media **mp, struct sdp_session *sess,
 			bool offer, const struct pl *pl)
 {
+	static struct regex *rx_media, *rx_fmt;
 	struct pl name, port, proto, fmtv, fmt;
 	struct sdp_media *m;
 	int err;
 
-	if (re_regex(pl->p, pl->l, "[a-z]+ [^ ]+ [^ ]+[^]*",
-		     &name, &port, &proto, &fmtv))
+	if (re_regex_cached(&rx_media, pl->p, pl->l, "[a-z]+ [^ ]+ [^ ]+[^]*",
+			    &name, &port, &proto, &fmtv))
 		return EBADMSG;
 
 	m = list_ledata(*mp ? (*mp)->le.next : sess->medial.head);
@@ -208,7 +215,7 @@ static int media_decode(struct sdp_media **mp, struct sdp_session *sess,
 		}
 	}
 
-	while (!re_regex(fmtv.p, fmtv.l, " [^ ]+", &fmt)) {
+	while (!re_regex_cached(&rx_fmt, fmtv.p, fmtv.l, " [^ ]+", &fmt)) {
 
 		pl_advance(&fmtv, fmt.p + fmt.l - fmtv.p);
 
@@ -246,9 +253,8 @@ static int version_decode(const struct pl *pl)
 int sdp_decode(struct sdp_session *sess, struct mbuf *mb, bool offer)
 {
 	struct sdp_media *m;
-	struct pl pl, val;
+	struct pl pl, line, val;
 	struct le *le;
-	char type = 0;
 	int err = 0;
 
 	if (!sess || !mb)
@@ -268,75 +274,57 @@ int sdp_decode(struct sdp_session *sess, struct mbuf *mb, bool offer)
 
 	m = NULL;
 
-	for (;pl.l && !err; pl.p++, pl.l--) {
+	while (!err && !pl_getline(&pl, &line)) {
 
-		switch (*pl.p) {
+		char type;
 
-		case '\r':
-		case '\n':
-			if (!type)
-				break;
-
-			switch (type) {
-
-			case 'a':
-				err = attr_decode(sess, m,
-						  m ? &m->rdir : &sess->rdir,
-						  &val);
-				break;
-
-			case 'b':
-				err = bandwidth_decode(m? m->rbwv : sess->rbwv,
-						       &val);
-				break;
+		if (!line.l)
+			continue;
 
-			case 'c':
-				err = conn_decode(m ? &m->raddr : &sess->raddr,
-						  &val);
-				break;
+		if (line.l < 2 || line.p[1] != '=') {
+			err = EBADMSG;
+			break;
+		}
 
-			case 'm':
-				err = media_decode(&m, sess, offer, &val);
-				break;
+		type  = line.p[0];
+		val.p = line.p + 2;
+		val.l = line.l - 2;
 
-			case 'v':
-				err = version_decode(&val);
-				break;
-			}
+		switch (type) {
 
-#if 0
-			if (err)
-				re_printf("** %c='%r': %m\n", type, &val, err);
-#endif
-
-			type = 0;
+		case 'a':
+			err = attr_decode(sess, m, m ? &m->rdir : &sess->rdir,
+					  &val);
 			break;
 
-		default:
-			if (type) {
-				val.l++;
-				break;
-			}
+		case 'b':
+			err = bandwidth_decode(m? m->rbwv : sess->rbwv, &val);
+			break;
 
-			if (pl.l < 2 || *(pl.p + 1) != '=') {
-				err = EBADMSG;
-				break;
-			}
+		case 'c':
+			err = conn_decode(m ? &m->raddr : &sess->raddr, &val);
+			break;
 
-			type  = *pl.p;
-			val.p = pl.p + 2;
-			val.l = 0;
+		case 'm':
+			err = media_decode(&m, sess, offer, &val);
+			break;
 
-			pl.p += 1;
-			pl.l -= 1;
+		case 'v':
+			err = version_decode(&val);
 			break;
 		}
+
+#if 0
+		if (err)
+			re_printf("** %c='%r': %m\n", type, &val, err);
+#endif
 	}
 
 	if (err)
 		return err;
 
-	if (type)
+	/* The last line is not terminated */
+	if (pl.l)
 		return EBADMSG;
 
 	for (le=sess->medial.head; le; le=le->next)
@@ -24,6 +24,7 @@
  */
 int sip_addr_decode(struct sip_addr *addr, const struct pl *pl)
 {
+	static struct regex *rx_naddr, *rx_addr;
 	int err;
 
 	if (!addr || !pl)
@@ -31,8 +32,10 @@ int sip_addr_decode(struct sip_addr *addr, const struct pl *pl)
 
 	memset(addr, 0, sizeof(*addr));
 
-	if (0 == re_regex(pl->p, pl->l, "[~ \t\r\n<]*[ \t\r\n]*<[^>]+>[^]*",
-			  &addr->dname, NULL, &addr->auri, &addr->params)) {
+	if (0 == re_regex_cached(&rx_naddr, pl->p, pl->l,
+				 "[~ \t\r\n<]*[ \t\r\n]*<[^>]+>[^]*",
+				 &addr->dname, NULL, &addr->auri,
+				 &addr->params)) {
 
 		if (!addr->dname.l)
 			addr->dname.p = NULL;
@@ -43,8 +46,8 @@ int sip_addr_decode(struct sip_addr *addr, const struct pl *pl)
 	else {
 		memset(addr, 0, sizeof(*addr));
 
-		if (re_regex(pl->p, pl->l, "[^;]+[^]*",
-			     &addr->auri, &addr->params))
+		if (re_regex_cached(&rx_addr, pl->p, pl->l, "[^;]+[^]*",
+				    &addr->auri, &addr->params))
 			return EBADMSG;
 	}
 
@@ -23,14 +23,16 @@
  */
 int sip_cseq_decode(struct sip_cseq *cseq, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct pl num;
 	int err;
 
 	if (!cseq || !pl)
 		return EINVAL;
 
-	err = re_regex(pl->p, pl->l, "[0-9]+[ \t\r\n]+[^ \t\r\n]+",
-		       &num, NULL, &cseq->met);
+	err = re_regex_cached(&rx, pl->p, pl->l,
+			      "[0-9]+[ \t\r\n]+[^ \t\r\n]+",
+			      &num, NULL, &cseq->met);
 	if (err)
 		return err;
 
@@ -267,7 +267,7 @@ static bool response_handler(const struct sip_msg *msg, void *arg)
 	struct sip *sip = arg;
 
 	ct = list_ledata(hash_lookup(sip->ht_ctrans,
-				     hash_joaat_pl(&msg->via.branch),
+				     hash_fast32_pl(&msg->via.branch),
 				     cmp_handler, (void *)msg));
 	if (!ct)
 		return false;
@@ -322,7 +322,7 @@ int sip_ctrans_request(struct sip_ctrans **ctp, struct sip *sip,
 	if (!ct)
 		return ENOMEM;
 
-	hash_append(sip->ht_ctrans, hash_joaat_str(branch), &ct->he, ct);
+	hash_append(sip->ht_ctrans, hash_fast32_str(branch), &ct->he, ct);
 
 	ct->invite = !strcmp(met, "INVITE");
 	ct->branch = mem_ref(branch);
@@ -398,6 +398,15 @@ int sip_ctrans_cancel(struct sip_ctrans *ct)
 }
 
 
+/* Chained rather than an intmap, for the same reasons as strans_key() */
+static uint32_t ctrans_key(struct le *le)
+{
+	const struct sip_ctrans *ct = le->data;
+
+	return hash_fast32_str(ct->branch);
+}
+
+
 int sip_ctrans_init(struct sip *sip, uint32_t sz)
 {
 	int err;
@@ -406,7 +415,7 @@ int sip_ctrans_init(struct sip *sip, uint32_t sz)
 	if (err)
 		return err;
 
-	return hash_alloc(&sip->ht_ctrans, sz);
+	return hash_alloc_resizable(&sip->ht_ctrans, sz, ctrans_key);
 }
 
 
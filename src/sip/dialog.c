@@ -106,7 +106,7 @@ int sip_dialog_alloc(struct sip_dialog **dlgp,
 	if (!dlg)
 		return ENOMEM;
 
-	dlg->hash = hash_fast_str(from_uri);
+	dlg->hash = hash_fast32_str(from_uri);
 	dlg->lseq = rand_u16();
 
 	err = str_dup(&dlg->uri, uri);
@@ -225,7 +225,7 @@ int sip_dialog_accept(struct sip_dialog **dlgp, const struct sip_msg *msg)
 	if (err)
 		goto out;
 
-	err = x64_strdup(&dlg->ltag, msg->tag);
+	err = x64_strdup(&dlg->ltag, sip_msg_tag(msg));
 	if (err)
 		goto out;
 
@@ -246,7 +246,7 @@ int sip_dialog_accept(struct sip_dialog **dlgp, const struct sip_msg *msg)
 				 record_route_handler, &renc) ? ENOMEM : 0;
 	err |= mbuf_printf(dlg->mb, "To: %r\r\n", &msg->from.val);
 	err |= mbuf_printf(dlg->mb, "From: %r;tag=%016llx\r\n", &msg->to.val,
-			   msg->tag);
+			   sip_msg_tag(msg));
 	if (err)
 		goto out;
 
@@ -13,6 +13,7 @@
 #include <re_list.h>
 #include <re_sys.h>
 #include <re_uri.h>
+#include <re_tmr.h>
 #include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
@@ -155,6 +155,20 @@ static struct sip_udpconn *udpconn_find(struct sip *sip, struct udp_sock *us,
 }
 
 
+static uint32_t udpconn_key(struct le *le)
+{
+	const struct sip_udpconn *uc = le->data;
+
+	return sa_hash(&uc->paddr, SA_ALL);
+}
+
+
+int sip_keepalive_udp_init(struct sip *sip, uint32_t sz)
+{
+	return hash_alloc_resizable(&sip->ht_udpconn, sz, udpconn_key);
+}
+
+
 int  sip_keepalive_udp(struct sip_keepalive *ka, struct sip *sip,
 		       struct udp_sock *us, const struct sa *paddr,
 		       uint32_t interval)
@@ -170,10 +184,11 @@ int  sip_keepalive_udp(struct sip_keepalive *ka, struct sip *sip,
 		if (!uc)
 			return ENOMEM;
 
+		uc->paddr = *paddr;
+
 		hash_append(sip->ht_udpconn, sa_hash(paddr, SA_ALL),
 			    &uc->he, uc);
 
-		uc->paddr = *paddr;
 		uc->stun  = mem_ref(sip->stun);
 		uc->us    = mem_ref(us);
 		uc->ka_interval = interval ? interval : UDP_KEEPALIVE_INTVAL;
@@ -4,6 +4,8 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <ctype.h>
+#include <string.h>
+#include <strings.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_sys.h>
@@ -13,10 +15,12 @@
 #include <re_hash.h>
 #include <re_fmt.h>
 #include <re_uri.h>
+#include <re_tmr.h>
 #include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
 #include "sip.h"
+#include "../fmt/fmt.h"
 
 
 enum {
@@ -24,28 +28,161 @@ enum {
 	STARTLINE_MAX = 8192,
 };
 
+/** Fields of a SIP Message that are decoded on first use */
+enum {
+	DEC_TO    = 1<<0,  /**< To header           */
+	DEC_FROM  = 1<<1,  /**< From header         */
+	DEC_URI   = 1<<2,  /**< Request URI         */
+	DEC_CTYPE = 1<<3,  /**< Content-Type header */
+};
 
-static void hdr_destructor(void *arg)
-{
-	struct sip_hdr *hdr = arg;
 
-	list_unlink(&hdr->le);
-	hash_unlink(&hdr->he);
-}
+/**
+ * Defines the private state of a decoded SIP message. The headers are
+ * stored in one array after the state, which is sized up front.
+ */
+struct sip_msgpriv {
+	struct list ht[HDR_HASH_SIZE];  /**< Headers by SIP Header ID */
+	uint32_t n;                     /**< Number of headers used   */
+	uint32_t size;                  /**< Size of header array     */
+
+	/* Decoded on first use */
+	struct uri uri;                 /**< Request URI              */
+	struct sip_taddr to;            /**< To header                */
+	struct sip_taddr from;          /**< From header              */
+	struct msg_ctype ctyp;          /**< Content-Type header      */
+	uint64_t tag;                   /**< Opaque tag               */
+	unsigned dec;                   /**< Decoded fields           */
+};
 
 
 static void destructor(void *arg)
 {
 	struct sip_msg *msg = arg;
 
-	list_flush(&msg->hdrl);
-	hash_flush(msg->hdrht);
-	mem_deref(msg->hdrht);
+	/* The headers are owned by the header table */
+	list_clear(&msg->hdrl);
+	mem_deref(msg->priv);
 	mem_deref(msg->sock);
 	mem_deref(msg->mb);
 }
 
 
+static inline struct list *hdrtab_list(const struct sip_msgpriv *tab,
+				       enum sip_hdrid id)
+{
+	return tab ? (struct list *)&tab->ht[id & (HDR_HASH_SIZE - 1)] : NULL;
+}
+
+
+/*
+ * Get the maximum number of header entries in the header section,
+ * one per comma separated value and one per header line.
+ */
+static uint32_t hdr_count(const char *p, size_t l)
+{
+	struct pl pl;
+	const char *q;
+	uint32_t n = 0;
+	bool bol = true;
+
+	pl.p = p;
+	pl.l = l;
+
+	while ((q = pl_find_any(&pl, ",\n"))) {
+
+		if (*q == ',') {
+			++n;
+			bol = false;
+		}
+		else {
+			const char *c;
+
+			/* empty line, eoh */
+			for (c = pl.p; bol && c < q; c++)
+				bol = (*c == '\r');
+
+			if (bol)
+				return n;
+
+			n += 2;
+			bol = true;
+		}
+
+		pl_advance(&pl, q + 1 - pl.p);
+	}
+
+	return n + 2;
+}
+
+
+static int hdrtab_alloc(struct sip_msgpriv **tabp, uint32_t size)
+{
+	struct sip_msgpriv *tab;
+
+	tab = mem_alloc(sizeof(*tab) + size * sizeof(struct sip_hdr), NULL);
+	if (!tab)
+		return ENOMEM;
+
+	memset(tab, 0, sizeof(*tab));
+	tab->size = size;
+
+	*tabp = tab;
+
+	return 0;
+}
+
+
+/*
+ * Decode the start line: token SP token SP text *CR LF
+ */
+static bool startline_decode(struct pl *x, struct pl *y, struct pl *z,
+			     struct pl *e, const char *p, size_t l)
+{
+	const char *end = p + l;
+	struct pl *tokv[2];
+	unsigned i;
+
+	tokv[0] = x;
+	tokv[1] = y;
+
+	for (i=0; i<2; i++) {
+
+		tokv[i]->p = p;
+
+		while (p < end && *p != ' ' && *p != '\t' &&
+		       *p != '\r' && *p != '\n')
+			++p;
+
+		tokv[i]->l = p - tokv[i]->p;
+
+		if (!tokv[i]->l || p >= end || *p != ' ')
+			return false;
+
+		++p;
+	}
+
+	z->p = p;
+
+	while (p < end && *p != '\r' && *p != '\n')
+		++p;
+
+	z->l = p - z->p;
+
+	e->p = p;
+
+	while (p < end && *p == '\r')
+		++p;
+
+	if (p >= end || *p != '\n')
+		return false;
+
+	e->l = p + 1 - e->p;
+
+	return true;
+}
+
+
 static enum sip_hdrid hdr_hash(const struct pl *name)
 {
 	if (!name->l)
@@ -149,16 +286,205 @@ static inline bool hdr_comma_separated(enum sip_hdrid id)
 }
 
 
+static inline bool is_lws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+
+/*
+ * Find a parameter in the ';' separated parameters between p and end,
+ * without using re_regex()
+ */
+static bool param_find(struct pl *val, const char *p, const char *end,
+		       const char *name)
+{
+	const size_t n = str_len(name);
+	const char *v;
+
+	while ((p = memchr(p, ';', end - p))) {
+
+		for (++p; p < end && is_lws(*p); p++)
+			;
+
+		if ((size_t)(end - p) < n || strncasecmp(p, name, n))
+			continue;
+
+		for (p += n; p < end && is_lws(*p); p++)
+			;
+
+		if (p >= end || *p != '=')
+			continue;
+
+		for (++p; p < end && is_lws(*p); p++)
+			;
+
+		for (v = p; p < end && !is_lws(*p) && *p != ';'; p++)
+			;
+
+		if (p == v)
+			return false;
+
+		val->p = v;
+		val->l = p - v;
+
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Get the tag parameter of a To or From header, without decoding the
+ * address. The parameters follow the closing '>', or the first ';' if
+ * the address is not enclosed in angle brackets.
+ */
+static void taddr_tag_decode(struct pl *tag, const struct pl *val)
+{
+	const char *p = val->p, *end = val->p + val->l;
+	const char *v;
+
+	pl_set_str(tag, NULL);
+
+	while (p < end && is_lws(*p))
+		++p;
+
+	/* quoted display-name */
+	if (p < end && *p == '"') {
+
+		for (++p; p < end && *p != '"'; p++) {
+			if (*p == '\\')
+				++p;
+		}
+
+		if (p >= end)
+			return;
+	}
+
+	v = memchr(p, '<', end - p);
+	if (v) {
+		p = memchr(v, '>', end - v);
+		if (!p)
+			return;
+	}
+
+	(void)param_find(tag, p, end, "tag");
+}
+
+
+static bool hdr_name_eq(const struct pl *name, const char *full, char cmp)
+{
+	if (name->l == 1)
+		return cmp && tolower(name->p[0]) == cmp;
+
+	return 0 == pl_strcasecmp(name, full);
+}
+
+
+/**
+ * Get the fingerprint of a SIP request, without decoding the message.
+ * Only the request method, the branch of the top Via header and the
+ * CSeq header are decoded.
+ *
+ * @param fp Fingerprint to set
+ * @param mb Buffer containing SIP Message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_msg_fingerprint(struct sip_fp *fp, const struct mbuf *mb)
+{
+	const char *p, *end, *eol;
+	bool via = false, cseq = false;
+
+	if (!fp || !mb)
+		return EINVAL;
+
+	p   = (const char *)mbuf_buf(mb);
+	end = p + mbuf_get_left(mb);
+
+	/* Request-Line: Method SP Request-URI SP SIP-Version CRLF */
+	eol = memchr(p, '\n', end - p);
+	if (!eol || end - p < 4 || !memcmp(p, "SIP/", 4))
+		return EBADMSG;
+
+	fp->met.p = p;
+	while (p < eol && *p != ' ')
+		++p;
+
+	fp->met.l = p - fp->met.p;
+	if (!fp->met.l || p >= eol)
+		return EBADMSG;
+
+	for (p = eol + 1; p < end && !(via && cseq); p = eol + 1) {
+		struct pl name;
+		const char *v;
+
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			return ENODATA;
+
+		/* End of headers, or folded line */
+		if (*p == '\r' || *p == '\n' || is_lws(*p))
+			break;
+
+		v = memchr(p, ':', eol - p);
+		if (!v)
+			return EBADMSG;
+
+		name.p = p;
+		for (name.l = v - p; name.l && is_lws(p[name.l-1]); name.l--)
+			;
+
+		for (++v; v < eol && is_lws(*v); v++)
+			;
+
+		if (!via && hdr_name_eq(&name, "Via", 'v')) {
+			const char *c = memchr(v, ',', eol - v);
+
+			/* top Via only */
+			if (!param_find(&fp->branch, v, c ? c : eol, "branch"))
+				return EBADMSG;
+
+			via = true;
+		}
+		else if (!cseq && hdr_name_eq(&name, "CSeq", 0)) {
+
+			for (fp->cseq = 0; v < eol && isdigit(*v); v++)
+				fp->cseq = fp->cseq * 10 + (*v - '0');
+
+			for (; v < eol && is_lws(*v); v++)
+				;
+
+			for (fp->cmet.p = v; v < eol && !is_lws(*v); v++)
+				;
+
+			fp->cmet.l = v - fp->cmet.p;
+			if (!fp->cmet.l)
+				return EBADMSG;
+
+			cseq = true;
+		}
+	}
+
+	return (via && cseq) ? 0 : ENOENT;
+}
+
+
 static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 			  enum sip_hdrid id, const char *p, ssize_t l,
 			  bool atomic, bool line)
 {
+	struct sip_msgpriv *tab = msg->priv;
 	struct sip_hdr *hdr;
 	int err = 0;
 
-	hdr = mem_zalloc(sizeof(*hdr), hdr_destructor);
-	if (!hdr)
-		return ENOMEM;
+	if (tab->n >= tab->size)
+		return EBADMSG;
+
+	hdr = (struct sip_hdr *)(tab + 1) + tab->n++;
+
+	memset(hdr, 0, sizeof(*hdr));
 
 	hdr->name  = *name;
 	hdr->val.p = p;
@@ -172,15 +498,15 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		if (!atomic)
 			break;
 
-		hash_append(msg->hdrht, id, &hdr->he, mem_ref(hdr));
-		list_append(&msg->hdrl, &hdr->le, mem_ref(hdr));
+		list_append(hdrtab_list(tab, id), &hdr->he, hdr);
+		list_append(&msg->hdrl, &hdr->le, hdr);
 		break;
 
 	default:
 		if (atomic)
-			hash_append(msg->hdrht, id, &hdr->he, mem_ref(hdr));
+			list_append(hdrtab_list(tab, id), &hdr->he, hdr);
 		if (line)
-			list_append(&msg->hdrl, &hdr->le, mem_ref(hdr));
+			list_append(&msg->hdrl, &hdr->le, hdr);
 		break;
 	}
 
@@ -195,22 +521,12 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		break;
 
 	case SIP_HDR_TO:
-		err = sip_addr_decode((struct sip_addr *)&msg->to, &hdr->val);
-		if (err)
-			break;
-
-		(void)msg_param_decode(&msg->to.params, "tag", &msg->to.tag);
+		taddr_tag_decode(&msg->to.tag, &hdr->val);
 		msg->to.val = hdr->val;
 		break;
 
 	case SIP_HDR_FROM:
-		err = sip_addr_decode((struct sip_addr *)&msg->from,
-				      &hdr->val);
-		if (err)
-			break;
-
-		(void)msg_param_decode(&msg->from.params, "tag",
-				       &msg->from.tag);
+		taddr_tag_decode(&msg->from.tag, &hdr->val);
 		msg->from.val = hdr->val;
 		break;
 
@@ -226,10 +542,6 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		msg->maxfwd = hdr->val;
 		break;
 
-	case SIP_HDR_CONTENT_TYPE:
-		err = msg_ctype_decode(&msg->ctyp, &hdr->val);
-		break;
-
 	case SIP_HDR_CONTENT_LENGTH:
 		msg->clen = hdr->val;
 		break;
@@ -243,8 +555,6 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		break;
 	}
 
-	mem_deref(hdr);
-
 	return err;
 }
 
@@ -274,19 +584,18 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 	p = (const char *)mbuf_buf(mb);
 	l = mbuf_get_left(mb);
 
-	if (re_regex(p, l, "[^ \t\r\n]+ [^ \t\r\n]+ [^\r\n]*[\r]*[\n]1",
-		     &x, &y, &z, NULL, &e) || x.p != (char *)mbuf_buf(mb))
+	if (!startline_decode(&x, &y, &z, &e, p, l))
 		return (l > STARTLINE_MAX) ? EBADMSG : ENODATA;
 
-	msg = mem_zalloc(sizeof(*msg), destructor);
+	msg = mem_pool_alloc(sizeof(*msg), destructor);
 	if (!msg)
 		return ENOMEM;
 
-	err = hash_alloc(&msg->hdrht, HDR_HASH_SIZE);
+	err = hdrtab_alloc(&msg->priv,
+			   hdr_count(e.p + e.l, l - (e.p + e.l - p)));
 	if (err)
 		goto out;
 
-	msg->tag = rand_u64();
 	msg->mb  = mem_ref(mb);
 	msg->req = (0 == pl_strcmp(&z, "SIP/2.0"));
 
@@ -295,11 +604,6 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 		msg->met = x;
 		msg->ruri = y;
 		msg->ver = z;
-
-		if (uri_decode(&msg->uri, &y)) {
-			err = EBADMSG;
-			goto out;
-		}
 	}
 	else {
 		msg->ver    = x;
@@ -419,6 +723,7 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 				quote = !quote;
 
 			ws = 0;
+			fmt_hdrval_skip(&p, &l);
 			break;
 		}
 	}
@@ -437,6 +742,166 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 }
 
 
+/**
+ * Get the opaque tag of a SIP Message, which is used as the local tag in
+ * responses. The tag is generated on first use.
+ *
+ * @param msg SIP Message
+ *
+ * @return Opaque tag
+ */
+uint64_t sip_msg_tag(const struct sip_msg *msg)
+{
+	struct sip_msgpriv *priv;
+
+	if (!msg || !msg->priv)
+		return 0;
+
+	priv = msg->priv;
+
+	while (!priv->tag)
+		priv->tag = rand_u64();
+
+	return priv->tag;
+}
+
+
+/**
+ * Set the opaque tag of a SIP Message
+ *
+ * @param msg SIP Message
+ * @param tag Opaque tag
+ */
+void sip_msg_tag_set(const struct sip_msg *msg, uint64_t tag)
+{
+	if (!msg || !msg->priv)
+		return;
+
+	msg->priv->tag = tag;
+}
+
+
+static const struct sip_taddr *taddr_get(struct sip_msgpriv *priv,
+					 struct sip_taddr *taddr,
+					 const struct sip_tagval *tv,
+					 unsigned flag)
+{
+	struct sip_addr addr;
+
+	if (priv->dec & flag)
+		return taddr;
+
+	if (!pl_isset(&tv->val) || sip_addr_decode(&addr, &tv->val))
+		return NULL;
+
+	taddr->tag    = tv->tag;
+	taddr->val    = tv->val;
+	taddr->dname  = addr.dname;
+	taddr->auri   = addr.auri;
+	taddr->uri    = addr.uri;
+	taddr->params = addr.params;
+
+	priv->dec |= flag;
+
+	return taddr;
+}
+
+
+/**
+ * Get the decoded To header of a SIP Message. The header is decoded on
+ * first use, only the tag and value are set by sip_msg_decode().
+ *
+ * @param msg SIP Message
+ *
+ * @return Decoded To header, NULL if missing or invalid
+ */
+const struct sip_taddr *sip_msg_to(const struct sip_msg *msg)
+{
+	if (!msg || !msg->priv)
+		return NULL;
+
+	return taddr_get(msg->priv, &msg->priv->to, &msg->to, DEC_TO);
+}
+
+
+/**
+ * Get the decoded From header of a SIP Message. The header is decoded on
+ * first use, only the tag and value are set by sip_msg_decode().
+ *
+ * @param msg SIP Message
+ *
+ * @return Decoded From header, NULL if missing or invalid
+ */
+const struct sip_taddr *sip_msg_from(const struct sip_msg *msg)
+{
+	if (!msg || !msg->priv)
+		return NULL;
+
+	return taddr_get(msg->priv, &msg->priv->from, &msg->from, DEC_FROM);
+}
+
+
+/**
+ * Get the decoded Request-URI of a SIP Request. The URI is decoded on
+ * first use.
+ *
+ * @param msg SIP Message
+ *
+ * @return Decoded Request-URI, NULL if not a request or invalid
+ */
+const struct uri *sip_msg_uri(const struct sip_msg *msg)
+{
+	struct sip_msgpriv *priv;
+
+	if (!msg || !msg->req || !msg->priv)
+		return NULL;
+
+	priv = msg->priv;
+
+	if (priv->dec & DEC_URI)
+		return &priv->uri;
+
+	if (uri_decode(&priv->uri, &msg->ruri))
+		return NULL;
+
+	priv->dec |= DEC_URI;
+
+	return &priv->uri;
+}
+
+
+/**
+ * Get the decoded Content-Type header of a SIP Message. The header is
+ * decoded on first use.
+ *
+ * @param msg SIP Message
+ *
+ * @return Decoded Content-Type, NULL if missing or invalid
+ */
+const struct msg_ctype *sip_msg_ctype(const struct sip_msg *msg)
+{
+	struct sip_msgpriv *priv;
+	const struct sip_hdr *hdr;
+
+	if (!msg || !msg->priv)
+		return NULL;
+
+	priv = msg->priv;
+
+	if (priv->dec & DEC_CTYPE)
+		return &priv->ctyp;
+
+	hdr = sip_msg_hdr_apply(msg, false, SIP_HDR_CONTENT_TYPE,
+				NULL, NULL);
+	if (!hdr || msg_ctype_decode(&priv->ctyp, &hdr->val))
+		return NULL;
+
+	priv->dec |= DEC_CTYPE;
+
+	return &priv->ctyp;
+}
+
+
 /**
  * Get a SIP Header from a SIP Message
  *
@@ -472,7 +937,7 @@ const struct sip_hdr *sip_msg_hdr_apply(const struct sip_msg *msg,
 	if (!msg)
 		return NULL;
 
-	lst = hash_list(msg->hdrht, id);
+	lst = hdrtab_list(msg->priv, id);
 
 	le = fwd ? list_head(lst) : list_tail(lst);
 
@@ -530,7 +995,7 @@ const struct sip_hdr *sip_msg_xhdr_apply(const struct sip_msg *msg,
 
 	pl_set_str(&pl, name);
 
-	lst = hash_list(msg->hdrht, hdr_hash(&pl));
+	lst = hdrtab_list(msg->priv, hdr_hash(&pl));
 
 	le = fwd ? list_head(lst) : list_tail(lst);
 
@@ -657,7 +1122,7 @@ void sip_msg_dump(const struct sip_msg *msg)
 
 	for (i=0; i<HDR_HASH_SIZE; i++) {
 
-		le = list_head(hash_list(msg->hdrht, i));
+		le = list_head(hdrtab_list(msg->priv, i));
 
 		while (le) {
 			const struct sip_hdr *hdr = le->data;
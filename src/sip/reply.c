@@ -3,6 +3,8 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
+#include <strings.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -10,37 +12,117 @@
 #include <re_list.h>
 #include <re_fmt.h>
 #include <re_uri.h>
+#include <re_tmr.h>
 #include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
 #include "sip.h"
 
 
-static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
-		   struct sip *sip, const struct sip_msg *msg, bool rec_route,
-		   uint16_t scode, const char *reason,
-		   const char *fmt, va_list ap)
+/** Defines a pre-formatted SIP response */
+struct sip_rtmpl {
+	struct mbuf *mb;   /**< Status line, then trailing headers and body */
+	size_t split;      /**< Length of the status line                   */
+	uint16_t scode;    /**< Response status code                        */
+};
+
+
+static void tmpl_destructor(void *arg)
+{
+	struct sip_rtmpl *tmpl = arg;
+
+	mem_deref(tmpl->mb);
+}
+
+
+static inline bool is_lws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+
+static int write_dec(struct mbuf *mb, uint32_t v)
+{
+	uint8_t buf[10];
+	size_t i = sizeof(buf);
+
+	do {
+		buf[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	return mbuf_write_mem(mb, &buf[i], sizeof(buf) - i);
+}
+
+
+static int write_x64(struct mbuf *mb, uint64_t v)
+{
+	static const char hex[] = "0123456789abcdef";
+	uint8_t buf[16];
+	size_t i;
+
+	for (i=sizeof(buf); i--; v >>= 4)
+		buf[i] = hex[v & 0xf];
+
+	return mbuf_write_mem(mb, buf, sizeof(buf));
+}
+
+
+static int write_hdr(struct mbuf *mb, const struct sip_hdr *hdr)
 {
-	bool rport = false;
-	uint32_t viac = 0;
-	struct mbuf *mb;
-	struct sa dst;
-	struct le *le;
 	int err;
 
-	if (!sip || !msg || !reason)
-		return EINVAL;
+	err  = mbuf_write_pl(mb, &hdr->name);
+	err |= mbuf_write_mem(mb, (const uint8_t *)": ", 2);
+	err |= mbuf_write_pl(mb, &hdr->val);
 
-	if (!pl_strcmp(&msg->met, "ACK"))
-		return 0;
+	return err;
+}
 
-	mb = mbuf_alloc(1024);
-	if (!mb) {
-		err = ENOMEM;
-		goto out;
+
+/* Find the rport parameter, including any value */
+static bool rport_find(struct pl *rp, const struct pl *params)
+{
+	const char *p = params->p, *end = params->p + params->l;
+	const char *s;
+
+	while (p && (p = memchr(p, ';', end - p))) {
+
+		for (s = p++; p < end && is_lws(*p); p++)
+			;
+
+		if (end - p < 5 || strncasecmp(p, "rport", 5))
+			continue;
+
+		p += 5;
+		if (p < end && *p != ';' && *p != '=' && !is_lws(*p))
+			continue;
+
+		while (p < end && *p != ';')
+			++p;
+
+		rp->p = s;
+		rp->l = p - s;
+
+		return true;
 	}
 
-	err = mbuf_printf(mb, "SIP/2.0 %u %s\r\n", scode, reason);
+	return false;
+}
+
+
+/*
+ * Copy the headers of the request to the response. Only raw byte
+ * ranges of the request are copied, without the printf engine.
+ */
+static int hdrs_encode(struct mbuf *mb, const struct sip_msg *msg,
+		       bool rec_route, uint16_t scode, bool *rportp)
+{
+	char addr[64];
+	bool rport = false;
+	uint32_t viac = 0;
+	struct le *le;
+	int err = 0;
 
 	for (le = msg->hdrl.head; le; le = le->next) {
 
@@ -50,36 +132,44 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 		switch (hdr->id) {
 
 		case SIP_HDR_VIA:
-			err |= mbuf_printf(mb, "%r: ", &hdr->name);
 			if (viac++) {
-				err |= mbuf_printf(mb, "%r\r\n", &hdr->val);
+				err |= write_hdr(mb, hdr);
+				err |= mbuf_write_mem(mb,
+						(const uint8_t *)"\r\n", 2);
 				break;
 			}
 
-			if (!msg_param_exists(&msg->via.params, "rport", &rp)){
+			err |= mbuf_write_pl(mb, &hdr->name);
+			err |= mbuf_write_str(mb, ": ");
+
+			if (rport_find(&rp, &msg->via.params)) {
 				err |= mbuf_write_pl_skip(mb, &hdr->val, &rp);
-				err |= mbuf_printf(mb, ";rport=%u",
-						   sa_port(&msg->src));
+				err |= mbuf_write_str(mb, ";rport=");
+				err |= write_dec(mb, sa_port(&msg->src));
 				rport = true;
 			}
 			else
 				err |= mbuf_write_pl(mb, &hdr->val);
 
 			if (rport || !sa_cmp(&msg->src, &msg->via.addr,
-					     SA_ADDR))
-				err |= mbuf_printf(mb, ";received=%j",
-						   &msg->src);
+					     SA_ADDR)) {
+				if (sa_ntop(&msg->src, addr, sizeof(addr)))
+					str_ncpy(addr, "?", sizeof(addr));
+
+				err |= mbuf_write_str(mb, ";received=");
+				err |= mbuf_write_str(mb, addr);
+			}
 
-			err |= mbuf_write_str(mb, "\r\n");
+			err |= mbuf_write_mem(mb, (const uint8_t *)"\r\n", 2);
 			break;
 
 		case SIP_HDR_TO:
-			err |= mbuf_printf(mb, "%r: %r", &hdr->name,
-					   &hdr->val);
-			if (!pl_isset(&msg->to.tag) && scode > 100)
-				err |= mbuf_printf(mb, ";tag=%016llx",
-						   msg->tag);
-			err |= mbuf_write_str(mb, "\r\n");
+			err |= write_hdr(mb, hdr);
+			if (!pl_isset(&msg->to.tag) && scode > 100) {
+				err |= mbuf_write_str(mb, ";tag=");
+				err |= write_x64(mb, sip_msg_tag(msg));
+			}
+			err |= mbuf_write_mem(mb, (const uint8_t *)"\r\n", 2);
 			break;
 
 		case SIP_HDR_RECORD_ROUTE:
@@ -91,8 +181,8 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 		case SIP_HDR_FROM:
 		case SIP_HDR_CALL_ID:
 		case SIP_HDR_CSEQ:
-			err |= mbuf_printf(mb, "%r: %r\r\n",
-					   &hdr->name, &hdr->val);
+			err |= write_hdr(mb, hdr);
+			err |= mbuf_write_mem(mb, (const uint8_t *)"\r\n", 2);
 			break;
 
 		default:
@@ -100,6 +190,53 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 		}
 	}
 
+	*rportp = rport;
+
+	return err;
+}
+
+
+static int reply_send(struct sip_strans **stp, struct mbuf *mb, bool trans,
+		      struct sip *sip, const struct sip_msg *msg,
+		      uint16_t scode, bool rport)
+{
+	struct sa dst;
+
+	mb->pos = 0;
+
+	sip_reply_addr(&dst, msg, rport);
+
+	if (trans)
+		return sip_strans_reply(stp, sip, msg, &dst, scode, mb);
+	else
+		return sip_send(sip, msg->sock, msg->tp, &dst, mb);
+}
+
+
+static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
+		   struct sip *sip, const struct sip_msg *msg, bool rec_route,
+		   uint16_t scode, const char *reason,
+		   const char *fmt, va_list ap)
+{
+	bool rport = false;
+	struct mbuf *mb;
+	int err;
+
+	if (!sip || !msg || !reason)
+		return EINVAL;
+
+	if (!pl_strcmp(&msg->met, "ACK"))
+		return 0;
+
+	mb = mbuf_alloc(1024);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err  = mbuf_printf(mb, "SIP/2.0 %u %s\r\n", scode, reason);
+	err |= hdrs_encode(mb, msg, rec_route, scode, &rport);
+
 	if (sip->software)
 		err |= mbuf_printf(mb, "Server: %s\r\n", sip->software);
 
@@ -111,16 +248,7 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 	if (err)
 		goto out;
 
-	mb->pos = 0;
-
-	sip_reply_addr(&dst, msg, rport);
-
-	if (trans) {
-		err = sip_strans_reply(stp, sip, msg, &dst, scode, mb);
-	}
-	else {
-		err = sip_send(sip, msg->sock, msg->tp, &dst, mb);
-	}
+	err = reply_send(stp, mb, trans, sip, msg, scode, rport);
 
  out:
 	if (err && stp)
@@ -135,6 +263,49 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 }
 
 
+static int tmpl_reply(struct sip_strans **stp, bool trans, struct sip *sip,
+		      const struct sip_msg *msg, bool rec_route,
+		      const struct sip_rtmpl *tmpl, const struct pl *hdrs)
+{
+	bool rport = false;
+	struct mbuf *mb;
+	int err;
+
+	if (!sip || !msg || !tmpl)
+		return EINVAL;
+
+	if (!pl_strcmp(&msg->met, "ACK"))
+		return 0;
+
+	mb = mbuf_alloc(1024);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err  = mbuf_write_mem(mb, tmpl->mb->buf, tmpl->split);
+	err |= hdrs_encode(mb, msg, rec_route, tmpl->scode, &rport);
+
+	if (hdrs)
+		err |= mbuf_write_pl(mb, hdrs);
+
+	err |= mbuf_write_mem(mb, tmpl->mb->buf + tmpl->split,
+			      tmpl->mb->end - tmpl->split);
+	if (err)
+		goto out;
+
+	err = reply_send(stp, mb, trans, sip, msg, tmpl->scode, rport);
+
+ out:
+	if (err && stp)
+		*stp = mem_deref(*stp);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
 /**
  * Formatted reply using Server Transaction
  *
@@ -226,6 +397,103 @@ int sip_reply(struct sip *sip, const struct sip_msg *msg, uint16_t scode,
 }
 
 
+/**
+ * Allocate a pre-formatted SIP response. Responses are built from the
+ * template by copying headers of the request, without formatting.
+ *
+ * @param tmplp  Pointer to allocated response template
+ * @param sip    SIP Stack instance
+ * @param scode  Response status code
+ * @param reason Response reason phrase
+ * @param fmt    Additional formatted SIP headers and body, otherwise NULL
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_rtmpl_alloc(struct sip_rtmpl **tmplp, const struct sip *sip,
+		    uint16_t scode, const char *reason, const char *fmt, ...)
+{
+	struct sip_rtmpl *tmpl;
+	va_list ap;
+	int err;
+
+	if (!tmplp || !sip || !reason)
+		return EINVAL;
+
+	tmpl = mem_zalloc(sizeof(*tmpl), tmpl_destructor);
+	if (!tmpl)
+		return ENOMEM;
+
+	tmpl->scode = scode;
+
+	tmpl->mb = mbuf_alloc(256);
+	if (!tmpl->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_printf(tmpl->mb, "SIP/2.0 %u %s\r\n", scode, reason);
+
+	tmpl->split = tmpl->mb->end;
+
+	if (sip->software)
+		err |= mbuf_printf(tmpl->mb, "Server: %s\r\n",
+				   sip->software);
+
+	if (fmt) {
+		va_start(ap, fmt);
+		err |= mbuf_vprintf(tmpl->mb, fmt, ap);
+		va_end(ap);
+	}
+	else
+		err |= mbuf_write_str(tmpl->mb, "Content-Length: 0\r\n\r\n");
+
+ out:
+	if (err)
+		mem_deref(tmpl);
+	else
+		*tmplp = tmpl;
+
+	return err;
+}
+
+
+/**
+ * Reply with a pre-formatted response using Server Transaction
+ *
+ * @param stp       Pointer to allocated SIP Server Transaction (optional)
+ * @param sip       SIP Stack instance
+ * @param msg       Incoming SIP message
+ * @param rec_route True to copy Record-Route headers
+ * @param tmpl      Response template
+ * @param hdrs      Raw SIP headers with CRLF to add, otherwise NULL
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_rtmpl_treply(struct sip_strans **stp, struct sip *sip,
+		     const struct sip_msg *msg, bool rec_route,
+		     const struct sip_rtmpl *tmpl, const struct pl *hdrs)
+{
+	return tmpl_reply(stp, true, sip, msg, rec_route, tmpl, hdrs);
+}
+
+
+/**
+ * Stateless reply with a pre-formatted response
+ *
+ * @param sip  SIP Stack instance
+ * @param msg  Incoming SIP message
+ * @param tmpl Response template
+ * @param hdrs Raw SIP headers with CRLF to add, otherwise NULL
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_rtmpl_reply(struct sip *sip, const struct sip_msg *msg,
+		    const struct sip_rtmpl *tmpl, const struct pl *hdrs)
+{
+	return tmpl_reply(NULL, false, sip, msg, false, tmpl, hdrs);
+}
+
+
 /**
  * Get the reply address from a SIP message
  *
@@ -45,6 +45,7 @@ static void destructor(void *arg)
 
 	hash_flush(sip->ht_conn);
 	mem_deref(sip->ht_conn);
+	tmr_cancel(&sip->tmr_conn);
 
 	hash_flush(sip->ht_udpconn);
 	mem_deref(sip->ht_udpconn);
@@ -109,7 +110,7 @@ int sip_alloc(struct sip **sipp, struct dnsc *dnsc, uint32_t ctsz,
 	if (err)
 		goto out;
 
-	err = hash_alloc(&sip->ht_udpconn, tcsz);
+	err = sip_keepalive_udp_init(sip, tcsz);
 	if (err)
 		goto out;
 
@@ -14,11 +14,16 @@ struct sip {
 	struct hash *ht_strans_mrg;
 	struct hash *ht_conn;
 	struct hash *ht_udpconn;
+	struct list connl;
+	struct tmr tmr_conn;
 	struct dnsc *dnsc;
 	struct stun *stun;
 	char *software;
 	sip_exit_h *exith;
 	void *arg;
+	uint32_t rtx_absorbed;
+	uint32_t rtx_decoded;
+	uint32_t rtx_replied;
 	bool closing;
 };
 
@@ -40,6 +45,18 @@ struct sip_keepalive {
 };
 
 
+/* msg */
+struct sip_fp {
+	struct pl met;     /**< Request method       */
+	struct pl branch;  /**< Branch of top Via    */
+	struct pl cmet;    /**< CSeq method          */
+	uint32_t cseq;     /**< CSeq sequence number */
+};
+
+int  sip_msg_fingerprint(struct sip_fp *fp, const struct mbuf *mb);
+void sip_msg_tag_set(const struct sip_msg *msg, uint64_t tag);
+
+
 /* request */
 void sip_request_close(struct sip *sip);
 
@@ -58,6 +75,8 @@ int  sip_ctrans_debug(struct re_printf *pf, const struct sip *sip);
 
 /* strans */
 int  sip_strans_init(struct sip *sip, uint32_t sz);
+bool sip_strans_absorb(struct sip *sip, const struct sip_fp *fp,
+		       const struct sa *src, void *sock);
 int  sip_strans_debug(struct re_printf *pf, const struct sip *sip);
 
 
@@ -96,6 +115,7 @@ void sip_keepalive_signal(struct list *kal, int err);
 uint64_t sip_keepalive_wait(uint32_t interval);
 int  sip_keepalive_tcp(struct sip_keepalive *ka, struct sip_conn *conn,
 		       uint32_t interval);
+int  sip_keepalive_udp_init(struct sip *sip, uint32_t sz);
 int  sip_keepalive_udp(struct sip_keepalive *ka, struct sip *sip,
 		       struct udp_sock *us, const struct sa *paddr,
 		       uint32_t interval);
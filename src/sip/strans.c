@@ -166,12 +166,48 @@ static void retransmit_handler(void *arg)
 }
 
 
+/* Re-send the last response to a retransmitted request */
+static void retransmit_reply(struct sip_strans *st)
+{
+	switch (st->state) {
+
+	case PROCEEDING:
+	case COMPLETED:
+		(void)sip_send(st->sip, st->msg->sock, st->msg->tp, &st->dst,
+			       st->mb);
+		++st->sip->rtx_replied;
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static bool cmp_fp_handler(struct le *le, void *arg)
+{
+	const struct sip_strans *st = le->data;
+	const struct sip_fp *fp = arg;
+
+	if (pl_cmp(&st->msg->via.branch, &fp->branch))
+		return false;
+
+	if (st->msg->cseq.num != fp->cseq)
+		return false;
+
+	if (pl_cmp(&st->msg->cseq.met, &fp->cmet))
+		return false;
+
+	return true;
+}
+
+
 static bool ack_handler(struct sip *sip, const struct sip_msg *msg)
 {
 	struct sip_strans *st;
 
 	st = list_ledata(hash_lookup(sip->ht_strans,
-				     hash_joaat_pl(&msg->via.branch),
+				     hash_fast32_pl(&msg->via.branch),
 				     cmp_ack_handler, (void *)msg));
 	if (!st)
 		return false;
@@ -206,12 +242,12 @@ static bool cancel_handler(struct sip *sip, const struct sip_msg *msg)
 	struct sip_strans *st;
 
 	st = list_ledata(hash_lookup(sip->ht_strans,
-				     hash_joaat_pl(&msg->via.branch),
+				     hash_fast32_pl(&msg->via.branch),
 				     cmp_cancel_handler, (void *)msg));
 	if (!st)
 		return false;
 
-	((struct sip_msg *)msg)->tag = st->msg->tag;
+	sip_msg_tag_set(msg, sip_msg_tag(st->msg));
 
 	(void)sip_reply(sip, msg, 200, "OK");
 
@@ -239,27 +275,17 @@ static bool request_handler(const struct sip_msg *msg, void *arg)
 		return ack_handler(sip, msg);
 
 	st = list_ledata(hash_lookup(sip->ht_strans,
-				     hash_joaat_pl(&msg->via.branch),
+				     hash_fast32_pl(&msg->via.branch),
 				     cmp_handler, (void *)msg));
 	if (st) {
-		switch (st->state) {
-
-		case PROCEEDING:
-		case COMPLETED:
-			(void)sip_send(st->sip, st->msg->sock, st->msg->tp,
-				       &st->dst, st->mb);
-			break;
-
-		default:
-			break;
-		}
-
+		++sip->rtx_decoded;
+		retransmit_reply(st);
 		return true;
 	}
 	else if (!pl_isset(&msg->to.tag)) {
 
 		st = list_ledata(hash_lookup(sip->ht_strans_mrg,
-					     hash_joaat_pl(&msg->callid),
+					     hash_fast32_pl(&msg->callid),
 					     cmp_merge_handler, (void *)msg));
 		if (st) {
 			(void)sip_reply(sip, msg, 482, "Loop Detected");
@@ -298,10 +324,10 @@ int sip_strans_alloc(struct sip_strans **stp, struct sip *sip,
 	if (!st)
 		return ENOMEM;
 
-	hash_append(sip->ht_strans, hash_joaat_pl(&msg->via.branch),
+	hash_append(sip->ht_strans, hash_fast32_pl(&msg->via.branch),
 		    &st->he, st);
 
-	hash_append(sip->ht_strans_mrg, hash_joaat_pl(&msg->callid),
+	hash_append(sip->ht_strans_mrg, hash_fast32_pl(&msg->callid),
 		    &st->he_mrg, st);
 
 	st->invite  = !pl_strcmp(&msg->met, "INVITE");
@@ -399,6 +425,67 @@ int sip_strans_reply(struct sip_strans **stp, struct sip *sip,
 }
 
 
+/**
+ * Absorb a retransmitted request before it is decoded. The fingerprint
+ * and the source address must match a server transaction, and the last
+ * response of the transaction is re-sent.
+ *
+ * @param sip  SIP Stack instance
+ * @param fp   Fingerprint of the request
+ * @param src  Source network address
+ * @param sock Transport socket
+ *
+ * @return True if the request was absorbed, false to decode it
+ */
+bool sip_strans_absorb(struct sip *sip, const struct sip_fp *fp,
+		       const struct sa *src, void *sock)
+{
+	struct sip_strans *st;
+
+	if (!sip || !fp || !src)
+		return false;
+
+	/* ACK changes the state of the transaction */
+	if (!pl_strcmp(&fp->met, "ACK"))
+		return false;
+
+	st = list_ledata(hash_lookup(sip->ht_strans,
+				     hash_fast32_pl(&fp->branch),
+				     cmp_fp_handler, (void *)fp));
+	if (!st)
+		return false;
+
+	if (st->msg->sock != sock || !sa_cmp(&st->msg->src, src, SA_ALL))
+		return false;
+
+	++sip->rtx_absorbed;
+	retransmit_reply(st);
+
+	return true;
+}
+
+
+/*
+ * Transactions are matched on the full branch string, and the INVITE and
+ * CANCEL transactions share one branch, so they stay in a chained hash
+ * with a compare handler rather than an intmap keyed by the hash value
+ */
+static uint32_t strans_key(struct le *le)
+{
+	const struct sip_strans *st = le->data;
+
+	return hash_fast32_pl(&st->msg->via.branch);
+}
+
+
+static uint32_t strans_mrg_key(struct le *le)
+{
+	const struct sip_strans *st = le->data;
+
+	return hash_fast32_pl(&st->msg->callid);
+}
+
+
 int sip_strans_init(struct sip *sip, uint32_t sz)
 {
 	int err;
@@ -407,11 +494,11 @@ int sip_strans_init(struct sip *sip, uint32_t sz)
 	if (err)
 		return err;
 
-	err = hash_alloc(&sip->ht_strans_mrg, sz);
+	err = hash_alloc_resizable(&sip->ht_strans_mrg, sz, strans_mrg_key);
 	if (err)
 		return err;
 
-	return hash_alloc(&sip->ht_strans, sz);
+	return hash_alloc_resizable(&sip->ht_strans, sz, strans_key);
 }
 
 
@@ -451,5 +538,10 @@ int sip_strans_debug(struct re_printf *pf, const struct sip *sip)
 	err = re_hprintf(pf, "server transactions:\n");
 	hash_apply(sip->ht_strans, debug_handler, pf);
 
+	err |= re_hprintf(pf, "retransmitted requests: %u absorbed, "
+			  "%u decoded, %u replies re-sent\n",
+			  sip->rtx_absorbed, sip->rtx_decoded,
+			  sip->rtx_replied);
+
 	return err;
 }
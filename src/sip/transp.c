@@ -45,6 +45,7 @@ struct sip_transport {
 
 struct sip_conn {
 	struct le he;
+	struct le le;
 	struct list ql;
 	struct list kal;
 	struct tmr tmr;
@@ -55,8 +56,12 @@ struct sip_conn {
 	struct tcp_conn *tc;
 	struct mbuf *mb;
 	struct sip *sip;
+	uint64_t active;
 	uint32_t ka_interval;
+	uint32_t nrx;
+	uint32_t ntx;
 	bool established;
+	bool secure;
 };
 
 
@@ -101,6 +106,7 @@ static void conn_destructor(void *arg)
 	list_flush(&conn->kal);
 	list_flush(&conn->ql);
 	hash_unlink(&conn->he);
+	list_unlink(&conn->le);
 	mem_deref(conn->sc);
 	mem_deref(conn->tc);
 	mem_deref(conn->mb);
@@ -143,18 +149,33 @@ static const struct sip_transport *transp_find(struct sip *sip,
 }
 
 
+/* TCP and TLS flows to the same peer are kept in different buckets */
+static inline uint32_t conn_hash(const struct sa *paddr, bool secure)
+{
+	return sa_hash(paddr, SA_ALL) ^ (secure ? 0x9e3779b9 : 0);
+}
+
+
+static uint32_t conn_key(struct le *le)
+{
+	const struct sip_conn *conn = le->data;
+
+	return conn_hash(&conn->paddr, conn->secure);
+}
+
+
 static struct sip_conn *conn_find(struct sip *sip, const struct sa *paddr,
 				  bool secure)
 {
 	struct le *le;
 
-	le = list_head(hash_list(sip->ht_conn, sa_hash(paddr, SA_ALL)));
+	le = list_head(hash_list(sip->ht_conn, conn_hash(paddr, secure)));
 
 	for (; le; le = le->next) {
 
 		struct sip_conn *conn = le->data;
 
-		if (!secure != (conn->sc == NULL))
+		if (conn->secure != secure)
 			continue;
 
 		if (!sa_cmp(&conn->paddr, paddr, SA_ALL))
@@ -176,6 +197,7 @@ static void conn_close(struct sip_conn *conn, int err)
 	tmr_cancel(&conn->tmr_ka);
 	tmr_cancel(&conn->tmr);
 	hash_unlink(&conn->he);
+	list_unlink(&conn->le);
 
 	le = list_head(&conn->ql);
 
@@ -207,6 +229,48 @@ static void conn_tmr_handler(void *arg)
 }
 
 
+/*
+ * The connections are kept in order of activity, and one timer per SIP
+ * stack closes the connections that have been idle for too long
+ */
+static void conn_idle_handler(void *arg)
+{
+	struct sip *sip = arg;
+	const uint64_t now = tmr_jiffies();
+	struct le *le;
+
+	while ((le = sip->connl.head)) {
+
+		struct sip_conn *conn = le->data;
+		uint64_t expire = conn->active + TCP_IDLE_TIMEOUT * 1000;
+
+		if (expire > now) {
+			tmr_start(&sip->tmr_conn, expire - now,
+				  conn_idle_handler, sip);
+			break;
+		}
+
+		conn_close(conn, ETIMEDOUT);
+		mem_deref(conn);
+	}
+}
+
+
+static void conn_active(struct sip_conn *conn)
+{
+	struct sip *sip = conn->sip;
+
+	conn->active = tmr_jiffies();
+
+	list_unlink(&conn->le);
+	list_append(&sip->connl, &conn->le, conn);
+
+	if (!tmr_isrunning(&sip->tmr_conn))
+		tmr_start(&sip->tmr_conn, TCP_IDLE_TIMEOUT * 1000,
+			  conn_idle_handler, sip);
+}
+
+
 static void conn_keepalive_handler(void *arg)
 {
 	struct sip_conn *conn = arg;
@@ -273,6 +337,7 @@ static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 	struct stun_unknown_attr ua;
 	struct stun_msg *stun_msg;
 	struct sip_msg *msg;
+	struct sip_fp fp;
 	int err;
 
 	if (mb->end <= 4)
@@ -306,6 +371,11 @@ static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 		return;
 	}
 
+	/* Retransmitted requests are absorbed without decoding */
+	if (!sip_msg_fingerprint(&fp, mb) &&
+	    sip_strans_absorb(transp->sip, &fp, src, transp->sock))
+		return;
+
 	err = sip_msg_decode(&msg, mb);
 	if (err) {
 		(void)re_fprintf(stderr, "sip: msg decode err: %m\n", err);
@@ -359,8 +429,8 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 
 		if (!memcmp(mbuf_buf(conn->mb), "\r\n", 2)) {
 
-			tmr_start(&conn->tmr, TCP_IDLE_TIMEOUT * 1000,
-				  conn_tmr_handler, conn);
+			tmr_cancel(&conn->tmr);
+			conn_active(conn);
 
 			conn->mb->pos += 2;
 
@@ -411,8 +481,9 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 			break;
 		}
 
-		tmr_start(&conn->tmr, TCP_IDLE_TIMEOUT * 1000,
-			  conn_tmr_handler, conn);
+		tmr_cancel(&conn->tmr);
+		conn_active(conn);
+		++conn->nrx;
 
 		end = conn->mb->end;
 
@@ -477,6 +548,8 @@ static void tcp_estab_handler(void *arg)
 			qent->qentp = NULL;
 		}
 
+		++conn->ntx;
+
 		err = tcp_send(conn->tc, qent->mb);
 		if (err)
 			qent->transph(err, qent->arg);
@@ -508,11 +581,13 @@ static void tcp_connect_handler(const struct sa *paddr, void *arg)
 		goto out;
 	}
 
-	hash_append(transp->sip->ht_conn, sa_hash(paddr, SA_ALL),
-		    &conn->he, conn);
+	conn->paddr  = *paddr;
+	conn->sip    = transp->sip;
+	conn->secure = transp->tls != NULL;
 
-	conn->paddr = *paddr;
-	conn->sip   = transp->sip;
+	hash_append(transp->sip->ht_conn, conn_hash(paddr, conn->secure),
+		    &conn->he, conn);
+	conn_active(conn);
 
 	err = tcp_accept(&conn->tc, transp->sock, tcp_estab_handler,
 			 tcp_recv_handler, tcp_close_handler, conn);
@@ -555,6 +630,8 @@ static int conn_send(struct sip_connqent **qentp, struct sip *sip, bool secure,
 		if (!conn->established)
 			goto enqueue;
 
+		++conn->ntx;
+
 		return tcp_send(conn->tc, mb);
 	}
 
@@ -562,9 +639,12 @@ static int conn_send(struct sip_connqent **qentp, struct sip *sip, bool secure,
 	if (!conn)
 		return ENOMEM;
 
-	hash_append(sip->ht_conn, sa_hash(dst, SA_ALL), &conn->he, conn);
-	conn->paddr = *dst;
-	conn->sip   = sip;
+	conn->paddr  = *dst;
+	conn->sip    = sip;
+	conn->secure = secure;
+
+	hash_append(sip->ht_conn, conn_hash(dst, secure), &conn->he, conn);
+	conn_active(conn);
 
 	err = tcp_connect(&conn->tc, dst, tcp_estab_handler, tcp_recv_handler,
 			  tcp_close_handler, conn);
@@ -591,8 +671,6 @@ static int conn_send(struct sip_connqent **qentp, struct sip *sip, bool secure,
 	}
 #endif
 
-	tmr_start(&conn->tmr, TCP_IDLE_TIMEOUT * 1000, conn_tmr_handler, conn);
-
  enqueue:
 	qent = mem_zalloc(sizeof(*qent), qent_destructor);
 	if (!qent) {
@@ -621,7 +699,7 @@ static int conn_send(struct sip_connqent **qentp, struct sip *sip, bool secure,
 
 int sip_transp_init(struct sip *sip, uint32_t sz)
 {
-	return hash_alloc(&sip->ht_conn, sz);
+	return hash_alloc_resizable(&sip->ht_conn, sz, conn_key);
 }
 
 
@@ -712,6 +790,7 @@ void sip_transp_flush(struct sip *sip)
 		return;
 
 	hash_flush(sip->ht_conn);
+	tmr_cancel(&sip->tmr_conn);
 	list_flush(&sip->transpl);
 }
 
@@ -749,8 +828,10 @@ int sip_transp_send(struct sip_connqent **qentp, struct sip *sip, void *sock,
 	case SIP_TRANSP_TCP:
 		conn = sock;
 
-		if (conn && conn->tc)
+		if (conn && conn->tc) {
+			++conn->ntx;
 			err = tcp_send(conn->tc, mb);
+		}
 		else
 			err = conn_send(qentp, sip, secure, dst, mb,
 					transph, arg);
@@ -924,6 +1005,21 @@ static bool debug_handler(struct le *le, void *arg)
 }
 
 
+static bool conn_debug_handler(struct le *le, void *arg)
+{
+	const struct sip_conn *conn = le->data;
+	struct re_printf *pf = arg;
+
+	(void)re_hprintf(pf, "  %s %J - %J rx=%u tx=%u idle=%llus%s\n",
+			 conn->secure ? "TLS" : "TCP",
+			 &conn->laddr, &conn->paddr, conn->nrx, conn->ntx,
+			 (tmr_jiffies() - conn->active) / 1000,
+			 conn->established ? "" : " (connecting)");
+
+	return false;
+}
+
+
 int sip_transp_debug(struct re_printf *pf, const struct sip *sip)
 {
 	int err;
@@ -931,6 +1027,9 @@ int sip_transp_debug(struct re_printf *pf, const struct sip *sip)
 	err = re_hprintf(pf, "transports:\n");
 	list_apply(&sip->transpl, true, debug_handler, pf);
 
+	err |= re_hprintf(pf, "connections: (%u)\n", list_count(&sip->connl));
+	list_apply(&sip->connl, true, conn_debug_handler, pf);
+
 	return err;
 }
 
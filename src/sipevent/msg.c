@@ -16,14 +16,16 @@
 
 int sipevent_event_decode(struct sipevent_event *se, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct pl param;
 	int err;
 
 	if (!se || !pl)
 		return EINVAL;
 
-	err = re_regex(pl->p, pl->l, "[^; \t\r\n]+[ \t\r\n]*[^]*",
-		       &se->event, NULL, &se->params);
+	err = re_regex_cached(&rx, pl->p, pl->l,
+			      "[^; \t\r\n]+[ \t\r\n]*[^]*",
+			      &se->event, NULL, &se->params);
 	if (err)
 		return EBADMSG;
 
@@ -38,14 +40,15 @@ int sipevent_event_decode(struct sipevent_event *se, const struct pl *pl)
 
 int sipevent_substate_decode(struct sipevent_substate *ss, const struct pl *pl)
 {
+	static struct regex *rx;
 	struct pl state, param;
 	int err;
 
 	if (!ss || !pl)
 		return EINVAL;
 
-	err = re_regex(pl->p, pl->l, "[a-z]+[ \t\r\n]*[^]*",
-		       &state, NULL, &ss->params);
+	err = re_regex_cached(&rx, pl->p, pl->l, "[a-z]+[ \t\r\n]*[^]*",
+			      &state, NULL, &ss->params);
 	if (err)
 		return EBADMSG;
 
@@ -388,7 +388,7 @@ static int sipsub_alloc(struct sipsub **subp, struct sipevent_sock *sock,
 	}
 
 	hash_append(sock->ht_sub,
-		    hash_joaat_str(sip_dialog_callid(sub->dlg)),
+		    hash_fast32_str(sip_dialog_callid(sub->dlg)),
 		    &sub->he, sub);
 
 	err = sip_auth_alloc(&sub->auth, authh, aarg, aref);
@@ -633,7 +633,7 @@ int sipevent_fork(struct sipsub **subp, struct sipsub *osub,
 		goto out;
 
 	hash_append(osub->sock->ht_sub,
-		    hash_joaat_str(sip_dialog_callid(sub->dlg)),
+		    hash_fast32_str(sip_dialog_callid(sub->dlg)),
 		    &sub->he, sub);
 
 	err = sip_auth_alloc(&sub->auth, authh, aarg, aref);
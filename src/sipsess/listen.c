@@ -52,7 +52,7 @@ static struct sipsess *sipsess_find(struct sipsess_sock *sock,
 				    const struct sip_msg *msg)
 {
 	return list_ledata(hash_lookup(sock->ht_sess,
-				       hash_joaat_pl(&msg->callid),
+				       hash_fast32_pl(&msg->callid),
 				       cmp_handler, (void *)msg));
 }
 
@@ -21,6 +21,7 @@
 /** SRTP protocol values */
 enum {
 	MAX_KEYLEN  = 32,  /**< Maximum keylength in bytes     */
+	BATCH_SIZE  = 32,  /**< Packets per cipher call        */
 };
 
 
@@ -80,6 +81,7 @@ static void destructor(void *arg)
 	mem_deref(srtp->rtcp.hmac);
 
 	list_flush(&srtp->streaml);
+	mem_deref(srtp->streams);
 }
 
 
@@ -168,6 +170,10 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 	if (err)
 		goto out;
 
+	err = stream_init(srtp);
+	if (err)
+		goto out;
+
  out:
 	if (err)
 		mem_deref(srtp);
@@ -178,22 +184,14 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 }
 
 
-int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
+/* Get the stream and the packet index of an outgoing packet */
+static int encr_index(struct srtp_stream **strmp, uint64_t *ix,
+		      struct srtp *srtp, struct mbuf *mb)
 {
 	struct srtp_stream *strm;
 	struct rtp_header hdr;
-	struct comp *comp;
-	size_t start;
-	uint64_t ix;
 	int err;
 
-	if (!srtp || !mb)
-		return EINVAL;
-
-	comp = &srtp->rtp;
-
-	start = mb->pos;
-
 	err = rtp_hdr_decode(&hdr, mb);
 	if (err)
 		return err;
@@ -208,7 +206,93 @@ int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 		strm->s_l = 0;
 	}
 
-	ix = 65536ULL * strm->roc + hdr.seq;
+	*ix = 65536ULL * strm->roc + hdr.seq;
+
+	if (hdr.seq > strm->s_l)
+		strm->s_l = hdr.seq;
+
+	*strmp = strm;
+
+	return 0;
+}
+
+
+static int encr_gcm(struct comp *comp, const struct srtp_stream *strm,
+		    struct mbuf *mb, size_t start, uint64_t ix)
+{
+	union vect128 iv;
+	uint8_t *p = mbuf_buf(mb);
+	uint8_t tag[GCM_TAGLEN];
+	int err;
+
+	srtp_iv_calc_gcm(&iv, &comp->k_s, strm->ssrc, ix);
+
+	aes_set_iv(comp->aes, iv.u8);
+
+	/* The RTP Header is Associated Data */
+	err = aes_encr(comp->aes, NULL, &mb->buf[start], mb->pos - start);
+	if (err)
+		return err;
+
+	err = aes_encr(comp->aes, p, p, mbuf_get_left(mb));
+	if (err)
+		return err;
+
+	err = aes_get_authtag(comp->aes, tag, sizeof(tag));
+	if (err)
+		return err;
+
+	mb->pos = mb->end;
+
+	return mbuf_write_mem(mb, tag, sizeof(tag));
+}
+
+
+/* Append the authentication tag of an encrypted packet */
+static int encr_auth(struct comp *comp, uint32_t roc, struct mbuf *mb,
+		     size_t start)
+{
+	const size_t tag_start = mb->end;
+	uint8_t tag[SHA_DIGEST_LENGTH];
+	int err;
+
+	mb->pos = tag_start;
+
+	err = mbuf_write_u32(mb, htonl(roc));
+	if (err)
+		return err;
+
+	mb->pos = start;
+
+	err = hmac_digest(comp->hmac, tag, sizeof(tag),
+			  mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		return err;
+
+	mb->pos = mb->end = tag_start;
+
+	return mbuf_write_mem(mb, tag, comp->tag_len);
+}
+
+
+int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
+{
+	struct srtp_stream *strm;
+	struct comp *comp;
+	size_t start;
+	uint64_t ix;
+	int err;
+
+	if (!srtp || !mb)
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	start = mb->pos;
+
+	err = encr_index(&strm, &ix, srtp, mb);
+	if (err)
+		return err;
 
 	if (comp->aes && comp->mode == AES_MODE_CTR) {
 		union vect128 iv;
@@ -222,84 +306,35 @@ int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 			return err;
 	}
 	else if (comp->aes && comp->mode == AES_MODE_GCM) {
-		union vect128 iv;
-		uint8_t *p = mbuf_buf(mb);
-		uint8_t tag[GCM_TAGLEN];
-
-		srtp_iv_calc_gcm(&iv, &comp->k_s, strm->ssrc, ix);
-
-		aes_set_iv(comp->aes, iv.u8);
 
-		/* The RTP Header is Associated Data */
-		err = aes_encr(comp->aes, NULL, &mb->buf[start],
-			       mb->pos - start);
-		if (err)
-			return err;
-
-		err = aes_encr(comp->aes, p, p, mbuf_get_left(mb));
-		if (err)
-			return err;
-
-		err = aes_get_authtag(comp->aes, tag, sizeof(tag));
-		if (err)
-			return err;
-
-		mb->pos = mb->end;
-		err = mbuf_write_mem(mb, tag, sizeof(tag));
+		err = encr_gcm(comp, strm, mb, start, ix);
 		if (err)
 			return err;
 	}
 
 	if (comp->hmac) {
-		const size_t tag_start = mb->end;
-		uint8_t tag[SHA_DIGEST_LENGTH];
-
-		mb->pos = tag_start;
-
-		err = mbuf_write_u32(mb, htonl(strm->roc));
-		if (err)
-			return err;
-
-		mb->pos = start;
-
-		err = hmac_digest(comp->hmac, tag, sizeof(tag),
-				  mbuf_buf(mb), mbuf_get_left(mb));
-		if (err)
-			return err;
 
-		mb->pos = mb->end = tag_start;
-
-		err = mbuf_write_mem(mb, tag, comp->tag_len);
+		err = encr_auth(comp, strm->roc, mb, start);
 		if (err)
 			return err;
 	}
 
-	if (hdr.seq > strm->s_l)
-		strm->s_l = hdr.seq;
-
 	mb->pos = start;
 
 	return 0;
 }
 
 
-int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
+/* Get the stream, the packet index and the sequence number of an incoming
+   packet */
+static int decr_index(struct srtp_stream **strmp, uint64_t *ix,
+		      uint16_t *seq, struct srtp *srtp, struct mbuf *mb)
 {
 	struct srtp_stream *strm;
 	struct rtp_header hdr;
-	struct comp *comp;
-	uint64_t ix;
-	size_t start;
 	int diff;
 	int err;
 
-	if (!srtp || !mb)
-		return EINVAL;
-
-	comp = &srtp->rtp;
-
-	start = mb->pos;
-
 	err = rtp_hdr_decode(&hdr, mb);
 	if (err)
 		return err;
@@ -318,52 +353,137 @@ int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
 		strm->s_l = 0;
 	}
 
-	ix = srtp_get_index(strm->roc, strm->s_l, hdr.seq);
+	*ix  = srtp_get_index(strm->roc, strm->s_l, hdr.seq);
+	*seq = hdr.seq;
+	*strmp = strm;
 
-	if (comp->hmac) {
-		uint8_t tag_calc[SHA_DIGEST_LENGTH];
-		uint8_t tag_pkt[SHA_DIGEST_LENGTH];
-		size_t pld_start, tag_start;
+	return 0;
+}
 
-		if (mbuf_get_left(mb) < comp->tag_len)
-			return EBADMSG;
 
-		pld_start = mb->pos;
-		tag_start = mb->end - comp->tag_len;
+/* Check and remove the authentication tag of an incoming packet */
+static int decr_auth(struct comp *comp, struct srtp_stream *strm,
+		     struct mbuf *mb, size_t start, uint64_t ix)
+{
+	uint8_t tag_calc[SHA_DIGEST_LENGTH];
+	uint8_t tag_pkt[SHA_DIGEST_LENGTH];
+	size_t pld_start, tag_start;
+	int err;
 
-		mb->pos = tag_start;
+	if (mbuf_get_left(mb) < comp->tag_len)
+		return EBADMSG;
 
-		err = mbuf_read_mem(mb, tag_pkt, comp->tag_len);
-		if (err)
-			return err;
+	pld_start = mb->pos;
+	tag_start = mb->end - comp->tag_len;
 
-		mb->pos = mb->end = tag_start;
+	mb->pos = tag_start;
 
-		err = mbuf_write_u32(mb, htonl(strm->roc));
-		if (err)
-			return err;
+	err = mbuf_read_mem(mb, tag_pkt, comp->tag_len);
+	if (err)
+		return err;
 
-		mb->pos = start;
+	mb->pos = mb->end = tag_start;
 
-		err = hmac_digest(comp->hmac, tag_calc, sizeof(tag_calc),
-				  mbuf_buf(mb), mbuf_get_left(mb));
-		if (err)
-			return err;
+	err = mbuf_write_u32(mb, htonl(strm->roc));
+	if (err)
+		return err;
+
+	mb->pos = start;
+
+	err = hmac_digest(comp->hmac, tag_calc, sizeof(tag_calc),
+			  mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		return err;
 
-		mb->pos = pld_start;
-		mb->end = tag_start;
+	mb->pos = pld_start;
+	mb->end = tag_start;
 
-		if (0 != memcmp(tag_calc, tag_pkt, comp->tag_len))
-			return EAUTH;
+	if (0 != memcmp(tag_calc, tag_pkt, comp->tag_len))
+		return EAUTH;
 
-		/*
-		 * 3.3.2.  Replay Protection
-		 *
-		 * Secure replay protection is only possible when
-		 * integrity protection is present.
-		 */
-		if (!srtp_replay_check(&strm->replay_rtp, ix))
-			return EALREADY;
+	/*
+	 * 3.3.2.  Replay Protection
+	 *
+	 * Secure replay protection is only possible when
+	 * integrity protection is present.
+	 */
+	if (!srtp_replay_check(&strm->replay_rtp, ix))
+		return EALREADY;
+
+	return 0;
+}
+
+
+static int decr_gcm(struct comp *comp, struct srtp_stream *strm,
+		    struct mbuf *mb, size_t start, uint64_t ix)
+{
+	union vect128 iv;
+	uint8_t *p = mbuf_buf(mb);
+	size_t tag_start;
+	int err;
+
+	srtp_iv_calc_gcm(&iv, &comp->k_s, strm->ssrc, ix);
+
+	aes_set_iv(comp->aes, iv.u8);
+
+	/* The RTP Header is Associated Data */
+	err = aes_decr(comp->aes, NULL, &mb->buf[start], mb->pos - start);
+	if (err)
+		return err;
+
+	if (mbuf_get_left(mb) < GCM_TAGLEN)
+		return EBADMSG;
+
+	tag_start = mb->end - GCM_TAGLEN;
+
+	err = aes_decr(comp->aes, p, p, tag_start - mb->pos);
+	if (err)
+		return err;
+
+	err = aes_authenticate(comp->aes, &mb->buf[tag_start], GCM_TAGLEN);
+	if (err)
+		return err;
+
+	mb->end = tag_start;
+
+	/*
+	 * 3.3.2.  Replay Protection
+	 *
+	 * Secure replay protection is only possible when
+	 * integrity protection is present.
+	 */
+	if (!srtp_replay_check(&strm->replay_rtp, ix))
+		return EALREADY;
+
+	return 0;
+}
+
+
+int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
+{
+	struct srtp_stream *strm;
+	struct comp *comp;
+	uint64_t ix;
+	size_t start;
+	uint16_t seq;
+	int err;
+
+	if (!srtp || !mb)
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	start = mb->pos;
+
+	err = decr_index(&strm, &ix, &seq, srtp, mb);
+	if (err)
+		return err;
+
+	if (comp->hmac) {
+
+		err = decr_auth(comp, strm, mb, start, ix);
+		if (err)
+			return err;
 	}
 
 	if (comp->aes && comp->mode == AES_MODE_CTR) {
@@ -380,51 +500,202 @@ int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
 	}
 	else if (comp->aes && comp->mode == AES_MODE_GCM) {
 
-		union vect128 iv;
-		uint8_t *p = mbuf_buf(mb);
-		size_t tag_start;
+		err = decr_gcm(comp, strm, mb, start, ix);
+		if (err)
+			return err;
+	}
 
-		srtp_iv_calc_gcm(&iv, &comp->k_s, strm->ssrc, ix);
+	if (seq > strm->s_l)
+		strm->s_l = seq;
 
-		aes_set_iv(comp->aes, iv.u8);
+	mb->pos = start;
 
-		/* The RTP Header is Associated Data */
-		err = aes_decr(comp->aes, NULL, &mb->buf[start],
-			       mb->pos - start);
-		if (err)
-			return err;
+	return 0;
+}
 
-		if (mbuf_get_left(mb) < GCM_TAGLEN)
-			return EBADMSG;
 
-		tag_start = mb->end - GCM_TAGLEN;
+static inline void batch_result(int *errv, size_t i, int err, int *errp)
+{
+	if (errv)
+		errv[i] = err;
 
-		err = aes_decr(comp->aes, p, p, tag_start - mb->pos);
-		if (err)
-			return err;
+	if (err && !*errp)
+		*errp = err;
+}
 
-		err = aes_authenticate(comp->aes, &mb->buf[tag_start],
-				       GCM_TAGLEN);
-		if (err)
-			return err;
 
-		mb->end = tag_start;
+/**
+ * Encrypt a batch of SRTP packets. In Counter mode, the payloads of all
+ * packets are encrypted with one call to the cipher.
+ *
+ * @param srtp SRTP session
+ * @param mbv  Packets, encrypted in place
+ * @param errv Optional returned error codes, one per packet
+ * @param n    Number of packets
+ *
+ * @return 0 if success, otherwise errorcode of the first failed packet
+ */
+int srtp_encrypt_batch(struct srtp *srtp, struct mbuf **mbv, int *errv,
+		       size_t n)
+{
+	struct aes_ctr_buf bufv[BATCH_SIZE];
+	union vect128 ivv[BATCH_SIZE];
+	size_t startv[BATCH_SIZE], idxv[BATCH_SIZE];
+	uint32_t rocv[BATCH_SIZE];
+	struct comp *comp;
+	size_t i, j, k, m;
+	int err = 0;
 
-		/*
-		 * 3.3.2.  Replay Protection
-		 *
-		 * Secure replay protection is only possible when
-		 * integrity protection is present.
-		 */
-		if (!srtp_replay_check(&strm->replay_rtp, ix))
-			return EALREADY;
+	if (!srtp || (!mbv && n))
+		return EINVAL;
 
+	comp = &srtp->rtp;
+
+	if (!comp->aes || comp->mode != AES_MODE_CTR) {
+
+		for (i=0; i<n; i++)
+			batch_result(errv, i, srtp_encrypt(srtp, mbv[i]),
+				     &err);
+
+		return err;
 	}
 
-	if (hdr.seq > strm->s_l)
-		strm->s_l = hdr.seq;
+	for (i=0; i<n; i+=j) {
 
-	mb->pos = start;
+		int e;
 
-	return 0;
+		/* Stream and IV of each packet, in order */
+		for (j=0, m=0; j<BATCH_SIZE && i+j<n; j++) {
+
+			struct mbuf *mb = mbv[i+j];
+			struct srtp_stream *strm;
+			uint64_t ix;
+
+			if (!mb) {
+				batch_result(errv, i+j, EINVAL, &err);
+				continue;
+			}
+
+			startv[m] = mb->pos;
+
+			e = encr_index(&strm, &ix, srtp, mb);
+			if (e) {
+				mb->pos = startv[m];
+				batch_result(errv, i+j, e, &err);
+				continue;
+			}
+
+			/* The ROC may change with the next packets */
+			srtp_iv_calc(&ivv[m], &comp->k_s, strm->ssrc, ix);
+			rocv[m] = strm->roc;
+
+			bufv[m].iv   = ivv[m].u8;
+			bufv[m].data = mbuf_buf(mb);
+			bufv[m].len  = mbuf_get_left(mb);
+			idxv[m++]    = i+j;
+		}
+
+		e = aes_ctr_batch(comp->aes, bufv, m);
+
+		for (k=0; k<m; k++) {
+
+			struct mbuf *mb = mbv[idxv[k]];
+			int ek = e;
+
+			if (!ek && comp->hmac)
+				ek = encr_auth(comp, rocv[k], mb, startv[k]);
+
+			mb->pos = startv[k];
+			batch_result(errv, idxv[k], ek, &err);
+		}
+	}
+
+	return err;
+}
+
+
+/**
+ * Decrypt a batch of SRTP packets. In Counter mode, the payloads of all
+ * authenticated packets are decrypted with one call to the cipher.
+ *
+ * @param srtp SRTP session
+ * @param mbv  Packets, decrypted in place
+ * @param errv Optional returned error codes, one per packet
+ * @param n    Number of packets
+ *
+ * @return 0 if success, otherwise errorcode of the first failed packet
+ */
+int srtp_decrypt_batch(struct srtp *srtp, struct mbuf **mbv, int *errv,
+		       size_t n)
+{
+	struct aes_ctr_buf bufv[BATCH_SIZE];
+	union vect128 ivv[BATCH_SIZE];
+	size_t startv[BATCH_SIZE], idxv[BATCH_SIZE];
+	struct comp *comp;
+	size_t i, j, k, m;
+	int err = 0;
+
+	if (!srtp || (!mbv && n))
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	if (!comp->aes || comp->mode != AES_MODE_CTR) {
+
+		for (i=0; i<n; i++)
+			batch_result(errv, i, srtp_decrypt(srtp, mbv[i]),
+				     &err);
+
+		return err;
+	}
+
+	for (i=0; i<n; i+=j) {
+
+		int e;
+
+		/* Authenticate each packet, in order */
+		for (j=0, m=0; j<BATCH_SIZE && i+j<n; j++) {
+
+			struct mbuf *mb = mbv[i+j];
+			struct srtp_stream *strm;
+			uint64_t ix;
+			uint16_t seq;
+
+			if (!mb) {
+				batch_result(errv, i+j, EINVAL, &err);
+				continue;
+			}
+
+			startv[m] = mb->pos;
+
+			e = decr_index(&strm, &ix, &seq, srtp, mb);
+			if (!e && comp->hmac)
+				e = decr_auth(comp, strm, mb, startv[m], ix);
+			if (e) {
+				mb->pos = startv[m];
+				batch_result(errv, i+j, e, &err);
+				continue;
+			}
+
+			if (seq > strm->s_l)
+				strm->s_l = seq;
+
+			srtp_iv_calc(&ivv[m], &comp->k_s, strm->ssrc, ix);
+
+			bufv[m].iv   = ivv[m].u8;
+			bufv[m].data = mbuf_buf(mb);
+			bufv[m].len  = mbuf_get_left(mb);
+			idxv[m++]    = i+j;
+		}
+
+		e = aes_ctr_batch(comp->aes, bufv, m);
+
+		for (k=0; k<m; k++) {
+
+			mbv[idxv[k]]->pos = startv[k];
+			batch_result(errv, idxv[k], e, &err);
+		}
+	}
+
+	return err;
 }
@@ -28,6 +28,8 @@ struct replay {
 /** SRTP stream/context -- shared state between RTP/RTCP */
 struct srtp_stream {
 	struct le le;              /**< Linked-list element                */
+	struct srtp *srtp;         /**< Parent SRTP session                */
+	uint64_t used;             /**< Last use [ms], for idle eviction   */
 	struct replay replay_rtp;  /**< recv -- replay protection for RTP  */
 	struct replay replay_rtcp; /**< recv -- replay protection for RTCP */
 	uint32_t ssrc;             /**< SSRC -- lookup key                 */
@@ -48,9 +50,14 @@ struct srtp {
 	} rtp, rtcp;
 
 	struct list streaml;        /**< SRTP-streams (struct srtp_stream) */
+	struct intmap *streams;     /**< SRTP-streams indexed by SSRC      */
+	struct srtp_stream *last;   /**< Last used stream                  */
+	uint32_t max_streams;       /**< Maximum number of streams         */
+	uint32_t idle;              /**< Idle timeout of streams [ms]      */
 };
 
 
+int stream_init(struct srtp *srtp);
 int stream_get(struct srtp_stream **strmp, struct srtp *srtp, uint32_t ssrc);
 int stream_get_seq(struct srtp_stream **strmp, struct srtp *srtp,
 		   uint32_t ssrc, uint16_t seq);
@@ -7,6 +7,8 @@
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_hash.h>
+#include <re_tmr.h>
 #include <re_aes.h>
 #include <re_srtp.h>
 #include "srtp.h"
@@ -22,23 +24,49 @@ static void stream_destructor(void *arg)
 {
 	struct srtp_stream *strm = arg;
 
+	/* Only linked after it was added to the map */
+	if (!strm->le.list)
+		return;
+
+	if (strm->srtp->last == strm)
+		strm->srtp->last = NULL;
+
+	intmap_remove(strm->srtp->streams, strm->ssrc);
 	list_unlink(&strm->le);
 }
 
 
+/* The last used stream is checked first, most packets are of one SSRC */
 static struct srtp_stream *stream_find(struct srtp *srtp, uint32_t ssrc)
 {
-	struct le *le;
+	struct srtp_stream *strm = srtp->last;
+
+	if (strm && strm->ssrc == ssrc)
+		return strm;
+
+	strm = intmap_find(srtp->streams, ssrc);
+	if (strm)
+		srtp->last = strm;
+
+	return strm;
+}
 
-	for (le = srtp->streaml.head; le; le = le->next) {
+
+/* Remove the streams that were not used within the idle timeout */
+static void stream_evict(struct srtp *srtp)
+{
+	const uint64_t now = tmr_jiffies();
+	struct le *le = srtp->streaml.head;
+
+	while (le) {
 
 		struct srtp_stream *strm = le->data;
 
-		if (strm->ssrc == ssrc)
-			return strm;
-	}
+		le = le->next;
 
-	return NULL;
+		if (now - strm->used >= srtp->idle)
+			mem_deref(strm);
+	}
 }
 
 
@@ -46,20 +74,34 @@ static int stream_new(struct srtp_stream **strmp, struct srtp *srtp,
 		      uint32_t ssrc)
 {
 	struct srtp_stream *strm;
+	int err;
+
+	if (srtp->idle && intmap_count(srtp->streams) >= srtp->max_streams)
+		stream_evict(srtp);
 
-	if (list_count(&srtp->streaml) >= SRTP_MAX_STREAMS)
+	if (intmap_count(srtp->streams) >= srtp->max_streams)
 		return ENOSR;
 
 	strm = mem_zalloc(sizeof(*strm), stream_destructor);
 	if (!strm)
 		return ENOMEM;
 
+	err = intmap_add(srtp->streams, ssrc, strm);
+	if (err) {
+		mem_deref(strm);
+		return err;
+	}
+
+	strm->srtp = srtp;
 	strm->ssrc = ssrc;
+	strm->used = tmr_jiffies();
 	srtp_replay_init(&strm->replay_rtp);
 	srtp_replay_init(&strm->replay_rtcp);
 
 	list_append(&srtp->streaml, &strm->le, strm);
 
+	srtp->last = strm;
+
 	if (strmp)
 		*strmp = strm;
 
@@ -67,6 +109,14 @@ static int stream_new(struct srtp_stream **strmp, struct srtp *srtp,
 }
 
 
+int stream_init(struct srtp *srtp)
+{
+	srtp->max_streams = SRTP_MAX_STREAMS;
+
+	return intmap_alloc(&srtp->streams, SRTP_MAX_STREAMS);
+}
+
+
 int stream_get(struct srtp_stream **strmp, struct srtp *srtp, uint32_t ssrc)
 {
 	struct srtp_stream *strm;
@@ -76,6 +126,9 @@ int stream_get(struct srtp_stream **strmp, struct srtp *srtp, uint32_t ssrc)
 
 	strm = stream_find(srtp, ssrc);
 	if (strm) {
+		/* Also without an idle timeout, which may be set later */
+		strm->used = tmr_jiffies();
+
 		*strmp = strm;
 		return 0;
 	}
@@ -107,3 +160,39 @@ int stream_get_seq(struct srtp_stream **strmp, struct srtp *srtp,
 
 	return 0;
 }
+
+
+/**
+ * Set the stream limits of an SRTP session. A new stream replaces the
+ * streams that were idle for the idle timeout, if there are too many.
+ *
+ * @param srtp        SRTP session
+ * @param max_streams Maximum number of streams (SSRCs)
+ * @param idle        Idle timeout of streams in [ms], 0 to never replace
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_set_stream_limit(struct srtp *srtp, uint32_t max_streams,
+			  uint32_t idle)
+{
+	if (!srtp || !max_streams)
+		return EINVAL;
+
+	srtp->max_streams = max_streams;
+	srtp->idle        = idle;
+
+	return 0;
+}
+
+
+/**
+ * Get the number of streams of an SRTP session
+ *
+ * @param srtp SRTP session
+ *
+ * @return Number of streams
+ */
+uint32_t srtp_stream_count(const struct srtp *srtp)
+{
+	return srtp ? intmap_count(srtp->streams) : 0;
+}
@@ -95,7 +95,7 @@ int stun_msg_decode(struct stun_msg **msgpp, struct mbuf *mb,
 		return err;
 	}
 
-	msg = mem_zalloc(sizeof(*msg), destructor);
+	msg = mem_pool_alloc(sizeof(*msg), destructor);
 	if (!msg) {
 		mb->pos = start;
 		return ENOMEM;
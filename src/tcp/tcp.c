@@ -102,6 +102,16 @@ struct tcp_qent {
 static void tcp_recv_handler(int flags, void *arg);
 
 
+/*
+ * Connections are polled edge-triggered if enabled, except when a send
+ * handler is set, which needs to be called while the socket is writable.
+ */
+static inline int conn_flags(const struct tcp_conn *tc, int flags)
+{
+	return tc->sendh ? flags : flags | FD_EDGE;
+}
+
+
 static bool helper_estab_handler(int *err, bool active, void *arg)
 {
 	(void)err;
@@ -186,7 +196,7 @@ static int enqueue(struct tcp_conn *tc, struct mbuf *mb)
 
 	if (!tc->sendq.head && !tc->sendh) {
 
-		err = fd_listen(tc->fdc, FD_READ | FD_WRITE,
+		err = fd_listen(tc->fdc, conn_flags(tc, FD_READ | FD_WRITE),
 				tcp_recv_handler, tc);
 		if (err)
 			return err;
@@ -212,6 +222,7 @@ static int enqueue(struct tcp_conn *tc, struct mbuf *mb)
 }
 
 
+/* Send from the queue, returns EAGAIN if the socket would block */
 static int dequeue(struct tcp_conn *tc)
 {
 	struct tcp_qent *qe = list_ledata(tc->sendq.head);
@@ -231,11 +242,9 @@ static int dequeue(struct tcp_conn *tc)
 	n = send(tc->fdc, BUF_CAST mbuf_buf(&qe->mb),
 		 qe->mb.end - qe->mb.pos, flags);
 	if (n < 0) {
-		if (EAGAIN == errno)
-			return 0;
 #ifdef WIN32
 		if (WSAEWOULDBLOCK == WSAGetLastError())
-			return 0;
+			return EAGAIN;
 #endif
 		return errno;
 	}
@@ -267,14 +276,116 @@ static void conn_close(struct tcp_conn *tc, int err)
 }
 
 
-static void tcp_recv_handler(int flags, void *arg)
+/* Read one chunk of data, returns true if more data may be pending */
+static bool conn_read(struct tcp_conn *tc)
 {
-	struct tcp_conn *tc = arg;
-	struct mbuf *mb = NULL;
+	struct mbuf *mb;
 	bool hlp_estab = false;
+	bool more = false;
+	uint32_t nrefs;
 	struct le *le;
 	ssize_t n;
 	int err;
+
+	mb = mbuf_alloc(tc->rxsz);
+	if (!mb)
+		return false;
+
+	n = recv(tc->fdc, BUF_CAST mb->buf, mb->size, 0);
+	if (0 == n) {
+		mem_deref(mb);
+		conn_close(tc, 0);
+		return false;
+	}
+	else if (n < 0) {
+		if (EAGAIN != errno)
+			DEBUG_WARNING("recv handler: recv(): %m\n", errno);
+		goto out;
+	}
+
+	mb->end = n;
+	more = ((size_t)n == mb->size);
+
+	le = tc->helpers.head;
+	while (le) {
+		struct tcp_helper *th = le->data;
+		bool hdld = false;
+
+		le = le->next;
+
+		if (hlp_estab) {
+
+			hdld |= th->estabh(&err, tc->active, th->arg);
+			if (err) {
+				conn_close(tc, err);
+				more = false;
+				goto out;
+			}
+		}
+
+		if (mb->pos < mb->end) {
+
+		        hdld |= th->recvh(&err, mb, &hlp_estab, th->arg);
+			if (err) {
+				conn_close(tc, err);
+				more = false;
+				goto out;
+			}
+		}
+
+		if (hdld)
+			goto out;
+	}
+
+	mbuf_trim(mb);
+
+	if (hlp_estab && tc->estabh) {
+
+		mem_ref(tc);
+
+		tc->estabh(tc->arg);
+
+		nrefs = mem_nrefs(tc);
+		mem_deref(tc);
+
+		/* check if connection was deref'ed from establish handler */
+		if (nrefs == 1) {
+			more = false;
+			goto out;
+		}
+	}
+
+	if (mb->pos < mb->end && tc->recvh) {
+
+		if (!more) {
+			tc->recvh(mb, tc->arg);
+			goto out;
+		}
+
+		mem_ref(tc);
+
+		tc->recvh(mb, tc->arg);
+
+		nrefs = mem_nrefs(tc);
+		mem_deref(tc);
+
+		/* check if connection was deref'ed from receive handler */
+		if (nrefs == 1)
+			more = false;
+	}
+
+ out:
+	mem_deref(mb);
+
+	return more;
+}
+
+
+static void tcp_recv_handler(int flags, void *arg)
+{
+	struct tcp_conn *tc = arg;
+	struct le *le;
+	int err;
 	socklen_t err_len = sizeof(err);
 
 	if (flags & FD_EXCEPT) {
@@ -307,7 +418,11 @@ static void tcp_recv_handler(int flags, void *arg)
 
 			mem_ref(tc);
 
-			err = dequeue(tc);
+			/* edge-triggered: send until the socket would block */
+			do {
+				err = dequeue(tc);
+
+			} while (!err && (flags & FD_EDGE) && tc->sendq.head);
 
 			nrefs = mem_nrefs(tc);
 			mem_deref(tc);
@@ -316,6 +431,9 @@ static void tcp_recv_handler(int flags, void *arg)
 			if (nrefs == 1)
 				return;
 
+			if (EAGAIN == err)
+				err = 0;
+
 			if (err) {
 				conn_close(tc, err);
 				return;
@@ -323,7 +441,8 @@ static void tcp_recv_handler(int flags, void *arg)
 
 			if (!tc->sendq.head && !tc->sendh) {
 
-				err = fd_listen(tc->fdc, FD_READ,
+				err = fd_listen(tc->fdc,
+						conn_flags(tc, FD_READ),
 						tcp_recv_handler, tc);
 				if (err) {
 					conn_close(tc, err);
@@ -339,7 +458,8 @@ static void tcp_recv_handler(int flags, void *arg)
 
 		tc->connected = true;
 
-		err = fd_listen(tc->fdc, FD_READ, tcp_recv_handler, tc);
+		err = fd_listen(tc->fdc, conn_flags(tc, FD_READ),
+				tcp_recv_handler, tc);
 		if (err) {
 			DEBUG_WARNING("recv handler: fd_listen(): %m\n", err);
 			conn_close(tc, err);
@@ -359,83 +479,33 @@ static void tcp_recv_handler(int flags, void *arg)
 			}
 		}
 
-		if (tc->estabh)
-			tc->estabh(tc->arg);
-
-		return;
-	}
+		if (tc->estabh) {
 
- read:
-	mb = mbuf_alloc(tc->rxsz);
-	if (!mb)
-		return;
-
-	n = recv(tc->fdc, BUF_CAST mb->buf, mb->size, 0);
-	if (0 == n) {
-		mem_deref(mb);
-		conn_close(tc, 0);
-		return;
-	}
-	else if (n < 0) {
-		DEBUG_WARNING("recv handler: recv(): %m\n", errno);
-		goto out;
-	}
-
-	mb->end = n;
-
-	le = tc->helpers.head;
-	while (le) {
-		struct tcp_helper *th = le->data;
-		bool hdld = false;
-
-		le = le->next;
+			uint32_t nrefs;
 
-		if (hlp_estab) {
+			mem_ref(tc);
 
-			hdld |= th->estabh(&err, tc->active, th->arg);
-			if (err) {
-				conn_close(tc, err);
-				goto out;
-			}
-		}
+			tc->estabh(tc->arg);
 
-		if (mb->pos < mb->end) {
+			nrefs = mem_nrefs(tc);
+			mem_deref(tc);
 
-		        hdld |= th->recvh(&err, mb, &hlp_estab, th->arg);
-			if (err) {
-				conn_close(tc, err);
-				goto out;
-			}
+			/* check if connection was deref'd from handler */
+			if (nrefs == 1)
+				return;
 		}
 
-		if (hdld)
-			goto out;
-	}
-
-	mbuf_trim(mb);
-
-	if (hlp_estab && tc->estabh) {
-
-		uint32_t nrefs;
+		/* edge-triggered: data that came with the connect edge */
+		if (flags & FD_READ)
+			goto read;
 
-		mem_ref(tc);
-
-		tc->estabh(tc->arg);
-
-		nrefs = mem_nrefs(tc);
-		mem_deref(tc);
-
-		/* check if connection was deref'ed from establish handler */
-		if (nrefs == 1)
-			goto out;
-	}
-
-	if (mb->pos < mb->end && tc->recvh) {
-		tc->recvh(mb, tc->arg);
+		return;
 	}
 
- out:
-	mem_deref(mb);
+ read:
+	/* edge-triggered: read until the socket is drained */
+	while (conn_read(tc) && (flags & FD_EDGE))
+		;
 }
 
 
@@ -771,7 +841,8 @@ int tcp_accept(struct tcp_conn **tcp, struct tcp_sock *ts, tcp_estab_h *eh,
 	tc->fdc = ts->fdc;
 	ts->fdc = -1;
 
-	err = fd_listen(tc->fdc, FD_READ | FD_WRITE | FD_EXCEPT,
+	err = fd_listen(tc->fdc,
+			conn_flags(tc, FD_READ | FD_WRITE | FD_EXCEPT),
 			tcp_recv_handler, tc);
 	if (err) {
 		DEBUG_WARNING("accept: fd_listen(): %m\n", err);
@@ -1043,7 +1114,8 @@ int tcp_conn_connect(struct tcp_conn *tc, const struct sa *peer)
 	if (err)
 		return err;
 
-	return fd_listen(tc->fdc, FD_READ | FD_WRITE | FD_EXCEPT,
+	return fd_listen(tc->fdc,
+			 conn_flags(tc, FD_READ | FD_WRITE | FD_EXCEPT),
 			 tcp_recv_handler, tc);
 }
 
@@ -1168,9 +1240,10 @@ int tcp_set_send(struct tcp_conn *tc, tcp_send_h *sendh)
 
 	tc->sendh = sendh;
 
-	if (tc->sendq.head || !sendh)
+	if (!sendh)
 		return 0;
 
+	/* the send handler needs level-triggered write events */
 	return fd_listen(tc->fdc, FD_READ | FD_WRITE, tcp_recv_handler, tc);
 }
 
@@ -5,3 +5,9 @@
 #
 
 SRCS	+= tmr/tmr.c
+
+# Timer backend. The hierarchical timing wheel is the default,
+# set USE_TMR_LIST to use the sorted timer list instead.
+ifeq ($(USE_TMR_LIST),)
+CFLAGS  += -DUSE_TMR_WHEEL
+endif
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#define _DEFAULT_SOURCE 1
 #include <string.h>
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
@@ -12,8 +13,8 @@
 #else
 #include <time.h>
 #endif
-#ifdef HAVE_PTHREAD
 #include <stdlib.h>
+#ifdef HAVE_PTHREAD
 #include <pthread.h>
 #endif
 #include <re_types.h>
@@ -21,6 +22,7 @@
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_tmr.h>
+#include "../main/main.h"
 
 
 #define DEBUG_MODULE "tmr"
@@ -37,7 +39,272 @@ enum {
 	MAX_BLOCKING = 100   /**< Maximum time spent in handler [ms] */
 };
 
-extern struct list *tmrl_get(void);
+
+#ifdef USE_TMR_WHEEL
+
+/*
+ * Hierarchical timing wheel
+ *
+ * The wheel has one level of 256 slots with a resolution of 1 [ms],
+ * followed by 4 levels of 64 slots each, covering 2^32 [ms] in total.
+ * Starting and cancelling a timer is O(1). When the lowest level wraps,
+ * the next slot of the level above is cascaded down. Expired timers are
+ * moved to the timer-list of the thread, where they are called in order.
+ */
+
+/** Timer wheel values */
+enum {
+	TVR_BITS   = 8,
+	TVN_BITS   = 6,
+	TVR_SIZE   = 1 << TVR_BITS,
+	TVN_SIZE   = 1 << TVN_BITS,
+	TVR_MASK   = TVR_SIZE - 1,
+	TVN_MASK   = TVN_SIZE - 1,
+	TVN_LEVELS = 4,
+};
+
+/** Defines a hierarchical timing wheel */
+struct tmrw {
+	struct list tv1[TVR_SIZE];              /**< Lowest level slots   */
+	struct list tvn[TVN_LEVELS][TVN_SIZE];  /**< Upper level slots    */
+	uint64_t bm1[TVR_SIZE / 64];            /**< Non-empty tv1 slots  */
+	uint64_t bmn[TVN_LEVELS];               /**< Non-empty tvn slots  */
+	uint64_t jfs;                           /**< Next jiffy to expire */
+};
+
+
+static inline unsigned bit_ctz(uint64_t v)
+{
+#if defined(__GNUC__)
+	return (unsigned)__builtin_ctzll(v);
+#else
+	unsigned n = 0;
+
+	while (!(v & 1)) {
+		v >>= 1;
+		++n;
+	}
+
+	return n;
+#endif
+}
+
+
+/*
+ * Find the first set bit in a bitmap of nbits, searching circularly
+ * from position pos. Returns the distance from pos, or -1 if no bits set.
+ */
+static int bitmap_find(const uint64_t *bm, unsigned nbits, unsigned pos)
+{
+	unsigned i = 0;
+
+	while (i < nbits) {
+		const unsigned bit = (pos + i) & (nbits - 1);
+		const uint64_t v = bm[bit / 64] >> (bit % 64);
+
+		if (v)
+			return (int)(i + bit_ctz(v));
+
+		i += 64 - bit % 64;
+	}
+
+	return -1;
+}
+
+
+static struct tmrw *tmrw_lookup(bool create)
+{
+	struct tmrw **wp = tmrw_get();
+
+	if (!*wp && create) {
+
+		*wp = calloc(1, sizeof(**wp));
+		if (!*wp) {
+			DEBUG_WARNING("could not allocate timer wheel\n");
+			return NULL;
+		}
+
+		(*wp)->jfs = tmr_jiffies();
+	}
+
+	return *wp;
+}
+
+
+static void tmrw_insert(struct tmrw *w, struct tmr *tmr)
+{
+	uint64_t expires = tmr->jfs;
+	uint64_t idx;
+	unsigned i, lvl, shift;
+
+	if (expires < w->jfs) {
+		/* already expired, add to the next slot to expire */
+		i = w->jfs & TVR_MASK;
+		goto tv1;
+	}
+
+	idx = expires - w->jfs;
+	if (idx < TVR_SIZE) {
+		i = expires & TVR_MASK;
+		goto tv1;
+	}
+
+	for (lvl=0; lvl<TVN_LEVELS-1; lvl++) {
+		if (idx < (uint64_t)1 << (TVR_BITS + (lvl+1)*TVN_BITS))
+			break;
+	}
+
+	if (idx > 0xffffffffULL)
+		expires = w->jfs + 0xffffffffULL;
+
+	shift = TVR_BITS + lvl*TVN_BITS;
+	i = (expires >> shift) & TVN_MASK;
+
+	list_append(&w->tvn[lvl][i], &tmr->le, tmr);
+	w->bmn[lvl] |= (uint64_t)1 << i;
+	return;
+
+ tv1:
+	list_append(&w->tv1[i], &tmr->le, tmr);
+	w->bm1[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+
+static void tmrw_cascade(struct tmrw *w, unsigned lvl, unsigned i)
+{
+	struct list *tv = &w->tvn[lvl][i];
+	struct le *le;
+
+	w->bmn[lvl] &= ~((uint64_t)1 << i);
+
+	while ((le = tv->head)) {
+
+		list_unlink(le);
+		tmrw_insert(w, le->data);
+	}
+}
+
+
+/*
+ * Advance the wheel up to and including jiffy 'now', and move all
+ * expired timers to the timer-list.
+ */
+static void tmrw_expire(struct tmrw *w, struct list *tmrl, uint64_t now)
+{
+	while (w->jfs <= now) {
+
+		const unsigned i = w->jfs & TVR_MASK;
+		struct list *tv = &w->tv1[i];
+		struct le *le;
+		int d;
+
+		if (i == 0) {
+			unsigned lvl;
+
+			for (lvl=0; lvl<TVN_LEVELS; lvl++) {
+
+				const unsigned shift = TVR_BITS + lvl*TVN_BITS;
+				const unsigned j = (w->jfs >> shift) & TVN_MASK;
+
+				tmrw_cascade(w, lvl, j);
+				if (j)
+					break;
+			}
+		}
+
+		w->bm1[i / 64] &= ~((uint64_t)1 << (i % 64));
+
+		while ((le = tv->head)) {
+
+			list_unlink(le);
+			list_append(tmrl, le, le->data);
+		}
+
+		++w->jfs;
+
+		/* skip empty slots, but stop at the next cascade */
+		if (!(w->jfs & TVR_MASK))
+			continue;
+
+		d = bitmap_find(w->bm1, TVR_SIZE, w->jfs & TVR_MASK);
+		if (d < 0 || (w->jfs & TVR_MASK) + d >= TVR_SIZE)
+			w->jfs = (w->jfs | TVR_MASK) + 1;
+		else
+			w->jfs += d;
+
+		if (w->jfs > now + 1)
+			w->jfs = now + 1;
+	}
+}
+
+
+/*
+ * Get the jiffy when the wheel next needs to be advanced, either
+ * because a timer expires or because a slot must be cascaded.
+ */
+static bool tmrw_next(struct tmrw *w, uint64_t *jfs)
+{
+	bool found = false;
+	unsigned lvl;
+	int d;
+
+	*jfs = 0;
+
+	for (;;) {
+		unsigned i;
+
+		d = bitmap_find(w->bm1, TVR_SIZE, w->jfs & TVR_MASK);
+		if (d < 0)
+			break;
+
+		i = (w->jfs + d) & TVR_MASK;
+
+		/* clear stale bits left by cancelled timers */
+		if (list_isempty(&w->tv1[i])) {
+			w->bm1[i / 64] &= ~((uint64_t)1 << (i % 64));
+			continue;
+		}
+
+		*jfs = w->jfs + d;
+		found = true;
+		break;
+	}
+
+	for (lvl=0; lvl<TVN_LEVELS; lvl++) {
+
+		const unsigned shift = TVR_BITS + lvl*TVN_BITS;
+		const uint64_t blk = w->jfs >> shift;
+		uint64_t cjfs;
+
+		for (;;) {
+			unsigned i;
+
+			d = bitmap_find(&w->bmn[lvl], TVN_SIZE,
+					(unsigned)(blk + 1) & TVN_MASK);
+			if (d < 0)
+				break;
+
+			i = (unsigned)(blk + 1 + d) & TVN_MASK;
+
+			if (list_isempty(&w->tvn[lvl][i])) {
+				w->bmn[lvl] &= ~((uint64_t)1 << i);
+				continue;
+			}
+
+			cjfs = (blk + 1 + d) << shift;
+
+			if (!found || cjfs < *jfs) {
+				*jfs = cjfs;
+				found = true;
+			}
+			break;
+		}
+	}
+
+	return found;
+}
+
+#else
 
 
 static bool inspos_handler(struct le *le, void *arg)
@@ -57,17 +324,19 @@ static bool inspos_handler_0(struct le *le, void *arg)
 	return tmr->jfs > now;
 }
 
+#endif
+
 
 #if TMR_DEBUG
 static void call_handler(tmr_h *th, void *arg)
 {
-	const uint64_t tick = tmr_jiffies();
+	const uint64_t tick = tmr_clock_us();
 	uint32_t diff;
 
 	/* Call handler */
 	th(arg);
 
-	diff = (uint32_t)(tmr_jiffies() - tick);
+	diff = (uint32_t)((tmr_clock_us() - tick) / 1000);
 
 	if (diff > MAX_BLOCKING) {
 		DEBUG_WARNING("long async blocking: %u>%u ms (h=%p arg=%p)\n",
@@ -77,6 +346,38 @@ static void call_handler(tmr_h *th, void *arg)
 #endif
 
 
+/**
+ * Free a timer wheel. Timers that are still running are stopped.
+ *
+ * @param wp Pointer to timer wheel
+ */
+void tmrw_free(struct tmrw **wp)
+{
+	struct tmrw *w;
+#ifdef USE_TMR_WHEEL
+	unsigned i, lvl;
+#endif
+
+	if (!wp || !*wp)
+		return;
+
+	w = *wp;
+
+#ifdef USE_TMR_WHEEL
+	for (i=0; i<TVR_SIZE; i++)
+		list_clear(&w->tv1[i]);
+
+	for (lvl=0; lvl<TVN_LEVELS; lvl++) {
+		for (i=0; i<TVN_SIZE; i++)
+			list_clear(&w->tvn[lvl][i]);
+	}
+#endif
+
+	free(w);
+	*wp = NULL;
+}
+
+
 /**
  * Poll all timers in the current thread
  *
@@ -85,6 +386,15 @@ static void call_handler(tmr_h *th, void *arg)
 void tmr_poll(struct list *tmrl)
 {
 	const uint64_t jfs = tmr_jiffies();
+	uint32_t n;
+#ifdef USE_TMR_WHEEL
+	struct tmrw *w = tmrw_lookup(false);
+
+	if (w)
+		tmrw_expire(w, tmrl, jfs);
+#endif
+
+	n = list_count(tmrl);
 
 	for (;;) {
 		struct tmr *tmr;
@@ -97,6 +407,15 @@ void tmr_poll(struct list *tmrl)
 			break;
 		}
 
+		/*
+		 * Timers started by the handlers with no delay are called
+		 * in this poll, until the clock has passed the cached jiffy
+		 */
+		if (n)
+			--n;
+		else if (tmr_clock_us() / 1000 > jfs)
+			break;
+
 		th = tmr->th;
 		th_arg = tmr->arg;
 
@@ -117,21 +436,31 @@ void tmr_poll(struct list *tmrl)
 
 
 /**
- * Get the timer jiffies in milliseconds
+ * Read the monotonic clock, bypassing the cached jiffies of the
+ * main polling loop
  *
- * @return Jiffies in [ms]
+ * @return Monotonic time in [us]
  */
-uint64_t tmr_jiffies(void)
+uint64_t tmr_clock_us(void)
 {
-	uint64_t jfs;
-
 #if defined(WIN32)
-	FILETIME ft;
-	ULARGE_INTEGER li;
-	GetSystemTimeAsFileTime(&ft);
-	li.LowPart = ft.dwLowDateTime;
-	li.HighPart = ft.dwHighDateTime;
-	jfs = li.QuadPart/10/1000;
+	LARGE_INTEGER freq, cnt;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&cnt);
+
+	return (uint64_t)(cnt.QuadPart / freq.QuadPart) * 1000000
+		+ (uint64_t)(cnt.QuadPart % freq.QuadPart) * 1000000
+		/ freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec now;
+
+	if (0 != clock_gettime(CLOCK_MONOTONIC, &now)) {
+		DEBUG_WARNING("jiffies: clock_gettime() failed (%m)\n", errno);
+		return 0;
+	}
+
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 #else
 	struct timeval now;
 
@@ -140,11 +469,34 @@ uint64_t tmr_jiffies(void)
 		return 0;
 	}
 
-	jfs  = (long)now.tv_sec * (uint64_t)1000;
-	jfs += now.tv_usec / 1000;
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
 #endif
+}
+
 
-	return jfs;
+/**
+ * Get the timer jiffies in microseconds. The jiffies are monotonic, and
+ * cached once per iteration of the polling loop of the calling thread.
+ *
+ * @return Jiffies in [us]
+ */
+uint64_t tmr_jiffies_us(void)
+{
+	const uint64_t *jfs = tmr_jfs_get();
+
+	return jfs ? *jfs : tmr_clock_us();
+}
+
+
+/**
+ * Get the timer jiffies in milliseconds. The jiffies are monotonic, and
+ * cached once per iteration of the polling loop of the calling thread.
+ *
+ * @return Jiffies in [ms]
+ */
+uint64_t tmr_jiffies(void)
+{
+	return tmr_jiffies_us() / 1000;
 }
 
 
@@ -159,40 +511,102 @@ uint64_t tmr_next_timeout(struct list *tmrl)
 {
 	const uint64_t jif = tmr_jiffies();
 	const struct tmr *tmr;
+	uint64_t jfs;
 
 	tmr = list_ledata(tmrl->head);
-	if (!tmr)
+	if (tmr) {
+		jfs = tmr->jfs;
+	}
+	else {
+#ifdef USE_TMR_WHEEL
+		struct tmrw *w = tmrw_lookup(false);
+
+		if (!w || !tmrw_next(w, &jfs))
+			return 0;
+#else
 		return 0;
+#endif
+	}
 
-	if (tmr->jfs <= jif)
+	if (jfs <= jif)
 		return 1;
 	else
-		return tmr->jfs - jif;
+		return jfs - jif;
+}
+
+
+static uint32_t tmr_count(const struct list *tmrl)
+{
+	uint32_t n = list_count(tmrl);
+#ifdef USE_TMR_WHEEL
+	const struct tmrw *w = tmrw_lookup(false);
+	unsigned i, lvl;
+
+	if (!w)
+		return n;
+
+	for (i=0; i<TVR_SIZE; i++)
+		n += list_count(&w->tv1[i]);
+
+	for (lvl=0; lvl<TVN_LEVELS; lvl++) {
+		for (i=0; i<TVN_SIZE; i++)
+			n += list_count(&w->tvn[lvl][i]);
+	}
+#endif
+
+	return n;
+}
+
+
+static int tmrl_status(struct re_printf *pf, const struct list *tmrl)
+{
+	struct le *le;
+	int err = 0;
+
+	for (le = tmrl->head; le; le = le->next) {
+		const struct tmr *tmr = le->data;
+
+		err |= re_hprintf(pf, "  %p: th=%p expire=%llums\n",
+				  tmr, tmr->th,
+				  (unsigned long long)tmr_get_expire(tmr));
+	}
+
+	return err;
 }
 
 
 int tmr_status(struct re_printf *pf, void *unused)
 {
 	struct list *tmrl = tmrl_get();
-	struct le *le;
 	uint32_t n;
 	int err;
+#ifdef USE_TMR_WHEEL
+	const struct tmrw *w;
+	unsigned i, lvl;
+#endif
 
 	(void)unused;
 
-	n = list_count(tmrl);
+	n = tmr_count(tmrl);
 	if (!n)
 		return 0;
 
 	err = re_hprintf(pf, "Timers (%u):\n", n);
 
-	for (le = tmrl->head; le; le = le->next) {
-		const struct tmr *tmr = le->data;
+	err |= tmrl_status(pf, tmrl);
 
-		err |= re_hprintf(pf, "  %p: th=%p expire=%llums\n",
-				  tmr, tmr->th,
-				  (unsigned long long)tmr_get_expire(tmr));
+#ifdef USE_TMR_WHEEL
+	w = tmrw_lookup(false);
+	if (w) {
+		for (i=0; i<TVR_SIZE; i++)
+			err |= tmrl_status(pf, &w->tv1[i]);
+
+		for (lvl=0; lvl<TVN_LEVELS; lvl++) {
+			for (i=0; i<TVN_SIZE; i++)
+				err |= tmrl_status(pf, &w->tvn[lvl][i]);
+		}
 	}
+#endif
 
 	if (n > 100)
 		err |= re_hprintf(pf, "    (Dumped Timers: %u)\n", n);
@@ -206,7 +620,7 @@ int tmr_status(struct re_printf *pf, void *unused)
  */
 void tmr_debug(void)
 {
-	if (!list_isempty(tmrl_get()))
+	if (tmr_count(tmrl_get()))
 		(void)re_fprintf(stderr, "%H", tmr_status, NULL);
 }
 
@@ -235,8 +649,12 @@ void tmr_init(struct tmr *tmr)
  */
 void tmr_start(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg)
 {
+#ifdef USE_TMR_WHEEL
+	struct tmrw *w;
+#else
 	struct list *tmrl = tmrl_get();
 	struct le *le;
+#endif
 
 	if (!tmr)
 		return;
@@ -253,6 +671,19 @@ void tmr_start(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg)
 
 	tmr->jfs = delay + tmr_jiffies();
 
+#ifdef USE_TMR_WHEEL
+	w = tmrw_lookup(true);
+	if (!w) {
+		tmr->th = NULL;
+		return;
+	}
+
+	/* The wheel has passed it, call it from the current tmr_poll() */
+	if (tmr->jfs < w->jfs)
+		list_append(tmrl_get(), &tmr->le, tmr);
+	else
+		tmrw_insert(w, tmr);
+#else
 	if (delay == 0) {
 		le = list_apply(tmrl, true, inspos_handler_0, &tmr->jfs);
 		if (le) {
@@ -271,6 +702,7 @@ void tmr_start(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg)
 			list_prepend(tmrl, &tmr->le, tmr);
 		}
 	}
+#endif
 }
 
 
@@ -26,20 +26,20 @@ enum {
 
 
 struct channels {
-	struct hash *ht_numb;
+	struct intmap *numb;
 	struct hash *ht_peer;
 	uint16_t nr;
 };
 
 
 struct chan {
-	struct le he_numb;
 	struct le he_peer;
 	struct loop_state ls;
 	uint16_t nr;
 	struct sa peer;
 	struct tmr tmr;
 	struct turnc *turnc;
+	struct intmap *numb;
 	struct stun_ctrans *ct;
 	turnc_chan_h *ch;
 	void *arg;
@@ -53,10 +53,10 @@ static void channels_destructor(void *data)
 {
 	struct channels *c = data;
 
-	/* flush from primary hash */
-	hash_flush(c->ht_numb);
+	/* flush from primary map */
+	intmap_flush(c->numb);
 
-	mem_deref(c->ht_numb);
+	mem_deref(c->numb);
 	mem_deref(c->ht_peer);
 }
 
@@ -67,20 +67,11 @@ static void chan_destructor(void *data)
 
 	tmr_cancel(&chan->tmr);
 	mem_deref(chan->ct);
-	hash_unlink(&chan->he_numb);
+	intmap_remove(chan->numb, chan->nr);
 	hash_unlink(&chan->he_peer);
 }
 
 
-static bool numb_hash_cmp_handler(struct le *le, void *arg)
-{
-	const struct chan *chan = le->data;
-	const uint16_t *nr = arg;
-
-	return chan->nr == *nr;
-}
-
-
 static bool peer_hash_cmp_handler(struct le *le, void *arg)
 {
 	const struct chan *chan = le->data;
@@ -193,7 +184,13 @@ int turnc_add_chan(struct turnc *turnc, const struct sa *peer,
 	chan->nr = turnc->chans->nr++;
 	chan->peer = *peer;
 
-	hash_append(turnc->chans->ht_numb, chan->nr, &chan->he_numb, chan);
+	err = intmap_add(turnc->chans->numb, chan->nr, chan);
+	if (err) {
+		mem_deref(chan);
+		return err;
+	}
+
+	chan->numb = turnc->chans->numb;
 	hash_append(turnc->chans->ht_peer, sa_hash(peer, SA_ALL),
 		    &chan->he_peer, chan);
 
@@ -222,7 +219,7 @@ int turnc_chan_hash_alloc(struct channels **cp, uint32_t bsize)
 	if (!c)
 		return ENOMEM;
 
-	err = hash_alloc(&c->ht_numb, bsize);
+	err = intmap_alloc(&c->numb, bsize);
 	if (err)
 		goto out;
 
@@ -247,8 +244,7 @@ struct chan *turnc_chan_find_numb(const struct turnc *turnc, uint16_t nr)
 	if (!turnc)
 		return NULL;
 
-	return list_ledata(hash_lookup(turnc->chans->ht_numb, nr,
-				       numb_hash_cmp_handler, &nr));
+	return intmap_find(turnc->chans->numb, nr);
 }
 
 
@@ -6,3 +6,8 @@
 
 SRCS	+= udp/udp.c
 SRCS	+= udp/mcast.c
+
+ifeq ($(OS),linux)
+CFLAGS  += -DHAVE_RECVMMSG
+CFLAGS  += -DHAVE_SENDMMSG
+endif
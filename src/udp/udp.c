@@ -3,6 +3,9 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#if defined (HAVE_RECVMMSG) || defined (HAVE_SENDMMSG)
+#define _GNU_SOURCE 1
+#endif
 #include <stdlib.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -15,6 +18,12 @@
 #define __USE_XOPEN2K 1/**< Use POSIX.1:2001 code */
 #include <netdb.h>
 #endif
+#if defined (HAVE_RECVMMSG) || defined (HAVE_SENDMMSG)
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_SENDMMSG
+#include <netinet/udp.h>
+#endif
 #include <string.h>
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -52,7 +61,39 @@
 
 
 enum {
-	UDP_RXSZ_DEFAULT = 8192
+	UDP_RXSZ_DEFAULT = 8192,
+	UDP_TXBATCH_MAX  = 64,     /**< Max queued datagrams per socket */
+	UDP_GSO_MAXSZ    = 65000,  /**< Max total size of a GSO send    */
+};
+
+
+/** Defines a pool of receive buffers for batched receive */
+struct udp_rxbatch {
+	struct mbuf **mbv;        /**< Receive buffers             */
+	struct sa *srcv;          /**< Source addresses            */
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr *msgv;     /**< Message headers             */
+	struct iovec *iov;        /**< I/O vectors                 */
+#endif
+	unsigned n;               /**< Number of buffers           */
+};
+
+/** Defines a queued datagram for batched send */
+struct udp_txent {
+	struct mbuf *mb;          /**< Datagram buffer             */
+	struct sa dst;            /**< Destination address         */
+	int fd;                   /**< Socket file descriptor      */
+};
+
+/** Defines a queue of datagrams for batched send */
+struct udp_txbatch {
+	struct udp_txent entv[UDP_TXBATCH_MAX];  /**< Queued datagrams */
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgv[UDP_TXBATCH_MAX];    /**< Message headers  */
+	struct iovec iov[UDP_TXBATCH_MAX];       /**< I/O vectors      */
+	bool nogso;               /**< UDP GSO is not supported    */
+#endif
+	unsigned n;               /**< Number of queued datagrams  */
 };
 
 
@@ -67,6 +108,8 @@ struct udp_sock {
 	bool conn;           /**< Connected socket flag       */
 	size_t rxsz;         /**< Maximum receive chunk size  */
 	size_t rx_presz;     /**< Preallocated rx buffer size */
+	struct udp_rxbatch *rxb; /**< Batched receive, optional  */
+	struct udp_txbatch *txb; /**< Batched send, optional     */
 };
 
 /** Defines a UDP helper */
@@ -114,6 +157,8 @@ static void udp_destructor(void *data)
 	struct udp_sock *us = data;
 
 	list_flush(&us->helpers);
+	mem_deref(us->rxb);
+	mem_deref(us->txb);
 
 	if (-1 != us->fd) {
 		fd_close(us->fd);
@@ -127,81 +172,70 @@ static void udp_destructor(void *data)
 }
 
 
-static void udp_read(struct udp_sock *us, int fd)
+/*
+ * Handle a receive error. Returns true if more datagrams may be queued
+ * behind it, e.g. after an ICMP error, and false if the read would block.
+ */
+static bool udp_read_error(struct udp_sock *us, int err)
 {
-	struct mbuf *mb = mbuf_alloc(us->rxsz);
-	struct sa src;
-	struct le *le;
-	int err = 0;
-	ssize_t n;
-
-	if (!mb)
-		return;
-
-	src.len = sizeof(src.u);
-	n = recvfrom(fd, BUF_CAST mb->buf + us->rx_presz,
-		     mb->size - us->rx_presz, 0,
-		     &src.u.sa, &src.len);
-	if (n < 0) {
-		err = errno;
-
-		if (EAGAIN == err)
-			goto out;
+	if (EAGAIN == err)
+		return false;
 
 #ifdef EWOULDBLOCK
-		if (EWOULDBLOCK == err)
-			goto out;
+	if (EWOULDBLOCK == err)
+		return false;
 #endif
 
 #if TARGET_OS_IPHONE
-		if (ENOTCONN == err) {
+	if (ENOTCONN == err) {
 
-			struct udp_sock *us_new;
-			struct sa laddr;
+		struct udp_sock *us_new;
+		struct sa laddr;
 
-			err = udp_local_get(us, &laddr);
-			if (err)
-				goto out;
+		err = udp_local_get(us, &laddr);
+		if (err)
+			return false;
 
-			if (-1 != us->fd) {
-				fd_close(us->fd);
-				(void)close(us->fd);
-				us->fd = -1;
-			}
+		if (-1 != us->fd) {
+			fd_close(us->fd);
+			(void)close(us->fd);
+			us->fd = -1;
+		}
 
-			if (-1 != us->fd6) {
-				fd_close(us->fd6);
-				(void)close(us->fd6);
-				us->fd6 = -1;
-			}
+		if (-1 != us->fd6) {
+			fd_close(us->fd6);
+			(void)close(us->fd6);
+			us->fd6 = -1;
+		}
 
-			err = udp_listen(&us_new, &laddr, NULL, NULL);
-			if (err)
-				goto out;
+		err = udp_listen(&us_new, &laddr, NULL, NULL);
+		if (err)
+			return false;
 
-			us->fd  = us_new->fd;
-			us->fd6 = us_new->fd6;
+		us->fd  = us_new->fd;
+		us->fd6 = us_new->fd6;
 
-			us_new->fd  = -1;
-			us_new->fd6 = -1;
+		us_new->fd  = -1;
+		us_new->fd6 = -1;
 
-			mem_deref(us_new);
+		mem_deref(us_new);
 
-			udp_thread_attach(us);
+		udp_thread_attach(us);
 
-			goto out;
-		}
+		return false;
+	}
 #endif
-		if (us->eh)
-			us->eh(err, us->arg);
+	if (us->eh)
+		us->eh(err, us->arg);
 
-		goto out;
-	}
+	return true;
+}
 
-	mb->pos = us->rx_presz;
-	mb->end = n + us->rx_presz;
 
-	(void)mbuf_resize(mb, mb->end);
+static void udp_recv_packet(struct udp_sock *us, struct sa *src,
+			    struct mbuf *mb)
+{
+	struct le *le;
 
 	/* call helpers */
 	le = us->helpers.head;
@@ -211,15 +245,194 @@ static void udp_read(struct udp_sock *us, int fd)
 
 		le = le->next;
 
-		hdld = uh->recvh(&src, mb, uh->arg);
+		hdld = uh->recvh(src, mb, uh->arg);
 		if (hdld)
-			goto out;
+			return;
 	}
 
-	us->rh(&src, mb, us->arg);
+	us->rh(src, mb, us->arg);
+}
+
+
+/* Read one datagram, returns true if more datagrams may be pending */
+static bool udp_read(struct udp_sock *us, int fd)
+{
+	struct mbuf *mb = mbuf_alloc(us->rxsz);
+	struct sa src;
+	ssize_t n;
+	bool more = true;
+
+	if (!mb)
+		return false;
+
+	src.len = sizeof(src.u);
+	n = recvfrom(fd, BUF_CAST mb->buf + us->rx_presz,
+		     mb->size - us->rx_presz, 0,
+		     &src.u.sa, &src.len);
+	if (n < 0) {
+		more = udp_read_error(us, errno);
+		goto out;
+	}
+
+	mb->pos = us->rx_presz;
+	mb->end = n + us->rx_presz;
+
+	(void)mbuf_resize(mb, mb->end);
+
+	udp_recv_packet(us, &src, mb);
 
  out:
 	mem_deref(mb);
+
+	return more;
+}
+
+
+/* Get a receive buffer from the pool, allocating it if needed */
+static struct mbuf *rxbatch_mbuf(struct udp_sock *us,
+				 struct udp_rxbatch *rb, unsigned i)
+{
+	struct mbuf *mb = rb->mbv[i];
+
+	if (!mb) {
+		mb = mbuf_alloc(us->rxsz);
+		if (!mb)
+			return NULL;
+
+		rb->mbv[i] = mb;
+	}
+	else if (mb->size < us->rxsz) {
+		if (mbuf_resize(mb, us->rxsz))
+			return NULL;
+	}
+
+	return mb;
+}
+
+
+/* Put back a receive buffer, unless the handlers kept a reference */
+static void rxbatch_recycle(struct udp_rxbatch *rb, unsigned i)
+{
+	if (mem_nrefs(rb->mbv[i]) > 1)
+		rb->mbv[i] = mem_deref(rb->mbv[i]);
+}
+
+
+/*
+ * Read up to rb->n datagrams, and call the handlers for each of them.
+ * Returns true if the batch was filled, or a receive error was handled,
+ * and more datagrams may be pending.
+ */
+static bool udp_read_batch(struct udp_sock *us, struct udp_rxbatch *rb,
+			   int fd)
+{
+	unsigned i;
+#ifdef HAVE_RECVMMSG
+	int n;
+
+	for (i=0; i<rb->n; i++) {
+		struct mbuf *mb = rxbatch_mbuf(us, rb, i);
+
+		if (!mb)
+			break;
+
+		rb->iov[i].iov_base = mb->buf + us->rx_presz;
+		rb->iov[i].iov_len  = mb->size - us->rx_presz;
+
+		memset(&rb->msgv[i], 0, sizeof(rb->msgv[i]));
+		rb->msgv[i].msg_hdr.msg_name    = &rb->srcv[i].u;
+		rb->msgv[i].msg_hdr.msg_namelen = sizeof(rb->srcv[i].u);
+		rb->msgv[i].msg_hdr.msg_iov     = &rb->iov[i];
+		rb->msgv[i].msg_hdr.msg_iovlen  = 1;
+	}
+
+	if (!i)
+		return false;
+
+	n = recvmmsg(fd, rb->msgv, i, 0, NULL);
+	if (n < 0)
+		return udp_read_error(us, errno);
+
+	for (i=0; i<(unsigned)n; i++) {
+		struct mbuf *mb = rb->mbv[i];
+
+		rb->srcv[i].len = rb->msgv[i].msg_hdr.msg_namelen;
+
+		mb->pos = us->rx_presz;
+		mb->end = us->rx_presz + rb->msgv[i].msg_len;
+
+		udp_recv_packet(us, &rb->srcv[i], mb);
+
+		/* check if socket was deref'd from handler */
+		if (mem_nrefs(us) == 1)
+			return false;
+
+		rxbatch_recycle(rb, i);
+	}
+
+	return (unsigned)n == rb->n;
+#else
+	for (i=0; i<rb->n; i++) {
+		struct mbuf *mb = rxbatch_mbuf(us, rb, i);
+		struct sa *src = &rb->srcv[i];
+		ssize_t n;
+
+		if (!mb)
+			break;
+
+		src->len = sizeof(src->u);
+		n = recvfrom(fd, BUF_CAST mb->buf + us->rx_presz,
+			     mb->size - us->rx_presz, 0,
+			     &src->u.sa, &src->len);
+		if (n < 0)
+			return udp_read_error(us, errno);
+
+		mb->pos = us->rx_presz;
+		mb->end = n + us->rx_presz;
+
+		udp_recv_packet(us, src, mb);
+
+		/* check if socket was deref'd from handler */
+		if (mem_nrefs(us) == 1)
+			return false;
+
+		rxbatch_recycle(rb, i);
+	}
+
+	return i == rb->n;
+#endif
+}
+
+
+static void udp_read_fd(struct udp_sock *us, int fd, int flags)
+{
+	bool more;
+
+	if (!us->rxb && !(flags & FD_EDGE)) {
+		(void)udp_read(us, fd);
+		return;
+	}
+
+	mem_ref(us);
+
+	/* edge-triggered: read until EAGAIN */
+	do {
+		struct udp_rxbatch *rb = mem_ref(us->rxb);
+
+		if (rb)
+			more = udp_read_batch(us, rb, fd);
+		else
+			more = udp_read(us, fd);
+
+		mem_deref(rb);
+
+		/* check if socket was deref'd from handler */
+		if (mem_nrefs(us) == 1)
+			break;
+
+	} while (more && (flags & FD_EDGE));
+
+	mem_deref(us);
 }
 
 
@@ -227,9 +440,7 @@ static void udp_read_handler(int flags, void *arg)
 {
 	struct udp_sock *us = arg;
 
-	(void)flags;
-
-	udp_read(us, us->fd);
+	udp_read_fd(us, us->fd, flags);
 }
 
 
@@ -237,24 +448,12 @@ static void udp_read_handler6(int flags, void *arg)
 {
 	struct udp_sock *us = arg;
 
-	(void)flags;
-
-	udp_read(us, us->fd6);
+	udp_read_fd(us, us->fd6, flags);
 }
 
 
-/**
- * Create and listen on a UDP Socket
- *
- * @param usp   Pointer to returned UDP Socket
- * @param local Local network address
- * @param rh    Receive handler
- * @param arg   Handler argument
- *
- * @return 0 if success, otherwise errorcode
- */
-int udp_listen(struct udp_sock **usp, const struct sa *local,
-	       udp_recv_h *rh, void *arg)
+static int listen_sock(struct udp_sock **usp, const struct sa *local,
+		       udp_recv_h *rh, void *arg, bool reuseport)
 {
 	struct addrinfo hints, *res = NULL, *r;
 	struct udp_sock *us = NULL;
@@ -329,6 +528,15 @@ int udp_listen(struct udp_sock **usp, const struct sa *local,
 			continue;
 		}
 
+#ifdef SO_REUSEPORT
+		if (reuseport) {
+			int on = 1;
+
+			(void)setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+					 BUF_CAST &on, sizeof(on));
+		}
+#endif
+
 		if (bind(fd, r->ai_addr, SIZ_CAST r->ai_addrlen) < 0) {
 			err = errno;
 			DEBUG_INFO("listen: bind(): %m (%J)\n", err, local);
@@ -391,6 +599,51 @@ int udp_listen(struct udp_sock **usp, const struct sa *local,
 }
 
 
+/**
+ * Create and listen on a UDP Socket
+ *
+ * @param usp   Pointer to returned UDP Socket
+ * @param local Local network address
+ * @param rh    Receive handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_listen(struct udp_sock **usp, const struct sa *local,
+	       udp_recv_h *rh, void *arg)
+{
+	return listen_sock(usp, local, rh, arg, false);
+}
+
+
+/**
+ * Create and listen on a UDP Socket that shares its port with other
+ * sockets, using SO_REUSEPORT. The kernel distributes the flows between
+ * the sockets, e.g. one per event loop in the pool (see re_pool_start()).
+ *
+ * @param usp   Pointer to returned UDP Socket
+ * @param local Local network address
+ * @param rh    Receive handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_listen_reuseport(struct udp_sock **usp, const struct sa *local,
+			 udp_recv_h *rh, void *arg)
+{
+#ifdef SO_REUSEPORT
+	return listen_sock(usp, local, rh, arg, true);
+#else
+	(void)usp;
+	(void)local;
+	(void)rh;
+	(void)arg;
+
+	return ENOTSUP;
+#endif
+}
+
+
 /**
  * Connect a UDP Socket to a specific peer.
  * When connected, this UDP Socket will only receive data from that peer.
@@ -422,33 +675,49 @@ int udp_connect(struct udp_sock *us, const struct sa *peer)
 }
 
 
-static int udp_send_internal(struct udp_sock *us, const struct sa *dst,
-			     struct mbuf *mb, struct le *le)
+static int udp_sock_select(const struct udp_sock *us, const struct sa *dst)
 {
-	struct sa hdst;
-	int err = 0, fd;
-
 	/* choose a socket */
 	if (AF_INET6 == sa_af(dst) && -1 != us->fd6)
-		fd = us->fd6;
+		return us->fd6;
 	else
-		fd = us->fd;
+		return us->fd;
+}
+
 
-	/* call helpers in reverse order */
+/* Call the send helpers in reverse order, returns true if handled */
+static bool udp_send_helpers(int *err, const struct sa **dst,
+			     struct sa *hdst, struct mbuf *mb, struct le *le)
+{
 	while (le) {
 		struct udp_helper *uh = le->data;
 
 		le = le->prev;
 
-		if (dst != &hdst) {
-			sa_cpy(&hdst, dst);
-			dst = &hdst;
+		if (*dst != hdst) {
+			sa_cpy(hdst, *dst);
+			*dst = hdst;
 		}
 
-		if (uh->sendh(&err, &hdst, mb, uh->arg) || err)
-			return err;
+		if (uh->sendh(err, hdst, mb, uh->arg) || *err)
+			return true;
 	}
 
+	return false;
+}
+
+
+static int udp_send_internal(struct udp_sock *us, const struct sa *dst,
+			     struct mbuf *mb, struct le *le)
+{
+	struct sa hdst;
+	int err = 0, fd;
+
+	fd = udp_sock_select(us, dst);
+
+	if (udp_send_helpers(&err, &dst, &hdst, mb, le))
+		return err;
+
 	/* Connected socket? */
 	if (us->conn) {
 		if (send(fd, BUF_CAST mb->buf + mb->pos, mb->end - mb->pos,
@@ -465,6 +734,184 @@ static int udp_send_internal(struct udp_sock *us, const struct sa *dst,
 }
 
 
+static void txbatch_destructor(void *data)
+{
+	struct udp_txbatch *tb = data;
+	unsigned i;
+
+	for (i=0; i<tb->n; i++)
+		mem_deref(tb->entv[i].mb);
+}
+
+
+#ifdef HAVE_SENDMMSG
+#ifdef UDP_SEGMENT
+/*
+ * Check if datagrams can be sent with UDP GSO, i.e. all to the same peer
+ * and of equal size, except for the last one which may be shorter.
+ */
+static bool txbatch_gso_check(const struct udp_txbatch *tb,
+			      unsigned i, unsigned cnt)
+{
+	const size_t segsz = tb->iov[i].iov_len;
+	size_t total = 0;
+	unsigned j;
+
+	if (tb->nogso || cnt < 2 || !segsz)
+		return false;
+
+	for (j=i; j<i+cnt; j++) {
+
+		const size_t sz = tb->iov[j].iov_len;
+
+		if (sz > segsz || (sz < segsz && j != i+cnt-1))
+			return false;
+
+		if (!sa_cmp(&tb->entv[j].dst, &tb->entv[i].dst, SA_ALL))
+			return false;
+
+		total += sz;
+	}
+
+	return total <= UDP_GSO_MAXSZ;
+}
+
+
+static int txbatch_send_gso(struct udp_sock *us, struct udp_txbatch *tb,
+			    unsigned i, unsigned cnt)
+{
+	char ctrl[CMSG_SPACE(sizeof(uint16_t))];
+	const uint16_t segsz = (uint16_t)tb->iov[i].iov_len;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(ctrl, 0, sizeof(ctrl));
+
+	if (!us->conn) {
+		msg.msg_name    = &tb->entv[i].dst.u;
+		msg.msg_namelen = tb->entv[i].dst.len;
+	}
+	msg.msg_iov        = &tb->iov[i];
+	msg.msg_iovlen     = cnt;
+	msg.msg_control    = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = IPPROTO_UDP;
+	cm->cmsg_type  = UDP_SEGMENT;
+	cm->cmsg_len   = CMSG_LEN(sizeof(segsz));
+	memcpy(CMSG_DATA(cm), &segsz, sizeof(segsz));
+
+	if (sendmsg(tb->entv[i].fd, &msg, 0) < 0)
+		return errno;
+
+	return 0;
+}
+#endif
+
+
+static int txbatch_send(struct udp_sock *us, struct udp_txbatch *tb,
+			unsigned i, unsigned cnt)
+{
+	const int fd = tb->entv[i].fd;
+
+#ifdef UDP_SEGMENT
+	if (txbatch_gso_check(tb, i, cnt)) {
+
+		int err = txbatch_send_gso(us, tb, i, cnt);
+
+		switch (err) {
+
+		case EIO:
+		case ENOPROTOOPT:
+			DEBUG_INFO("UDP GSO not supported (%m)\n", err);
+			tb->nogso = true;
+			break;
+
+		case EINVAL:
+			/* Limits of this batch, send it without GSO */
+			break;
+
+		default:
+			return err;
+		}
+	}
+#else
+	(void)us;
+#endif
+
+	while (cnt) {
+		int n = sendmmsg(fd, &tb->msgv[i], cnt, 0);
+		if (n < 0)
+			return errno;
+
+		i   += n;
+		cnt -= n;
+	}
+
+	return 0;
+}
+#else
+
+
+static int txbatch_send(struct udp_sock *us, struct udp_txbatch *tb,
+			unsigned i, unsigned cnt)
+{
+	int err = 0;
+
+	for (; cnt; i++, cnt--) {
+
+		const struct udp_txent *ent = &tb->entv[i];
+		const struct mbuf *mb = ent->mb;
+		ssize_t n;
+
+		if (us->conn)
+			n = send(ent->fd, BUF_CAST mb->buf + mb->pos,
+				 mb->end - mb->pos, 0);
+		else
+			n = sendto(ent->fd, BUF_CAST mb->buf + mb->pos,
+				   mb->end - mb->pos, 0,
+				   &ent->dst.u.sa, ent->dst.len);
+		if (n < 0 && !err)
+			err = errno;
+	}
+
+	return err;
+}
+#endif
+
+
+static int txbatch_flush(struct udp_sock *us, struct udp_txbatch *tb)
+{
+	unsigned i = 0;
+	int err = 0;
+
+	/* send runs of datagrams on the same socket */
+	while (i < tb->n) {
+
+		unsigned j = i + 1;
+		int e;
+
+		while (j < tb->n && tb->entv[j].fd == tb->entv[i].fd)
+			++j;
+
+		e = txbatch_send(us, tb, i, j - i);
+		if (e && !err)
+			err = e;
+
+		i = j;
+	}
+
+	for (i=0; i<tb->n; i++)
+		tb->entv[i].mb = mem_deref(tb->entv[i].mb);
+
+	tb->n = 0;
+
+	return err;
+}
+
+
 /**
  * Send a UDP Datagram to a peer
  *
@@ -483,6 +930,90 @@ int udp_send(struct udp_sock *us, const struct sa *dst, struct mbuf *mb)
 }
 
 
+/**
+ * Queue a UDP Datagram for batched send. The send helpers are called
+ * immediately, and the datagram is sent on the next call to
+ * udp_send_flush(), or when the queue is full.
+ *
+ * @param us  UDP Socket
+ * @param dst Destination network address
+ * @param mb  Buffer to send, must not be modified until flushed
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_send_batch(struct udp_sock *us, const struct sa *dst,
+		   struct mbuf *mb)
+{
+	struct udp_txbatch *tb;
+	struct udp_txent *ent;
+	struct sa hdst;
+	int err = 0, fd;
+
+	if (!us || !dst || !mb)
+		return EINVAL;
+
+	if (!us->txb) {
+		us->txb = mem_zalloc(sizeof(*us->txb), txbatch_destructor);
+		if (!us->txb)
+			return ENOMEM;
+	}
+
+	tb = us->txb;
+
+	fd = udp_sock_select(us, dst);
+
+	if (udp_send_helpers(&err, &dst, &hdst, mb, us->helpers.tail))
+		return err;
+
+	if (tb->n >= UDP_TXBATCH_MAX)
+		err = txbatch_flush(us, tb);
+
+	ent = &tb->entv[tb->n];
+
+	ent->mb = mem_ref(mb);
+	ent->fd = fd;
+	sa_cpy(&ent->dst, dst);
+
+#ifdef HAVE_SENDMMSG
+	tb->iov[tb->n].iov_base = mb->buf + mb->pos;
+	tb->iov[tb->n].iov_len  = mb->end - mb->pos;
+
+	memset(&tb->msgv[tb->n], 0, sizeof(tb->msgv[tb->n]));
+	if (!us->conn) {
+		tb->msgv[tb->n].msg_hdr.msg_name    = &ent->dst.u;
+		tb->msgv[tb->n].msg_hdr.msg_namelen = ent->dst.len;
+	}
+	tb->msgv[tb->n].msg_hdr.msg_iov    = &tb->iov[tb->n];
+	tb->msgv[tb->n].msg_hdr.msg_iovlen = 1;
+#endif
+
+	++tb->n;
+
+	return err;
+}
+
+
+/**
+ * Send all UDP Datagrams queued with udp_send_batch(). On Linux the
+ * datagrams are sent with sendmmsg(), or with UDP GSO if they are all
+ * sent to the same peer.
+ *
+ * @param us UDP Socket
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_send_flush(struct udp_sock *us)
+{
+	if (!us)
+		return EINVAL;
+
+	if (!us->txb)
+		return 0;
+
+	return txbatch_flush(us, us->txb);
+}
+
+
 /**
  * Send an anonymous UDP Datagram to a peer
  *
@@ -624,6 +1155,72 @@ void udp_rxbuf_presz_set(struct udp_sock *us, size_t rx_presz)
 }
 
 
+static void rxbatch_destructor(void *data)
+{
+	struct udp_rxbatch *rb = data;
+	unsigned i;
+
+	for (i=0; i<rb->n; i++)
+		mem_deref(rb->mbv[i]);
+
+	mem_deref(rb->mbv);
+	mem_deref(rb->srcv);
+#ifdef HAVE_RECVMMSG
+	mem_deref(rb->msgv);
+	mem_deref(rb->iov);
+#endif
+}
+
+
+/**
+ * Set batched receive on a UDP Socket. Up to n datagrams are read for
+ * each read event, into a pool of receive buffers owned by the socket.
+ * The receive buffers are reused for the next datagrams, unless a
+ * reference is kept by the receive handler.
+ *
+ * @param us UDP Socket
+ * @param n  Maximum number of datagrams per read event, 0 to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_rxbatch_set(struct udp_sock *us, unsigned n)
+{
+	struct udp_rxbatch *rb;
+
+	if (!us)
+		return EINVAL;
+
+	us->rxb = mem_deref(us->rxb);
+
+	if (!n)
+		return 0;
+
+	rb = mem_zalloc(sizeof(*rb), rxbatch_destructor);
+	if (!rb)
+		return ENOMEM;
+
+	rb->mbv  = mem_zalloc(n * sizeof(*rb->mbv), NULL);
+	rb->srcv = mem_zalloc(n * sizeof(*rb->srcv), NULL);
+#ifdef HAVE_RECVMMSG
+	rb->msgv = mem_zalloc(n * sizeof(*rb->msgv), NULL);
+	rb->iov  = mem_zalloc(n * sizeof(*rb->iov), NULL);
+	if (!rb->msgv || !rb->iov)
+		goto nomem;
+#endif
+	if (!rb->mbv || !rb->srcv)
+		goto nomem;
+
+	rb->n = n;
+	us->rxb = rb;
+
+	return 0;
+
+ nomem:
+	mem_deref(rb);
+	return ENOMEM;
+}
+
+
 /**
  * Set receive handler on a UDP Socket
  *
@@ -693,13 +1290,15 @@ int udp_thread_attach(struct udp_sock *us)
 		return EINVAL;
 
 	if (-1 != us->fd) {
-		err = fd_listen(us->fd, FD_READ, udp_read_handler, us);
+		err = fd_listen(us->fd, FD_READ | FD_EDGE,
+				udp_read_handler, us);
 		if (err)
 			goto out;
 	}
 
 	if (-1 != us->fd6) {
-		err = fd_listen(us->fd6, FD_READ, udp_read_handler6, us);
+		err = fd_listen(us->fd6, FD_READ | FD_EDGE,
+				udp_read_handler6, us);
 		if (err)
 			goto out;
 	}
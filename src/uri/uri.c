@@ -79,14 +79,16 @@ int uri_encode(struct re_printf *pf, const struct uri *uri)
 static int decode_hostport(const struct pl *hostport, struct pl *host,
 			   struct pl *port)
 {
+	static struct regex *rx_ipv6, *rx_host;
+
 	/* Try IPv6 first */
-	if (!re_regex(hostport->p, hostport->l, "\\[[0-9a-f:]+\\][:]*[0-9]*",
-		      host, NULL, port))
+	if (!re_regex_cached(&rx_ipv6, hostport->p, hostport->l,
+			     "\\[[0-9a-f:]+\\][:]*[0-9]*", host, NULL, port))
 		return 0;
 
 	/* Then non-IPv6 host */
-	return re_regex(hostport->p, hostport->l, "[^:]+[:]*[0-9]*",
-			host, NULL, port);
+	return re_regex_cached(&rx_host, hostport->p, hostport->l,
+			       "[^:]+[:]*[0-9]*", host, NULL, port);
 }
 
 
@@ -100,6 +102,7 @@ static int decode_hostport(const struct pl *hostport, struct pl *host,
  */
 int uri_decode(struct uri *uri, const struct pl *pl)
 {
+	static struct regex *rx_user, *rx_host;
 	struct sa addr;
 	struct pl port = PL_INIT;
 	struct pl hostport;
@@ -109,18 +112,20 @@ int uri_decode(struct uri *uri, const struct pl *pl)
 		return EINVAL;
 
 	memset(uri, 0, sizeof(*uri));
-	if (0 == re_regex(pl->p, pl->l,
-			  "[^:]+:[^@:]*[:]*[^@]*@[^;? ]+[^?]*[^]*",
-			  &uri->scheme, &uri->user, NULL, &uri->password,
-			  &hostport, &uri->params, &uri->headers)) {
+	if (0 == re_regex_cached(&rx_user, pl->p, pl->l,
+				 "[^:]+:[^@:]*[:]*[^@]*@[^;? ]+[^?]*[^]*",
+				 &uri->scheme, &uri->user, NULL,
+				 &uri->password, &hostport, &uri->params,
+				 &uri->headers)) {
 
 		if (0 == decode_hostport(&hostport, &uri->host, &port))
 			goto out;
 	}
 
 	memset(uri, 0, sizeof(*uri));
-	err = re_regex(pl->p, pl->l, "[^:]+:[^;? ]+[^?]*[^]*",
-		       &uri->scheme, &hostport, &uri->params, &uri->headers);
+	err = re_regex_cached(&rx_host, pl->p, pl->l, "[^:]+:[^;? ]+[^?]*[^]*",
+			      &uri->scheme, &hostport, &uri->params,
+			      &uri->headers);
 	if (0 == err) {
 		err = decode_hostport(&hostport, &uri->host, &port);
 		if (0 == err)
@@ -177,6 +182,7 @@ int uri_param_get(const struct pl *pl, const struct pl *pname,
  */
 int uri_params_apply(const struct pl *pl, uri_apply_h *ah, void *arg)
 {
+	static struct regex *rx;
 	struct pl plr, pname, eq, pvalue;
 	int err = 0;
 
@@ -187,8 +193,8 @@ int uri_params_apply(const struct pl *pl, uri_apply_h *ah, void *arg)
 
 	while (plr.l > 0) {
 
-		err = re_regex(plr.p, plr.l, ";[^;=]+[=]*[^;]*",
-			       &pname, &eq, &pvalue);
+		err = re_regex_cached(&rx, plr.p, plr.l, ";[^;=]+[=]*[^;]*",
+				      &pname, &eq, &pvalue);
 		if (err)
 			break;
 
@@ -237,6 +243,7 @@ int uri_header_get(const struct pl *pl, const struct pl *hname,
  */
 int uri_headers_apply(const struct pl *pl, uri_apply_h *ah, void *arg)
 {
+	static struct regex *rx;
 	struct pl plr, sep, hname, hvalue;
 	int err = 0;
 
@@ -247,8 +254,8 @@ int uri_headers_apply(const struct pl *pl, uri_apply_h *ah, void *arg)
 
 	while (plr.l > 0) {
 
-		err = re_regex(plr.p, plr.l, "[?&]1[^=]+=[^&]+",
-			       &sep, &hname, &hvalue);
+		err = re_regex_cached(&rx, plr.p, plr.l, "[?&]1[^=]+=[^&]+",
+				      &sep, &hname, &hvalue);
 		if (err)
 			break;
 